@@ -0,0 +1,139 @@
+#include "batch_scheduler.hpp"
+#include "shared/math_base.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <omp.h>
+#include <thread>
+
+struct ScheduledJob
+{
+    const BatchJob* job = nullptr;
+    int teamSize        = 1;
+};
+
+struct WorkerQueue
+{
+    std::mutex lock;
+    std::deque<ScheduledJob> jobs;
+};
+
+// The owner pops from the back of its own queue, thieves take from the front of the others
+static bool GetNextJob( std::vector<WorkerQueue>& queues, size_t workerIdx, ScheduledJob& job )
+{
+    {
+        WorkerQueue& own = queues[workerIdx];
+        std::scoped_lock guard( own.lock );
+        if ( !own.jobs.empty() )
+        {
+            job = own.jobs.back();
+            own.jobs.pop_back();
+            return true;
+        }
+    }
+
+    for ( size_t i = 1; i < queues.size(); ++i )
+    {
+        WorkerQueue& victim = queues[( workerIdx + i ) % queues.size()];
+        std::scoped_lock guard( victim.lock );
+        if ( !victim.jobs.empty() )
+        {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Hands out the threads of the batch to the jobs, in the order that they were requested, so a job that needs a big team can't
+// be starved by a stream of small ones
+class ThreadBudget
+{
+public:
+    explicit ThreadBudget( int numThreads ) : freeThreads( numThreads ) {}
+
+    void Acquire( int count )
+    {
+        std::unique_lock guard( lock );
+        uint64_t ticket = nextTicket++;
+        released.wait( guard, [&]() { return ticket == servingTicket && freeThreads >= count; } );
+        freeThreads -= count;
+        ++servingTicket;
+        released.notify_all();
+    }
+
+    void Release( int count )
+    {
+        {
+            std::scoped_lock guard( lock );
+            freeThreads += count;
+        }
+        released.notify_all();
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable released;
+    int freeThreads;
+    uint64_t nextTicket    = 0;
+    uint64_t servingTicket = 0;
+};
+
+static int GetTeamSize( const BatchJob& job, int numThreads, uint64_t costPerThread )
+{
+    int teamSize = static_cast<int>( Min<uint64_t>( numThreads, Max<uint64_t>( 1, job.cost / costPerThread ) ) );
+    if ( teamSize == numThreads )
+        return teamSize;
+
+    int pow2TeamSize = 1;
+    while ( 2 * pow2TeamSize <= teamSize )
+        pow2TeamSize *= 2;
+    return pow2TeamSize;
+}
+
+void RunBatch( const std::vector<BatchJob>& jobs, const BatchSchedulerSettings& settings )
+{
+    if ( jobs.empty() )
+        return;
+
+    int numThreads = settings.numThreads > 0 ? settings.numThreads : omp_get_max_threads();
+    uint64_t costPerThread = Max<uint64_t>( 1, settings.costPerThread );
+
+    std::vector<ScheduledJob> scheduled( jobs.size() );
+    for ( size_t i = 0; i < jobs.size(); ++i )
+        scheduled[i] = { &jobs[i], GetTeamSize( jobs[i], numThreads, costPerThread ) };
+
+    // biggest jobs first, dealt out round robin. Owners pop from the back, so the biggest jobs go at the back
+    std::sort( scheduled.begin(), scheduled.end(), []( const ScheduledJob& a, const ScheduledJob& b )
+        { return a.teamSize != b.teamSize ? a.teamSize < b.teamSize : a.job->cost < b.job->cost; } );
+    size_t numWorkers = Min( jobs.size(), static_cast<size_t>( numThreads ) );
+    std::vector<WorkerQueue> queues( numWorkers );
+    for ( size_t i = 0; i < scheduled.size(); ++i )
+        queues[i % numWorkers].jobs.push_back( scheduled[i] );
+
+    ThreadBudget budget( numThreads );
+    auto WorkerLoop = [&]( size_t workerIdx )
+    {
+        ScheduledJob job;
+        while ( GetNextJob( queues, workerIdx, job ) )
+        {
+            budget.Acquire( job.teamSize );
+            // each std::thread is its own OpenMP initial thread, so this only limits the teams this worker creates
+            omp_set_num_threads( job.teamSize );
+            job.job->work();
+            budget.Release( job.teamSize );
+        }
+    };
+
+    int prevNumThreads = omp_get_max_threads();
+    std::vector<std::thread> workers;
+    for ( size_t i = 1; i < numWorkers; ++i )
+        workers.emplace_back( WorkerLoop, i );
+    WorkerLoop( 0 );
+    for ( std::thread& worker : workers )
+        worker.join();
+    omp_set_num_threads( prevNumThreads );
+}
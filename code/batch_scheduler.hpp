@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+struct BatchJob
+{
+    std::function<void()> work;
+    uint64_t cost = 0; // roughly how much parallel work the job has, like its pixel count. Determines the job's OpenMP team size
+};
+
+struct BatchSchedulerSettings
+{
+    int numThreads         = 0;         // total threads to use. 0 == omp_get_max_threads()
+    uint64_t costPerThread = 512 * 512; // a job gets 1 thread per costPerThread, up to numThreads
+};
+
+// Runs all of the jobs, with independent jobs running concurrently to fill the machine. Each job gets an OpenMP team size
+// based on its cost (rounded down to a power of 2). All of the jobs are dealt out to up to numThreads worker threads, which
+// each have their own job queue and steal from the others once theirs is empty. A worker only starts a job once that many of
+// the numThreads are free, so jobs of every size run side by side. The largest jobs are started first, so that the many small
+// jobs are what balance out the end of the batch
+void RunBatch( const std::vector<BatchJob>& jobs, const BatchSchedulerSettings& settings = {} );
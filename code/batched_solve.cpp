@@ -0,0 +1,260 @@
+#include "batched_solve.hpp"
+
+// The lanes (images) of each texel are relaxed in groups of this many. A fixed count lets the compiler turn every group into whole
+// SIMD registers, so batches are padded up to a multiple of it, with flat images
+static constexpr int BATCH_LANE_GROUP = 8;
+
+// One solver level of the whole batch. numChannels is the number of lanes, so the slopes of every image at a texel are contiguous
+struct BatchedSlopes
+{
+    FloatImage2D dx;
+    FloatImage2D dy;
+};
+
+static std::vector<BatchedSlopes> BuildBatchedSlopes( const std::vector<FloatImage2D>& normalMaps, int lanes )
+{
+    std::vector<BatchedSlopes> levels;
+    for ( int image = 0; image < (int)normalMaps.size(); ++image )
+    {
+        std::vector<FloatImage2D> pyramid = BuildDxDyPyramid( DxDyImageFromNormalMap( normalMaps[image] ) );
+        if ( levels.empty() )
+        {
+            // zeroed, so that the padding lanes stay flat
+            levels.resize( pyramid.size() );
+            for ( size_t mipLevel = 0; mipLevel < pyramid.size(); ++mipLevel )
+            {
+                levels[mipLevel].dx = FloatImage2D( pyramid[mipLevel].width, pyramid[mipLevel].height, lanes );
+                levels[mipLevel].dy = FloatImage2D( pyramid[mipLevel].width, pyramid[mipLevel].height, lanes );
+            }
+        }
+
+        for ( size_t mipLevel = 0; mipLevel < pyramid.size(); ++mipLevel )
+        {
+            const float* src = pyramid[mipLevel].data.get();
+            float* dx        = levels[mipLevel].dx.data.get();
+            float* dy        = levels[mipLevel].dy.data.get();
+            int numPixels    = pyramid[mipLevel].width * pyramid[mipLevel].height;
+            #pragma omp parallel for if ( numPixels >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+            for ( int i = 0; i < numPixels; ++i )
+            {
+                dx[(size_t)i * lanes + image] = src[2 * i + 0];
+                dy[(size_t)i * lanes + image] = src[2 * i + 1];
+            }
+        }
+    }
+
+    return levels;
+}
+
+// Copies one lane of the batched heights h into the single image dst
+static void DeinterleaveLane( const float* h, int numPixels, int lanes, int lane, float* dst )
+{
+    for ( int i = 0; i < numPixels; ++i )
+        dst[i] = h[(size_t)i * lanes + lane];
+}
+
+// Same as ProlongRow, for every lane
+static void ProlongRowBatched( const float* coarseH, int coarseWidth, int lanes, const ProlongationTap& rowTap,
+    const std::vector<ProlongationTap>& colTaps, float* dst )
+{
+    size_t coarseRowFloats = (size_t)coarseWidth * lanes;
+    const float* r0 = coarseH + rowTap.index[0] * coarseRowFloats;
+    const float* r1 = coarseH + rowTap.index[1] * coarseRowFloats;
+    const float* r2 = coarseH + rowTap.index[2] * coarseRowFloats;
+    int width       = (int)colTaps.size();
+    for ( int col = 0; col < width; ++col, dst += lanes )
+    {
+        const ProlongationTap& t = colTaps[col];
+        size_t c0 = (size_t)t.index[0] * lanes;
+        size_t c1 = (size_t)t.index[1] * lanes;
+        size_t c2 = (size_t)t.index[2] * lanes;
+        for ( int group = 0; group < lanes; group += BATCH_LANE_GROUP )
+        {
+            // computed into a local first, which can't alias the inputs, so the compiler doesn't need a scalar fallback for that
+            float h[BATCH_LANE_GROUP];
+            for ( int l = 0, lane = group; l < BATCH_LANE_GROUP; ++l, ++lane )
+            {
+                float h0 = t.weight[0] * r0[c0 + lane] + t.weight[1] * r0[c1 + lane] + t.weight[2] * r0[c2 + lane];
+                float h1 = t.weight[0] * r1[c0 + lane] + t.weight[1] * r1[c1 + lane] + t.weight[2] * r1[c2 + lane];
+                float h2 = t.weight[0] * r2[c0 + lane] + t.weight[1] * r2[c1 + lane] + t.weight[2] * r2[c2 + lane];
+                h[l]     = rowTap.weight[0] * h0 + rowTap.weight[1] * h1 + rowTap.weight[2] * h2;
+            }
+            memcpy( dst + group, h, sizeof( h ) );
+        }
+    }
+}
+
+// Same as RelaxRow in normal_to_height.cpp (with the exact same float operations, so the results match), for every lane
+static void RelaxRowBatched( const BatchedSlopes& slopes, int lanes, int row, const float* hUp, const float* hMid, const float* hDown, float* next )
+{
+    int width              = slopes.dx.width;
+    int height             = slopes.dx.height;
+    size_t rowFloats       = (size_t)width * lanes;
+    const float* dxMid     = slopes.dx.data.get() + row * rowFloats;
+    const float* dyUpRow   = slopes.dy.data.get() + Wrap( row - 1, height ) * rowFloats;
+    const float* dyDownRow = slopes.dy.data.get() + Wrap( row + 1, height ) * rowFloats;
+
+    for ( int col = 0; col < width; ++col )
+    {
+        size_t left  = (size_t)Wrap( col - 1, width ) * lanes;
+        size_t right = (size_t)Wrap( col + 1, width ) * lanes;
+        size_t mid   = (size_t)col * lanes;
+        for ( int group = 0; group < lanes; group += BATCH_LANE_GROUP )
+        {
+            // see ProlongRowBatched
+            float h[BATCH_LANE_GROUP];
+            for ( int l = 0, lane = group; l < BATCH_LANE_GROUP; ++l, ++lane )
+            {
+                h[l]  = 0;
+                h[l] += hMid[left + lane]  + 0.5f * dxMid[left + lane];
+                h[l] += hMid[right + lane] - 0.5f * dxMid[right + lane];
+                h[l] += hUp[mid + lane]    + 0.5f * dyUpRow[mid + lane];
+                h[l] += hDown[mid + lane]  - 0.5f * dyDownRow[mid + lane];
+                h[l]  = h[l] / 4;
+            }
+            memcpy( next + mid + group, h, sizeof( h ) );
+        }
+    }
+}
+
+// Same as RelaxLevel with the fixed schedule, including the first sweep being fused with the upsampling (see ProlongAndRelax)
+static void RelaxLevelBatched( SweepScheduler& scheduler, uint32_t mipLevel, const BatchedSlopes& slopes, int lanes, float* scratchH,
+    float* outputH )
+{
+    int width        = slopes.dx.width;
+    int height       = slopes.dx.height;
+    int coarseWidth  = Max( width / 2, 1 );
+    int coarseHeight = Max( height / 2, 1 );
+    size_t rowFloats = (size_t)width * lanes;
+    // the whole batch shares each fork/join, so even the coarse levels of small images can be worth running in parallel
+    bool parallel    = rowFloats * height >= MIN_PIXELS_FOR_PARALLEL_SWEEP;
+
+    // the coarse solution is in outputH, so the first sweep has to write into scratchH
+    std::vector<ProlongationTap> colTaps = CalcProlongationTaps( coarseWidth, width );
+    std::vector<ProlongationTap> rowTaps = CalcProlongationTaps( coarseHeight, height );
+    #pragma omp parallel if ( parallel )
+    {
+        std::vector<float> ring( 3 * rowFloats );
+        float* rows[3] = { ring.data(), ring.data() + rowFloats, ring.data() + 2 * rowFloats }; // up, mid, down
+        int lastRow    = -2;
+        #pragma omp for schedule( static )
+        for ( int row = 0; row < height; ++row )
+        {
+            if ( row == lastRow + 1 )
+            {
+                std::swap( rows[0], rows[1] );
+                std::swap( rows[1], rows[2] );
+                ProlongRowBatched( outputH, coarseWidth, lanes, rowTaps[Wrap( row + 1, height )], colTaps, rows[2] );
+            }
+            else
+            {
+                ProlongRowBatched( outputH, coarseWidth, lanes, rowTaps[Wrap( row - 1, height )], colTaps, rows[0] );
+                ProlongRowBatched( outputH, coarseWidth, lanes, rowTaps[row], colTaps, rows[1] );
+                ProlongRowBatched( outputH, coarseWidth, lanes, rowTaps[Wrap( row + 1, height )], colTaps, rows[2] );
+            }
+            lastRow = row;
+            RelaxRowBatched( slopes, lanes, row, rows[0], rows[1], rows[2], scratchH + row * rowFloats );
+        }
+    }
+
+    // always an even number of sweeps, so the last one writes into outputH
+    uint32_t maxSweeps = scheduler.MaxSweeps( mipLevel );
+    float* cur         = scratchH;
+    float* next        = outputH;
+    for ( uint32_t sweep = 1; sweep < maxSweeps; ++sweep )
+    {
+        #pragma omp parallel for if ( parallel )
+        for ( int row = 0; row < height; ++row )
+        {
+            const float* hUp   = cur + Wrap( row - 1, height ) * rowFloats;
+            const float* hDown = cur + Wrap( row + 1, height ) * rowFloats;
+            RelaxRowBatched( slopes, lanes, row, hUp, cur + row * rowFloats, hDown, next + row * rowFloats );
+        }
+        std::swap( cur, next );
+    }
+
+    scheduler.FinishLevel( mipLevel, maxSweeps );
+}
+
+// Same as BuildDisplacement. results: only for HeightMipMode::SOLVER, to save the solution of every coarse level in
+static void BuildDisplacementBatched( const std::vector<BatchedSlopes>& levels, int lanes, float* scratchH, float* outputH,
+    SweepScheduler& scheduler, std::vector<GenerationResults>* results, uint32_t mipLevel = 0 )
+{
+    const BatchedSlopes& slopes = levels[mipLevel];
+    int width  = slopes.dx.width;
+    int height = slopes.dx.height;
+    if ( width == 1 || height == 1 )
+        memset( outputH, 0, (size_t)width * height * lanes * sizeof( float ) );
+    else
+    {
+        BuildDisplacementBatched( levels, lanes, scratchH, outputH, scheduler, results, mipLevel + 1 );
+        RelaxLevelBatched( scheduler, mipLevel, slopes, lanes, scratchH, outputH );
+    }
+
+    if ( results && mipLevel > 0 )
+    {
+        for ( int image = 0; image < (int)results->size(); ++image )
+        {
+            std::vector<FloatImage2D>& mips = ( *results )[image].heightMap.mips;
+            if ( mips.size() < mipLevel )
+                mips.resize( mipLevel );
+            mips[mipLevel - 1] = FloatImage2D( width, height, 1, ImageAllocFlags::UNINITIALIZED );
+            DeinterleaveLane( outputH, width * height, lanes, image, mips[mipLevel - 1].data.get() );
+        }
+    }
+}
+
+std::vector<GenerationResults> GetHeightMapsFromNormalMaps_Batched( const std::vector<FloatImage2D>& normalMaps, uint32_t iterations,
+    float iterationMultiplier, HeightMipMode mipMode )
+{
+    if ( normalMaps.empty() )
+        return {};
+
+    int width  = normalMaps[0].width;
+    int height = normalMaps[0].height;
+    for ( const FloatImage2D& normalMap : normalMaps )
+    {
+        if ( normalMap.width != width || normalMap.height != height )
+        {
+            LOG_ERR( "Every normal map in a batch has to be the same size (%dx%d vs %dx%d)", width, height, normalMap.width, normalMap.height );
+            return {};
+        }
+    }
+
+    auto startTime = PG::Time::GetTimePoint();
+
+    int numImages = (int)normalMaps.size();
+    int lanes     = ( numImages + BATCH_LANE_GROUP - 1 ) / BATCH_LANE_GROUP * BATCH_LANE_GROUP;
+    std::vector<BatchedSlopes> levels = BuildBatchedSlopes( normalMaps, lanes );
+    std::vector<uint64_t> levelSizes;
+    for ( const BatchedSlopes& level : levels )
+        levelSizes.push_back( (uint64_t)level.dx.width * level.dx.height );
+
+    std::vector<GenerationResults> results( numImages );
+    for ( GenerationResults& result : results )
+        result.heightMap = GeneratedHeightMap( width, height );
+
+    // every level writes its upsampled starting point into scratchH before reading it
+    FloatImage2D scratchH( width, height, lanes, ImageAllocFlags::UNINITIALIZED );
+    FloatImage2D outputH( width, height, lanes, ImageAllocFlags::UNINITIALIZED );
+    SweepScheduler scheduler( levelSizes, iterations, iterationMultiplier, {}, startTime );
+    BuildDisplacementBatched( levels, lanes, scratchH.data.get(), outputH.data.get(), scheduler,
+        mipMode == HeightMipMode::SOLVER ? &results : nullptr );
+
+    #pragma omp parallel for schedule( dynamic )
+    for ( int image = 0; image < numImages; ++image )
+    {
+        GenerationResults& result = results[image];
+        DeinterleaveLane( outputH.data.get(), width * height, lanes, image, result.heightMap.map.data.get() );
+        scheduler.GetResults( result );
+        CompleteHeightMapMips( result.heightMap, mipMode );
+        result.heightMap.CalcMinMax();
+        result.iterations = iterations;
+    }
+
+    float timeToGenerate = (float)PG::Time::GetTimeSince( startTime ) / 1000.0f;
+    for ( GenerationResults& result : results )
+        result.timeToGenerate = timeToGenerate;
+
+    return results;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "normal_to_height.hpp"
+
+// Same as calling GetHeightMapFromNormalMap (with the default RelaxationControls) on each of normalMaps, and gives the exact same
+// heights, but solves all of them at once. They all have to be the same size. The texels of every image are interleaved, so that a
+// single sweep over the batch relaxes the same texel of every image with SIMD, and the thread dispatch and synchronization of each
+// sweep is shared by the whole batch, instead of dominating the coarse levels of small images.
+// Every result's timeToGenerate is the time of the whole batch
+std::vector<GenerationResults> GetHeightMapsFromNormalMaps_Batched( const std::vector<FloatImage2D>& normalMaps, uint32_t iterations,
+    float iterationMultiplier = 1.0f, HeightMipMode mipMode = HeightMipMode::NONE );
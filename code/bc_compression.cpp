@@ -0,0 +1,316 @@
+#include "bc_compression.hpp"
+#include "shared/math_base.hpp"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+uint32_t BCBytesPerBlock( BCFormat format )
+{
+    return ( format == BCFormat::BC1 || format == BCFormat::BC4 || format == BCFormat::BC4_SNORM ) ? 8 : 16;
+}
+
+uint32_t BCNumDecodedChannels( BCFormat format )
+{
+    static constexpr uint8_t mapping[] =
+    {
+        4, // BC1
+        4, // BC3
+        2, // BC3N
+        1, // BC4
+        1, // BC4_SNORM
+        2, // BC5
+        2, // BC5_SNORM
+    };
+    static_assert( sizeof( mapping ) == static_cast<size_t>( BCFormat::COUNT ) );
+
+    return mapping[static_cast<uint32_t>( format )];
+}
+
+size_t BCTotalBytes( BCFormat format, int width, int height )
+{
+    size_t blocksX = ( width + 3 ) / 4;
+    size_t blocksY = ( height + 3 ) / 4;
+    return blocksX * blocksY * BCBytesPerBlock( format );
+}
+
+// Decodes a BC4 block (also the alpha block of BC3 and each channel of BC5) into 16 values.
+// The palette lookups are written as straight-line loops over all 16 texels, so that they auto-vectorize
+static void DecodeBC4Block( const uint8_t* block, bool isSigned, uint8_t out[16] )
+{
+    // signed endpoints are shifted into [0, 254] and interpolated like unsigned ones, since lerping commutes with the offset
+    int e0 = block[0];
+    int e1 = block[1];
+    int lowest = 0;
+    int highest = 255;
+    int offset = 0;
+    if ( isSigned )
+    {
+        e0      = Max( -127, (int)(int8_t)block[0] ) + 127;
+        e1      = Max( -127, (int)(int8_t)block[1] ) + 127;
+        highest = 254;
+        offset  = 1;
+    }
+
+    uint8_t palette[8];
+    palette[0] = static_cast<uint8_t>( e0 + offset );
+    palette[1] = static_cast<uint8_t>( e1 + offset );
+    if ( ( isSigned ? (int8_t)block[0] > (int8_t)block[1] : e0 > e1 ) )
+    {
+        for ( int i = 2; i < 8; ++i )
+            palette[i] = static_cast<uint8_t>( ( ( 8 - i ) * e0 + ( i - 1 ) * e1 + 3 ) / 7 + offset );
+    }
+    else
+    {
+        for ( int i = 2; i < 6; ++i )
+            palette[i] = static_cast<uint8_t>( ( ( 6 - i ) * e0 + ( i - 1 ) * e1 + 2 ) / 5 + offset );
+        palette[6] = static_cast<uint8_t>( lowest + offset );
+        palette[7] = static_cast<uint8_t>( highest + offset );
+    }
+
+    uint64_t bits = 0;
+    for ( int i = 0; i < 6; ++i )
+        bits |= static_cast<uint64_t>( block[2 + i] ) << ( 8 * i );
+
+    for ( int i = 0; i < 16; ++i )
+        out[i] = palette[( bits >> ( 3 * i ) ) & 7];
+}
+
+static void Expand565( uint16_t c, uint8_t* rgb )
+{
+    uint32_t r = ( c >> 11 ) & 31;
+    uint32_t g = ( c >> 5 ) & 63;
+    uint32_t b = c & 31;
+    rgb[0]     = static_cast<uint8_t>( ( r << 3 ) | ( r >> 2 ) );
+    rgb[1]     = static_cast<uint8_t>( ( g << 2 ) | ( g >> 4 ) );
+    rgb[2]     = static_cast<uint8_t>( ( b << 3 ) | ( b >> 2 ) );
+}
+
+// Decodes a BC1 color block into 16 RGBA values. BC3 color blocks always use the 4 color mode
+static void DecodeBC1Block( const uint8_t* block, bool forceFourColors, uint8_t out[16][4] )
+{
+    uint16_t c0 = static_cast<uint16_t>( block[0] | ( block[1] << 8 ) );
+    uint16_t c1 = static_cast<uint16_t>( block[2] | ( block[3] << 8 ) );
+
+    uint8_t palette[4][4];
+    Expand565( c0, palette[0] );
+    Expand565( c1, palette[1] );
+    palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+    if ( c0 > c1 || forceFourColors )
+    {
+        for ( int c = 0; c < 3; ++c )
+        {
+            palette[2][c] = static_cast<uint8_t>( ( 2 * palette[0][c] + palette[1][c] + 1 ) / 3 );
+            palette[3][c] = static_cast<uint8_t>( ( palette[0][c] + 2 * palette[1][c] + 1 ) / 3 );
+        }
+    }
+    else
+    {
+        for ( int c = 0; c < 3; ++c )
+        {
+            palette[2][c] = static_cast<uint8_t>( ( palette[0][c] + palette[1][c] + 1 ) / 2 );
+            palette[3][c] = 0;
+        }
+        palette[3][3] = 0;
+    }
+
+    uint32_t bits = block[4] | ( block[5] << 8 ) | ( block[6] << 16 ) | ( (uint32_t)block[7] << 24 );
+    for ( int i = 0; i < 16; ++i )
+    {
+        uint32_t idx = ( bits >> ( 2 * i ) ) & 3;
+        for ( int c = 0; c < 4; ++c )
+            out[i][c] = palette[idx][c];
+    }
+}
+
+static void DecodeBlock( BCFormat format, const uint8_t* block, uint8_t out[16][4] )
+{
+    uint8_t channel0[16];
+    uint8_t channel1[16];
+    switch ( format )
+    {
+    case BCFormat::BC1: DecodeBC1Block( block, false, out ); break;
+    case BCFormat::BC3:
+        DecodeBC1Block( block + 8, true, out );
+        DecodeBC4Block( block, false, channel0 );
+        for ( int i = 0; i < 16; ++i )
+            out[i][3] = channel0[i];
+        break;
+    case BCFormat::BC3N:
+        DecodeBC1Block( block + 8, true, out );
+        DecodeBC4Block( block, false, channel0 );
+        for ( int i = 0; i < 16; ++i )
+            out[i][0] = channel0[i]; // Y is already in green
+        break;
+    case BCFormat::BC4:
+    case BCFormat::BC4_SNORM:
+        DecodeBC4Block( block, format == BCFormat::BC4_SNORM, channel0 );
+        for ( int i = 0; i < 16; ++i )
+            out[i][0] = channel0[i];
+        break;
+    case BCFormat::BC5:
+    case BCFormat::BC5_SNORM:
+        DecodeBC4Block( block, format == BCFormat::BC5_SNORM, channel0 );
+        DecodeBC4Block( block + 8, format == BCFormat::BC5_SNORM, channel1 );
+        for ( int i = 0; i < 16; ++i )
+        {
+            out[i][0] = channel0[i];
+            out[i][1] = channel1[i];
+        }
+        break;
+    }
+}
+
+void DecodeBCImage( BCFormat format, const uint8_t* blocks, int width, int height, uint8_t* outPixels )
+{
+    const int blocksX          = ( width + 3 ) / 4;
+    const int blocksY          = ( height + 3 ) / 4;
+    const uint32_t blockBytes  = BCBytesPerBlock( format );
+    const uint32_t numChannels = BCNumDecodedChannels( format );
+
+    #pragma omp parallel for schedule( static )
+    for ( int blockRow = 0; blockRow < blocksY; ++blockRow )
+    {
+        uint8_t texels[16][4];
+        for ( int blockCol = 0; blockCol < blocksX; ++blockCol )
+        {
+            DecodeBlock( format, blocks + ( (size_t)blockRow * blocksX + blockCol ) * blockBytes, texels );
+
+            int rowsInBlock = Min( 4, height - 4 * blockRow );
+            int colsInBlock = Min( 4, width - 4 * blockCol );
+            for ( int r = 0; r < rowsInBlock; ++r )
+            {
+                uint8_t* dst = outPixels + ( (size_t)( 4 * blockRow + r ) * width + 4 * blockCol ) * numChannels;
+                for ( int c = 0; c < colsInBlock; ++c )
+                {
+                    for ( uint32_t chan = 0; chan < numChannels; ++chan )
+                        dst[c * numChannels + chan] = texels[4 * r + c][chan];
+                }
+            }
+        }
+    }
+}
+
+// Returns the squared error of the block, when using the 8 value mode with endpoints e0 > e1
+static float FindBC4Indices( const float texels[16], int e0, int e1, uint8_t indices[16] )
+{
+    float palette[8];
+    palette[0] = static_cast<float>( e0 );
+    palette[1] = static_cast<float>( e1 );
+    for ( int i = 2; i < 8; ++i )
+        palette[i] = static_cast<float>( ( ( 8 - i ) * e0 + ( i - 1 ) * e1 + 3 ) / 7 );
+
+    float totalError = 0;
+    for ( int t = 0; t < 16; ++t )
+    {
+        float bestError = FLT_MAX;
+        uint8_t bestIdx = 0;
+        for ( int i = 0; i < 8; ++i )
+        {
+            float d     = palette[i] - texels[t];
+            float error = d * d;
+            bestIdx     = error < bestError ? static_cast<uint8_t>( i ) : bestIdx;
+            bestError   = Min( bestError, error );
+        }
+        indices[t] = bestIdx;
+        totalError += bestError;
+    }
+
+    return totalError;
+}
+
+static void WriteBC4Block( int e0, int e1, const uint8_t indices[16], uint8_t* block )
+{
+    block[0]      = static_cast<uint8_t>( e0 );
+    block[1]      = static_cast<uint8_t>( e1 );
+    uint64_t bits = 0;
+    for ( int i = 0; i < 16; ++i )
+        bits |= static_cast<uint64_t>( indices[i] ) << ( 3 * i );
+    for ( int i = 0; i < 6; ++i )
+        block[2 + i] = static_cast<uint8_t>( bits >> ( 8 * i ) );
+}
+
+// texels are in [0, 255]. Starts with the min/max endpoints, and then does one least squares refit of the endpoints
+static void EncodeBC4Block( const float texels[16], uint8_t* block )
+{
+    float lo = texels[0];
+    float hi = texels[0];
+    for ( int i = 1; i < 16; ++i )
+    {
+        lo = Min( lo, texels[i] );
+        hi = Max( hi, texels[i] );
+    }
+
+    int e0 = static_cast<int>( std::lround( hi ) );
+    int e1 = static_cast<int>( std::lround( lo ) );
+    uint8_t indices[16] = {};
+    if ( e0 == e1 )
+    {
+        // 6 value mode, with every texel using endpoint 0
+        WriteBC4Block( e0, e1, indices, block );
+        return;
+    }
+
+    float bestError = FindBC4Indices( texels, e0, e1, indices );
+
+    // least squares fit: each texel is a * e0 + ( 1 - a ) * e1, where 'a' is determined by its current index
+    float aa = 0, ab = 0, bb = 0, av = 0, bv = 0;
+    for ( int i = 0; i < 16; ++i )
+    {
+        int idx = indices[i];
+        float a = idx == 0 ? 1.0f : ( idx == 1 ? 0.0f : ( 8 - idx ) / 7.0f );
+        float b = 1.0f - a;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        av += a * texels[i];
+        bv += b * texels[i];
+    }
+    float det = aa * bb - ab * ab;
+    if ( std::abs( det ) > 1e-6f )
+    {
+        int fitE0 = std::clamp( static_cast<int>( std::lround( ( av * bb - bv * ab ) / det ) ), 0, 255 );
+        int fitE1 = std::clamp( static_cast<int>( std::lround( ( bv * aa - av * ab ) / det ) ), 0, 255 );
+        uint8_t fitIndices[16];
+        if ( fitE0 > fitE1 )
+        {
+            float fitError = FindBC4Indices( texels, fitE0, fitE1, fitIndices );
+            if ( fitError < bestError )
+            {
+                e0 = fitE0;
+                e1 = fitE1;
+                for ( int i = 0; i < 16; ++i )
+                    indices[i] = fitIndices[i];
+            }
+        }
+    }
+
+    WriteBC4Block( e0, e1, indices, block );
+}
+
+void EncodeBC4Image( const float* pixels, int width, int height, uint8_t* outBlocks )
+{
+    const int blocksX = ( width + 3 ) / 4;
+    const int blocksY = ( height + 3 ) / 4;
+
+    #pragma omp parallel for schedule( static )
+    for ( int blockRow = 0; blockRow < blocksY; ++blockRow )
+    {
+        float texels[16];
+        for ( int blockCol = 0; blockCol < blocksX; ++blockCol )
+        {
+            // partial blocks on the right and bottom edges replicate the last row/column
+            for ( int r = 0; r < 4; ++r )
+            {
+                int row = Min( 4 * blockRow + r, height - 1 );
+                for ( int c = 0; c < 4; ++c )
+                {
+                    int col           = Min( 4 * blockCol + c, width - 1 );
+                    float v           = std::clamp( pixels[(size_t)row * width + col], 0.0f, 1.0f );
+                    texels[4 * r + c] = 255.0f * v;
+                }
+            }
+
+            EncodeBC4Block( texels, outBlocks + ( (size_t)blockRow * blocksX + blockCol ) * 8 );
+        }
+    }
+}
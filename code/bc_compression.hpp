@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+enum class BCFormat : uint8_t
+{
+    BC1,
+    BC3,
+    BC3N, // BC3 with the normal's X stored in alpha and Y in green (aka DXT5nm)
+    BC4,
+    BC4_SNORM,
+    BC5,
+    BC5_SNORM,
+
+    COUNT
+};
+
+uint32_t BCBytesPerBlock( BCFormat format );
+
+// How many 8-bit channels DecodeBCImage outputs per pixel. BC3N gets unswizzled into 2 channels (XY)
+uint32_t BCNumDecodedChannels( BCFormat format );
+
+size_t BCTotalBytes( BCFormat format, int width, int height );
+
+// Decodes the tightly packed, row-major blocks of an image into 8 bit per channel pixels, with BCNumDecodedChannels channels.
+// Signed formats are offset by 128, so that they can be unpacked like regular 8-bit unorm normals. Blocks are decoded in parallel
+void DecodeBCImage( BCFormat format, const uint8_t* blocks, int width, int height, uint8_t* outPixels );
+
+// Encodes a single channel float image in [0, 1] into tightly packed, row-major BC4 unorm blocks (BCTotalBytes( BC4, w, h ) bytes).
+// Values outside of [0, 1] are clamped. Blocks are encoded in parallel
+void EncodeBC4Image( const float* pixels, int width, int height, uint8_t* outBlocks );
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+
+// https://learn.microsoft.com/en-us/windows/win32/direct3ddds/dds-header
+
+#define DDS_MAKE_FOURCC( a, b, c, d ) \
+    ( (uint32_t)(uint8_t)( a ) | ( (uint32_t)(uint8_t)( b ) << 8 ) | ( (uint32_t)(uint8_t)( c ) << 16 ) | ( (uint32_t)(uint8_t)( d ) << 24 ) )
+
+constexpr uint32_t DDS_MAGIC = DDS_MAKE_FOURCC( 'D', 'D', 'S', ' ' );
+
+constexpr uint32_t DDSD_CAPS        = 0x1;
+constexpr uint32_t DDSD_HEIGHT      = 0x2;
+constexpr uint32_t DDSD_WIDTH       = 0x4;
+constexpr uint32_t DDSD_PIXELFORMAT = 0x1000;
+constexpr uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+constexpr uint32_t DDSD_LINEARSIZE  = 0x80000;
+
+constexpr uint32_t DDSCAPS_COMPLEX = 0x8;
+constexpr uint32_t DDSCAPS_TEXTURE = 0x1000;
+constexpr uint32_t DDSCAPS_MIPMAP  = 0x400000;
+
+constexpr uint32_t DDPF_FOURCC = 0x4;
+constexpr uint32_t DDPF_NORMAL = 0x80000000; // nvtt's flag for swizzled (BC3n / DXT5nm) normal maps
+
+constexpr uint32_t DXGI_FORMAT_BC1_UNORM = 71;
+constexpr uint32_t DXGI_FORMAT_BC3_UNORM = 77;
+constexpr uint32_t DXGI_FORMAT_BC4_UNORM = 80;
+constexpr uint32_t DXGI_FORMAT_BC4_SNORM = 81;
+constexpr uint32_t DXGI_FORMAT_BC5_UNORM = 83;
+constexpr uint32_t DXGI_FORMAT_BC5_SNORM = 84;
+
+constexpr uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+struct DDSPixelFormat
+{
+    uint32_t size;
+    uint32_t flags;
+    uint32_t fourCC;
+    uint32_t RGBBitCount;
+    uint32_t RBitMask;
+    uint32_t GBitMask;
+    uint32_t BBitMask;
+    uint32_t ABitMask;
+};
+
+struct DDSHeader
+{
+    uint32_t size;
+    uint32_t flags;
+    uint32_t height;
+    uint32_t width;
+    uint32_t pitchOrLinearSize;
+    uint32_t depth;
+    uint32_t mipMapCount;
+    uint32_t reserved1[11];
+    DDSPixelFormat ddspf;
+    uint32_t caps;
+    uint32_t caps2;
+    uint32_t caps3;
+    uint32_t caps4;
+    uint32_t reserved2;
+};
+
+struct DDSHeaderDX10
+{
+    uint32_t dxgiFormat;
+    uint32_t resourceDimension;
+    uint32_t miscFlag;
+    uint32_t arraySize;
+    uint32_t miscFlags2;
+};
+
+static_assert( sizeof( DDSHeader ) == 124 );
+static_assert( sizeof( DDSHeaderDX10 ) == 20 );
@@ -0,0 +1,208 @@
+#include "height_cache.hpp"
+#include "shared/filesystem.hpp"
+#include "shared/logger.hpp"
+#include "shared/platform_defines.hpp"
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
+#include <thread>
+
+#if USING( WINDOWS_PROGRAM )
+#include <process.h>
+#define getpid _getpid
+#else // #if USING( WINDOWS_PROGRAM )
+#include <unistd.h>
+#endif // #else // #if USING( WINDOWS_PROGRAM )
+
+namespace fs = std::filesystem;
+
+static constexpr uint32_t HEIGHT_CACHE_MAGIC   = 0x4843324E; // 'N2CH'
+static constexpr uint32_t HEIGHT_CACHE_VERSION = 1;
+static constexpr uint64_t FNV_PRIME            = 1099511628211ull;
+
+struct HeightCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numMaps; // mip 0 + heightMap.mips
+    uint32_t iterations;
+    float timeToGenerate;
+    float solverError;
+    float minH;
+    float maxH;
+    float scale;
+    float bias;
+};
+
+void HeightCacheKey::Add( const void* data, size_t numBytes )
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>( data );
+    for ( size_t i = 0; i < numBytes; ++i )
+        hash = ( hash ^ bytes[i] ) * FNV_PRIME;
+}
+
+HeightCacheKey HashNormalMap( const FloatImage2D& normalMap )
+{
+    int rowLength = normalMap.width * normalMap.numChannels;
+    std::vector<uint64_t> rowHashes( normalMap.height );
+    #pragma omp parallel for if ( normalMap.width * normalMap.height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+    for ( int row = 0; row < normalMap.height; ++row )
+    {
+        // word-wise FNV-1a: byte-wise would be 4x the dependent multiplies, and the full image can be hundreds of MB
+        const uint32_t* words = reinterpret_cast<const uint32_t*>( normalMap.data.get() + row * rowLength );
+        uint64_t hash = 14695981039346656037ull;
+        for ( int i = 0; i < rowLength; ++i )
+            hash = ( hash ^ words[i] ) * FNV_PRIME;
+        rowHashes[row] = hash;
+    }
+
+    HeightCacheKey key;
+    key.Add( normalMap.width );
+    key.Add( normalMap.height );
+    key.Add( normalMap.numChannels );
+    key.Add( rowHashes.data(), rowHashes.size() * sizeof( uint64_t ) );
+
+    return key;
+}
+
+static std::string GetCacheEntryPath( const HeightCacheSettings& settings, const HeightCacheKey& key )
+{
+    char name[32];
+    snprintf( name, sizeof( name ), "%016llx.n2h", (unsigned long long)key.hash );
+    return settings.directory + "/" + name;
+}
+
+bool LoadCachedHeightMap( const HeightCacheSettings& settings, const HeightCacheKey& key, GenerationResults& results )
+{
+    if ( settings.directory.empty() )
+        return false;
+
+    std::string path = GetCacheEntryPath( settings, key );
+    FILE* file       = fopen( path.c_str(), "rb" );
+    if ( !file )
+        return false;
+
+    HeightCacheHeader header;
+    bool success = fread( &header, sizeof( header ), 1, file ) == 1 && header.magic == HEIGHT_CACHE_MAGIC &&
+                   header.version == HEIGHT_CACHE_VERSION && header.numMaps > 0;
+    std::vector<FloatImage2D> maps( success ? header.numMaps : 0 );
+    for ( size_t i = 0; i < maps.size() && success; ++i )
+    {
+        int dims[2];
+        success = fread( dims, sizeof( dims ), 1, file ) == 1 && dims[0] > 0 && dims[1] > 0;
+        if ( success )
+        {
+            maps[i] = FloatImage2D( dims[0], dims[1], 1, ImageAllocFlags::UNINITIALIZED );
+            success = fread( maps[i].data.get(), sizeof( float ) * dims[0] * dims[1], 1, file ) == 1;
+        }
+    }
+    fclose( file );
+    if ( !success )
+    {
+        LOG_WARN( "Ignoring corrupt height cache entry '%s'", path.c_str() );
+        return false;
+    }
+
+    results.iterations     = header.iterations;
+    results.timeToGenerate = header.timeToGenerate;
+    results.solverError    = header.solverError;
+    results.heightMap.map  = maps[0];
+    results.heightMap.mips.assign( maps.begin() + 1, maps.end() );
+    results.heightMap.minH  = header.minH;
+    results.heightMap.maxH  = header.maxH;
+    results.heightMap.scale = header.scale;
+    results.heightMap.bias  = header.bias;
+
+    // the modification time doubles as the last use time for the LRU eviction
+    std::error_code ec;
+    fs::last_write_time( path, fs::file_time_type::clock::now(), ec );
+
+    return true;
+}
+
+static void EvictCachedHeightMaps( const HeightCacheSettings& settings )
+{
+    struct Entry
+    {
+        fs::path path;
+        fs::file_time_type lastUsed;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    uint64_t totalSize = 0;
+    std::error_code ec;
+    for ( const fs::directory_entry& dirEntry : fs::directory_iterator( settings.directory, ec ) )
+    {
+        if ( !dirEntry.is_regular_file( ec ) || dirEntry.path().extension() != ".n2h" )
+            continue;
+
+        Entry entry = { dirEntry.path(), dirEntry.last_write_time( ec ), dirEntry.file_size( ec ) };
+        totalSize += entry.size;
+        entries.push_back( entry );
+    }
+    if ( totalSize <= settings.maxSizeInBytes )
+        return;
+
+    std::sort( entries.begin(), entries.end(), []( const Entry& a, const Entry& b ) { return a.lastUsed < b.lastUsed; } );
+    for ( size_t i = 0; i < entries.size() && totalSize > settings.maxSizeInBytes; ++i )
+    {
+        if ( fs::remove( entries[i].path, ec ) )
+            totalSize -= entries[i].size;
+    }
+}
+
+void StoreCachedHeightMap( const HeightCacheSettings& settings, const HeightCacheKey& key, const GenerationResults& results )
+{
+    if ( settings.directory.empty() )
+        return;
+
+    const GeneratedHeightMap& heightMap = results.heightMap;
+    HeightCacheHeader header;
+    header.magic          = HEIGHT_CACHE_MAGIC;
+    header.version        = HEIGHT_CACHE_VERSION;
+    header.numMaps        = 1 + (uint32_t)heightMap.mips.size();
+    header.iterations     = results.iterations;
+    header.timeToGenerate = results.timeToGenerate;
+    header.solverError    = results.solverError;
+    header.minH           = heightMap.minH;
+    header.maxH           = heightMap.maxH;
+    header.scale          = heightMap.scale;
+    header.bias           = heightMap.bias;
+
+    CreateDirectory( settings.directory );
+
+    // write to a unique temporary file, and then rename it into place, so readers never see a partially written entry.
+    // The pid keeps separate processes sharing a cache directory from colliding
+    static std::atomic<uint32_t> s_tempCounter = 0;
+    std::string path     = GetCacheEntryPath( settings, key );
+    std::string tempPath = path + "." + std::to_string( getpid() ) + "_" +
+                           std::to_string( std::hash<std::thread::id>()( std::this_thread::get_id() ) ) + "_" +
+                           std::to_string( s_tempCounter++ ) + ".tmp";
+    FILE* file = fopen( tempPath.c_str(), "wb" );
+    if ( !file )
+    {
+        LOG_WARN( "Could not write height cache entry '%s'", tempPath.c_str() );
+        return;
+    }
+
+    bool success = fwrite( &header, sizeof( header ), 1, file ) == 1;
+    for ( uint32_t i = 0; i < header.numMaps && success; ++i )
+    {
+        const FloatImage2D& map = i == 0 ? heightMap.map : heightMap.mips[i - 1];
+        int dims[2]             = { map.width, map.height };
+        success = fwrite( dims, sizeof( dims ), 1, file ) == 1 && fwrite( map.data.get(), sizeof( float ) * map.width * map.height, 1, file ) == 1;
+    }
+    fclose( file );
+
+    std::error_code ec;
+    if ( success )
+        fs::rename( tempPath, path, ec );
+    if ( !success || ec )
+    {
+        LOG_WARN( "Could not write height cache entry '%s'", path.c_str() );
+        fs::remove( tempPath, ec );
+        return;
+    }
+
+    EvictCachedHeightMaps( settings );
+}
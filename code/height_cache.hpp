@@ -0,0 +1,35 @@
+#pragma once
+
+#include "normal_to_height.hpp"
+#include <string>
+
+struct HeightCacheSettings
+{
+    std::string directory;                        // empty == caching disabled
+    uint64_t maxSizeInBytes = 1024ull * 1024 * 1024; // least recently used entries are evicted once the directory is bigger than this
+};
+
+// 64-bit FNV-1a. Used to build the cache keys: hash the normal map with HashNormalMap, and then Add every option that changes the result
+struct HeightCacheKey
+{
+    uint64_t hash = 14695981039346656037ull;
+
+    void Add( const void* data, size_t numBytes );
+
+    template <typename T>
+    void Add( const T& value )
+    {
+        Add( &value, sizeof( T ) );
+    }
+};
+
+// Hashes the dimensions and decoded pixels. Rows are hashed in parallel and then combined in order
+HeightCacheKey HashNormalMap( const FloatImage2D& normalMap );
+
+// Returns false on a miss. On a hit, 'results' is filled out exactly as it was when stored (height map unpacked, plus any mips),
+// and the entry is marked as the most recently used
+bool LoadCachedHeightMap( const HeightCacheSettings& settings, const HeightCacheKey& key, GenerationResults& results );
+
+// Stores the results (the height map must not be packed yet), and evicts the least recently used entries if the cache is now
+// over its size budget. Safe to call from concurrent jobs, and processes, sharing the same directory
+void StoreCachedHeightMap( const HeightCacheSettings& settings, const HeightCacheKey& key, const GenerationResults& results );
@@ -5,7 +5,7 @@ const char* NormalCalcMethodToStr( NormalCalcMethod method )
     static const char* names[] =
     {
         "cross",    // CROSS
-        "forward"   // FORWARD
+        "forward",  // FORWARD
         "sobel",    // SOBEL
         "scharr",   // SCHARR
         "improved", // IMPROVED
@@ -16,170 +16,404 @@ const char* NormalCalcMethodToStr( NormalCalcMethod method )
     return names[Underlying( method )];
 }
 
+NormalCalcMethod StrToNormalCalcMethod( const std::string& str )
+{
+    for ( uint32_t i = 0; i < Underlying( NormalCalcMethod::COUNT ); ++i )
+    {
+        if ( str == NormalCalcMethodToStr( (NormalCalcMethod)i ) )
+            return (NormalCalcMethod)i;
+    }
+
+    return NormalCalcMethod::COUNT;
+}
+
 double CompareNormalMaps( const FloatImage2D& img1, const FloatImage2D& img2 )
 {
+    ImageView<const float, 3> normals1 = img1.View<3>();
+    ImageView<const float, 3> normals2 = img2.View<3>();
     double mse = 0;
+    #pragma omp parallel for reduction( + : mse ) if ( img1.width * img1.height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
     for ( int row = 0; row < img1.height; ++row )
     {
+        double rowMSE = 0;
         for ( int col = 0; col < img1.width; ++col )
         {
-            vec3 n1 = img1.Get( row, col );
-            vec3 n2 = img2.Get( row, col );
+            vec3 n1 = normals1.Get( row, col );
+            vec3 n2 = normals2.Get( row, col );
             float d = -Dot( n1, n2 ) + 1;
-            mse += d * d;
+            rowMSE += d * d;
         }
+        mse += rowMSE;
     }
 
-    mse /= ( img1.width * img1.height );
+    mse /= ( (double)img1.width * img1.height );
     return 10.0 * log10( 2.0 * 2.0 / mse );
 }
 
 FloatImage2D DiffNormalMaps( const FloatImage2D& img1, const FloatImage2D& img2 )
 {
-    FloatImage2D res = FloatImage2D( img1.width, img2.height, 3 );
+    FloatImage2D res = FloatImage2D( img1.width, img2.height, 3, ImageAllocFlags::UNINITIALIZED );
+    ImageView<const float, 3> normals1 = img1.View<3>();
+    ImageView<const float, 3> normals2 = img2.View<3>();
+    ImageView<float, 3> diffs = res.View<3>();
+    #pragma omp parallel for if ( res.width * res.height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
     for ( int row = 0; row < res.height; ++row )
     {
         for ( int col = 0; col < res.width; ++col )
         {
-            vec3 n1 = img1.Get( row, col );
-            vec3 n2 = img2.Get( row, col );
+            vec3 n1 = normals1.Get( row, col );
+            vec3 n2 = normals2.Get( row, col );
             float d = ( -Dot( n1, n2 ) + 1.0f ) / 2.0f;
-            res.Set( row, col, vec3( d ) );
+            diffs.Set( row, col, vec3( d ) );
         }
     }
 
     return res;
 }
 
-FloatImage2D GetNormalMapFromHeightMap( const GeneratedHeightMap& heightMap, NormalCalcMethod method )
+template <NormalCalcMethod method>
+static vec3 CalcNormal( float h_UL, float h_UM, float h_UR, float h_ML, float h_MM, float h_MR, float h_DL, float h_DM, float h_DR, float scale_H, float scale_V )
+{
+    if constexpr ( method == NormalCalcMethod::CROSS )
+    {
+        float X = (h_ML - h_MR ) / 2.0f;
+        float Y = (h_UM - h_DM ) / 2.0f;
+        return vec3( scale_H * X, scale_V * Y, 1 );
+    }
+    else if constexpr ( method == NormalCalcMethod::SOBEL )
+    {
+        float X = ((h_UL - h_UR) + 2.0f * (h_ML - h_MR) + (h_DL - h_DR)) / 8.0f;
+        float Y = ((h_UL - h_DL) + 2.0f * (h_UM - h_DM) + (h_UR - h_DR)) / 8.0f;
+        return vec3( scale_H * X, scale_V * Y, 1 );
+    }
+    else if constexpr ( method == NormalCalcMethod::SCHARR )
+    {
+        float X = (3.0f * (h_UL - h_UR) + 10.0f * (h_ML - h_MR) + 3.0f * (h_DL - h_DR)) / 32.0f;
+        float Y = (3.0f * (h_UL - h_DL) + 10.0f * (h_UM - h_DM) + 3.0f * (h_UR - h_DR)) / 32.0f;
+        return vec3( scale_H * X, scale_V * Y, 1 );
+    }
+    else if constexpr ( method == NormalCalcMethod::FORWARD )
+    {
+        float X = (h_MM - h_MR );
+        float Y = (h_MM - h_DM );
+        return vec3( scale_H * X, scale_V * Y, 1 );
+    }
+    // https://wickedengine.net/2019/09/22/improved-normal-reconstruction-from-depth/
+    else
+    {
+        static_assert( method == NormalCalcMethod::IMPROVED );
+        const uint32_t best_Z_horizontal = abs(h_MR - h_MM) < abs(h_ML - h_MM) ? 1 : 2; // right, left
+        const uint32_t best_Z_vertical = abs(h_DM - h_MM) < abs(h_UM - h_MM) ? 3 : 4; // down, up
+
+        vec3 P0 = vec3( 0, 0, h_MM ); // center
+        vec3 P1 = vec3( 0 );
+        vec3 P2 = vec3( 0 );
+        if ( best_Z_horizontal == 1 && best_Z_vertical == 4 ) // center, right, up
+        {
+            P1 = vec3( 1, 0, h_MR ); // right
+            P2 = vec3( 0, -1, h_UM ); // up
+        }
+        else if ( best_Z_horizontal == 1 && best_Z_vertical == 3 ) // center, down, right
+        {
+            P1 = vec3( 0, 1, h_DM ); // down
+            P2 = vec3( 1, 0, h_MR ); // right
+        }
+        else if ( best_Z_horizontal == 2 && best_Z_vertical == 4 ) // center, up, left
+        {
+            P1 = vec3( 0, -1, h_UM ); // up
+            P2 = vec3( -1, 0, h_ML ); // left
+        }
+        else // center, left, down
+        {
+            P1 = vec3( -1, 0, h_ML ); // left
+            P2 = vec3( 0, 1, h_DM ); // down
+        }
+        P1.x /= scale_H;
+        P2.x /= scale_H;
+        P1.y /= scale_V;
+        P2.y /= scale_V;
+
+        return Cross( P2 - P0, P1 - P0 );
+    }
+}
+
+// https://atyuwen.github.io/posts/normal-reconstruction/
+// Needs the pixels 2 away on the middle row and column (the '2' heights), so it doesn't fit in the 3x3 window
+static vec3 CalcNormal_Accurate( float h_UM2, float h_UM, float h_ML2, float h_ML, float h_MM, float h_MR, float h_MR2, float h_DM, float h_DM2,
+    float scale_H, float scale_V )
+{
+    float dLeft  = abs( 2.0f * h_ML - h_ML2 - h_MM );
+    float dRight = abs( 2.0f * h_MR - h_MR2 - h_MM );
+    vec3 dpdx = dLeft < dRight ? vec3( 1.0f / scale_H, 0, h_MM - h_ML ) :
+                                 vec3( 1.0f / scale_H, 0, h_MR - h_MM );
+
+    float dUp   = abs( 2.0f * h_UM - h_UM2 - h_MM );
+    float dDown = abs( 2.0f * h_DM - h_DM2 - h_MM );
+    vec3 dpdy = dUp < dDown ? vec3( 0, 1.0f / scale_V, h_MM - h_UM ) :
+                              vec3( 0, 1.0f / scale_V, h_DM - h_MM );
+
+    return Cross( dpdx, dpdy );
+}
+
+// WrapTexel for the texels 2 away, that ACCURATE also reads, and that Wrap can't handle
+template <bool PowerOfTwo>
+static inline int WrapTexel2( int v, int size )
+{
+    if constexpr ( PowerOfTwo ) return WrapTexel<true>( v, size );
+    else return ( v + 2 * size ) % size;
+}
+
+template <bool PowerOfTwo>
+static void CalcNormalsForRow_Accurate( const float* heights, int width, int height, int row, float* normals )
+{
+    float scale_H = (float)width;
+    float scale_V = (float)height;
+    const float* rowU2 = heights + WrapTexel2<PowerOfTwo>( row - 2, height ) * width;
+    const float* rowU  = heights + WrapTexel<PowerOfTwo>( row - 1, height ) * width;
+    const float* rowM  = heights + row * width;
+    const float* rowD  = heights + WrapTexel<PowerOfTwo>( row + 1, height ) * width;
+    const float* rowD2 = heights + WrapTexel2<PowerOfTwo>( row + 2, height ) * width;
+    for ( int col = 0; col < width; ++col )
+    {
+        vec3 normal = CalcNormal_Accurate( rowU2[col], rowU[col], rowM[WrapTexel2<PowerOfTwo>( col - 2, width )],
+            rowM[WrapTexel<PowerOfTwo>( col - 1, width )], rowM[col], rowM[WrapTexel<PowerOfTwo>( col + 1, width )],
+            rowM[WrapTexel2<PowerOfTwo>( col + 2, width )], rowD[col], rowD2[col], scale_H, scale_V );
+        normal = Normalize( normal );
+        normals[3 * col + 0] = normal.x;
+        normals[3 * col + 1] = normal.y;
+        normals[3 * col + 2] = normal.z;
+    }
+}
+
+// Slides a 3x3 window across the row, so each step only loads the new right column
+template <NormalCalcMethod method, bool PowerOfTwo>
+static void CalcNormalsForRow( const float* heights, int width, int height, int row, float* normals )
+{
+    if constexpr ( method == NormalCalcMethod::ACCURATE )
+    {
+        CalcNormalsForRow_Accurate<PowerOfTwo>( heights, width, height, row, normals );
+    }
+    else
+    {
+        float scale_H = (float)width;
+        float scale_V = (float)height;
+        const float* rowU = heights + WrapTexel<PowerOfTwo>( row - 1, height ) * width;
+        const float* rowM = heights + row * width;
+        const float* rowD = heights + WrapTexel<PowerOfTwo>( row + 1, height ) * width;
+
+        float h_UL = rowU[width - 1], h_UM = rowU[0];
+        float h_ML = rowM[width - 1], h_MM = rowM[0];
+        float h_DL = rowD[width - 1], h_DM = rowD[0];
+        for ( int col = 0; col < width; ++col )
+        {
+            int right  = WrapTexel<PowerOfTwo>( col + 1, width );
+            float h_UR = rowU[right];
+            float h_MR = rowM[right];
+            float h_DR = rowD[right];
+
+            vec3 normal = Normalize( CalcNormal<method>( h_UL, h_UM, h_UR, h_ML, h_MM, h_MR, h_DL, h_DM, h_DR, scale_H, scale_V ) );
+            normals[3 * col + 0] = normal.x;
+            normals[3 * col + 1] = normal.y;
+            normals[3 * col + 2] = normal.z;
+
+            h_UL = h_UM; h_UM = h_UR;
+            h_ML = h_MM; h_MM = h_MR;
+            h_DL = h_DM; h_DM = h_DR;
+        }
+    }
+}
+
+template <NormalCalcMethod method>
+static void CalcNormals( const float* heights, int width, int height, float* normals )
+{
+    DispatchPowerOfTwo( width, height, [&]( auto powerOfTwo )
+    {
+        #pragma omp parallel for if ( width * height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+        for ( int row = 0; row < height; ++row )
+            CalcNormalsForRow<method, powerOfTwo>( heights, width, height, row, normals + 3 * row * width );
+    } );
+}
+
+// Applies the scale and bias once up front, so the kernels can read the heights directly. Unpacked maps are used as-is
+static const float* GetUnpackedHeights( const GeneratedHeightMap& heightMap, std::vector<float>& unpackedHeights )
+{
+    int numPixels = heightMap.map.width * heightMap.map.height;
+    const float* heights = heightMap.map.data.get();
+    if ( heightMap.scale == 1.0f && heightMap.bias == 0.0f )
+        return heights;
+
+    unpackedHeights.resize( numPixels );
+    #pragma omp parallel for if ( numPixels >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+    for ( int i = 0; i < numPixels; ++i )
+        unpackedHeights[i] = heights[i] * heightMap.scale + heightMap.bias;
+
+    return unpackedHeights.data();
+}
+
+FloatImage2D GetNormalMapFromHeightMap( const GeneratedHeightMap& heightMap, NormalCalcMethod method, float* outputNormals )
 {
+    int width  = heightMap.map.width;
+    int height = heightMap.map.height;
+    FloatImage2D normalMap = outputNormals ? FloatImage2D( width, height, 3, outputNormals ) : FloatImage2D( width, height, 3, ImageAllocFlags::UNINITIALIZED );
+
+    std::vector<float> unpackedHeights;
+    const float* heights = GetUnpackedHeights( heightMap, unpackedHeights );
+
+    float* normals = normalMap.data.get();
+    switch ( method )
+    {
+    case NormalCalcMethod::CROSS:
+        CalcNormals<NormalCalcMethod::CROSS>( heights, width, height, normals );
+        break;
+    case NormalCalcMethod::FORWARD:
+        CalcNormals<NormalCalcMethod::FORWARD>( heights, width, height, normals );
+        break;
+    case NormalCalcMethod::SOBEL:
+        CalcNormals<NormalCalcMethod::SOBEL>( heights, width, height, normals );
+        break;
+    case NormalCalcMethod::SCHARR:
+        CalcNormals<NormalCalcMethod::SCHARR>( heights, width, height, normals );
+        break;
+    case NormalCalcMethod::IMPROVED:
+        CalcNormals<NormalCalcMethod::IMPROVED>( heights, width, height, normals );
+        break;
+    case NormalCalcMethod::ACCURATE:
+        CalcNormals<NormalCalcMethod::ACCURATE>( heights, width, height, normals );
+        break;
+    default:
+        break;
+    }
+
+    return normalMap;
+}
+
+NormalCalcMethodPSNRs ScoreNormalCalcMethods( const GeneratedHeightMap& heightMap, const FloatImage2D& sourceNormals, uint32_t methods,
+    uint32_t saveMethods, std::vector<FloatImage2D>* savedNormalMaps )
+{
+    constexpr uint32_t NUM_METHODS = Underlying( NormalCalcMethod::COUNT );
     int width  = heightMap.map.width;
     int height = heightMap.map.height;
     float scale_H = (float)width;
     float scale_V = (float)height;
 
-    FloatImage2D normalMap( width, height, 3 );
-    for ( int row = 0; row < height; ++row )
+    float* outputs[NUM_METHODS] = {};
+    if ( savedNormalMaps )
     {
-        int up = Wrap( row - 1, height );
-        int down = Wrap( row + 1, height );
-            
-        for ( int col = 0; col < width; ++col )
+        savedNormalMaps->assign( NUM_METHODS, FloatImage2D() );
+        for ( uint32_t m = 0; m < NUM_METHODS; ++m )
         {
-            int left = Wrap( col - 1, width );
-            int right = Wrap( col + 1, width );
-
-            float h_ML = heightMap.GetH( row, left );
-            float h_MM = heightMap.GetH( row, col );
-            float h_MR = heightMap.GetH( row, right );
-            float h_UL = heightMap.GetH( up, left );
-            float h_UM = heightMap.GetH( up, col );
-            float h_UR = heightMap.GetH( up, right );
-            float h_DL = heightMap.GetH( down, left );
-            float h_DM = heightMap.GetH( down, col );
-            float h_DR = heightMap.GetH( down, right );
-            
-            vec3 normal = vec3( 0 );
-            if ( method == NormalCalcMethod::CROSS )
-            {
-                float X = (h_ML - h_MR ) / 2.0f;
-                float Y = (h_UM - h_DM ) / 2.0f;
-                normal = vec3( scale_H * X, scale_V * Y, 1 );
-            }
-            else if ( method == NormalCalcMethod::SOBEL )
+            if ( saveMethods & methods & ( 1u << m ) )
             {
-                float X = ((h_UL - h_UR) + 2.0f * (h_ML - h_MR) + (h_DL - h_DR)) / 8.0f;
-                float Y = ((h_UL - h_DL) + 2.0f * (h_UM - h_DM) + (h_UR - h_DR)) / 8.0f;
-                normal = vec3( scale_H * X, scale_V * Y, 1 );
+                ( *savedNormalMaps )[m] = FloatImage2D( width, height, 3, ImageAllocFlags::UNINITIALIZED );
+                outputs[m] = ( *savedNormalMaps )[m].data.get();
             }
-            else if ( method == NormalCalcMethod::SCHARR )
-            {
-                float X = (3.0f * (h_UL - h_UR) + 10.0f * (h_ML - h_MR) + 3.0f * (h_DL - h_DR)) / 32.0f;
-                float Y = (3.0f * (h_UL - h_DL) + 10.0f * (h_UM - h_DM) + 3.0f * (h_UR - h_DR)) / 32.0f;
-                normal = vec3( scale_H * X, scale_V * Y, 1 );
-            }
-            else if ( method == NormalCalcMethod::FORWARD )
-            {
-                float X = (h_MM - h_MR );
-                float Y = (h_MM - h_DM );
-                normal = vec3( scale_H * X, scale_V * Y, 1 );
-            }
-            // https://wickedengine.net/2019/09/22/improved-normal-reconstruction-from-depth/
-            else if ( method == NormalCalcMethod::IMPROVED )
+        }
+    }
+
+    std::vector<float> unpackedHeights;
+    const float* heights = GetUnpackedHeights( heightMap, unpackedHeights );
+    ImageView<const float, 3> source = sourceNormals.View<3>();
+
+    // one set of sums per row instead of a shared reduction, so the result doesn't depend on the thread count
+    std::vector<double> rowErrors( (size_t)height * NUM_METHODS, 0.0 );
+    DispatchPowerOfTwo( width, height, [&]( auto powerOfTwo )
+    {
+        #pragma omp parallel for if ( width * height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+        for ( int row = 0; row < height; ++row )
+        {
+            const float* rowU2 = heights + WrapTexel2<powerOfTwo>( row - 2, height ) * width;
+            const float* rowU  = heights + WrapTexel<powerOfTwo>( row - 1, height ) * width;
+            const float* rowM  = heights + row * width;
+            const float* rowD  = heights + WrapTexel<powerOfTwo>( row + 1, height ) * width;
+            const float* rowD2 = heights + WrapTexel2<powerOfTwo>( row + 2, height ) * width;
+            double* errors     = &rowErrors[row * NUM_METHODS];
+
+            float h_UL = rowU[width - 1], h_UM = rowU[0];
+            float h_ML = rowM[width - 1], h_MM = rowM[0];
+            float h_DL = rowD[width - 1], h_DM = rowD[0];
+            for ( int col = 0; col < width; ++col )
             {
-                const uint32_t best_Z_horizontal = abs(h_MR - h_MM) < abs(h_ML - h_MM) ? 1 : 2; // right, left
-                const uint32_t best_Z_vertical = abs(h_DM - h_MM) < abs(h_UM - h_MM) ? 3 : 4; // down, up
+                int right  = WrapTexel<powerOfTwo>( col + 1, width );
+                float h_UR = rowU[right];
+                float h_MR = rowM[right];
+                float h_DR = rowD[right];
 
-                vec3 P0 = vec3( 0, 0, h_MM ); // center
-                vec3 P1 = vec3( 0 );
-                vec3 P2 = vec3( 0 );
-                if ( best_Z_horizontal == 1 && best_Z_vertical == 4 ) // center, right, up
-                {
-                    P1 = vec3( 1, 0, h_MR ); // right
-                    P2 = vec3( 0, -1, h_UM ); // up
-                }
-                else if ( best_Z_horizontal == 1 && best_Z_vertical == 3 ) // center, down, right
+                // only the requested methods. Every pixel takes the same branches, so they predict well
+                vec3 normals[NUM_METHODS];
+                if ( methods & ( 1u << Underlying( NormalCalcMethod::CROSS ) ) )
+                    normals[0] = CalcNormal<NormalCalcMethod::CROSS>( h_UL, h_UM, h_UR, h_ML, h_MM, h_MR, h_DL, h_DM, h_DR, scale_H, scale_V );
+                if ( methods & ( 1u << Underlying( NormalCalcMethod::FORWARD ) ) )
+                    normals[1] = CalcNormal<NormalCalcMethod::FORWARD>( h_UL, h_UM, h_UR, h_ML, h_MM, h_MR, h_DL, h_DM, h_DR, scale_H, scale_V );
+                if ( methods & ( 1u << Underlying( NormalCalcMethod::SOBEL ) ) )
+                    normals[2] = CalcNormal<NormalCalcMethod::SOBEL>( h_UL, h_UM, h_UR, h_ML, h_MM, h_MR, h_DL, h_DM, h_DR, scale_H, scale_V );
+                if ( methods & ( 1u << Underlying( NormalCalcMethod::SCHARR ) ) )
+                    normals[3] = CalcNormal<NormalCalcMethod::SCHARR>( h_UL, h_UM, h_UR, h_ML, h_MM, h_MR, h_DL, h_DM, h_DR, scale_H, scale_V );
+                if ( methods & ( 1u << Underlying( NormalCalcMethod::IMPROVED ) ) )
+                    normals[4] = CalcNormal<NormalCalcMethod::IMPROVED>( h_UL, h_UM, h_UR, h_ML, h_MM, h_MR, h_DL, h_DM, h_DR, scale_H, scale_V );
+                if ( methods & ( 1u << Underlying( NormalCalcMethod::ACCURATE ) ) )
                 {
-                    P1 = vec3( 0, 1, h_DM ); // down
-                    P2 = vec3( 1, 0, h_MR ); // right
+                    normals[5] = CalcNormal_Accurate( rowU2[col], h_UM, rowM[WrapTexel2<powerOfTwo>( col - 2, width )], h_ML, h_MM, h_MR,
+                        rowM[WrapTexel2<powerOfTwo>( col + 2, width )], h_DM, rowD2[col], scale_H, scale_V );
                 }
-                else if ( best_Z_horizontal == 2 && best_Z_vertical == 4 ) // center, up, left
-                {
-                    P1 = vec3( 0, -1, h_UM ); // up
-                    P2 = vec3( -1, 0, h_ML ); // left
-                }
-                else // center, left, down
+                static_assert( NUM_METHODS == 6, "dont forget to update this list when adding/deleting methods" );
+
+                vec3 sourceNormal = source.Get( row, col );
+                for ( uint32_t m = 0; m < NUM_METHODS; ++m )
                 {
-                    P1 = vec3( -1, 0, h_ML ); // left
-                    P2 = vec3( 0, 1, h_DM ); // down
+                    if ( !( methods & ( 1u << m ) ) )
+                        continue;
+
+                    vec3 normal = Normalize( normals[m] );
+                    float d = -Dot( normal, sourceNormal ) + 1;
+                    errors[m] += d * d;
+                    if ( outputs[m] )
+                    {
+                        float* dst = outputs[m] + 3 * ( row * width + col );
+                        dst[0] = normal.x;
+                        dst[1] = normal.y;
+                        dst[2] = normal.z;
+                    }
                 }
-                P1.x /= scale_H;
-                P2.x /= scale_H;
-                P1.y /= scale_V;
-                P2.y /= scale_V;
 
-                normal = Cross( P2 - P0, P1 - P0 );
+                h_UL = h_UM; h_UM = h_UR;
+                h_ML = h_MM; h_MM = h_MR;
+                h_DL = h_DM; h_DM = h_DR;
             }
-            // https://atyuwen.github.io/posts/normal-reconstruction/
-            else if ( method == NormalCalcMethod::ACCURATE )
-            {
-                float h_ML2 = heightMap.GetH( row, Wrap( col - 2, width ) );
-                float h_MR2 = heightMap.GetH( row, Wrap( col + 2, width ) );
-
-                float dLeft  = abs( 2.0f * h_ML - h_ML2 - h_MM );
-                float dRight = abs( 2.0f * h_MR - h_MR2 - h_MM );
-                vec3 dpdx = dLeft < dRight ? vec3( 1.0f / scale_H, 0, h_MM - h_ML ) :
-                                             vec3( 1.0f / scale_H, 0, h_MR - h_MM );
-
-                float h_UM2 = heightMap.GetH( row, Wrap( row - 2, height ) );
-                float h_DM2 = heightMap.GetH( row, Wrap( row + 2, height ) );
-                float dUp   = abs( 2.0f * h_UM - h_UM2 - h_MM );
-                float dDown = abs( 2.0f * h_DM - h_DM2 - h_MM );
-                vec3 dpdy = dUp < dDown ? vec3( 0, 1.0f / scale_V, h_MM - h_UM ) :
-                                          vec3( 0, 1.0f / scale_V, h_DM - h_MM );
-
-                normal = Cross( dpdx, dpdy );
-            }
-
-            normal = Normalize( normal );
-            normalMap.Set( row, col, normal );
         }
+    } );
+
+    NormalCalcMethodPSNRs psnrs = {};
+    for ( uint32_t m = 0; m < NUM_METHODS; ++m )
+    {
+        if ( !( methods & ( 1u << m ) ) )
+            continue;
+
+        double mse = 0;
+        for ( int row = 0; row < height; ++row )
+            mse += rowErrors[row * NUM_METHODS + m];
+        mse /= ( width * height );
+        psnrs[m] = 10.0 * log10( 2.0 * 2.0 / mse );
     }
 
-    return normalMap;
+    return psnrs;
 }
 
 void PackNormalMap( FloatImage2D& normalMap, bool flipY, bool flipX )
 {
-    for ( int i = 0; i < normalMap.width * normalMap.height; ++i )
+    ImageView<float, 3> normals = normalMap.View<3>();
+    #pragma omp parallel for if ( normalMap.width * normalMap.height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+    for ( int row = 0; row < normals.height; ++row )
     {
-        vec3 normal = normalMap.Get( i );
-        if ( flipY )
-            normal.y *= -1;
-        if ( flipX )
-            normal.x *= -1;
+        for ( int col = 0; col < normals.width; ++col )
+        {
+            vec3 normal = normals.Get( row, col );
+            if ( flipY )
+                normal.y *= -1;
+            if ( flipX )
+                normal.x *= -1;
 
-        vec3 packedNormal = 0.5f * (normal + vec3( 1.0f ));
-        normalMap.Set( i, packedNormal );
+            vec3 packedNormal = 0.5f * (normal + vec3( 1.0f ));
+            normals.Set( row, col, packedNormal );
+        }
     }
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "image.hpp"
 #include "normal_to_height.hpp"
+#include <array>
 
 enum class NormalCalcMethod : uint32_t
 {
@@ -16,13 +17,24 @@ enum class NormalCalcMethod : uint32_t
 };
 
 const char* NormalCalcMethodToStr( NormalCalcMethod method );
+// returns NormalCalcMethod::COUNT if the name doesn't match any of the methods
+NormalCalcMethod StrToNormalCalcMethod( const std::string& str );
 
-// returns the PSNR of the dot product between img1 and img2
+using NormalCalcMethodPSNRs = std::array<double, Underlying( NormalCalcMethod::COUNT )>;
+
+// returns the PSNR of the dot product between img1 and img2. See CompareNormalMapsDetailed for SSIM and angular errors
 double CompareNormalMaps( const FloatImage2D& img1, const FloatImage2D& img2 );
 
 // returns the image of the dot product between img1 and img2
 FloatImage2D DiffNormalMaps( const FloatImage2D& img1, const FloatImage2D& img2 );
 
-FloatImage2D GetNormalMapFromHeightMap( const GeneratedHeightMap& heightMap, NormalCalcMethod method );
+// outputNormals: optional caller-owned storage for the returned normal map (width * height * 3 floats)
+FloatImage2D GetNormalMapFromHeightMap( const GeneratedHeightMap& heightMap, NormalCalcMethod method, float* outputNormals = nullptr );
+
+// Same as calling GetNormalMapFromHeightMap + CompareNormalMaps for every method in 'methods' (bit N == NormalCalcMethod N), but in a
+// single parallel pass that reads each pixel's neighborhood once. Returns each method's PSNR, 0 for the methods not in 'methods'.
+// savedNormalMaps (optional): gets COUNT entries. Only the methods in 'saveMethods' get their normal maps stored, the rest are left empty
+NormalCalcMethodPSNRs ScoreNormalCalcMethods( const GeneratedHeightMap& heightMap, const FloatImage2D& sourceNormals, uint32_t methods,
+    uint32_t saveMethods = 0, std::vector<FloatImage2D>* savedNormalMaps = nullptr );
 
 void PackNormalMap( FloatImage2D& normalMap, bool flipY, bool flipX );
\ No newline at end of file
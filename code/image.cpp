@@ -117,7 +117,7 @@ void RawImage2D::SetPixelFromFloat4( int row, int col, vec4 pixel )
 // TODO: optimize
 RawImage2D RawImage2D::Convert( ImageFormat dstFormat ) const
 {
-    RawImage2D outputImg( width, height, dstFormat );
+    RawImage2D outputImg( width, height, dstFormat, ImageAllocFlags::UNINITIALIZED );
     int inputChannels  = NumChannels();
     int outputChannels = outputImg.NumChannels();
 
@@ -135,7 +135,7 @@ RawImage2D RawImage2D::Convert( ImageFormat dstFormat ) const
 
 RawImage2D RawImage2D::Clone() const
 {
-    RawImage2D ret( width, height, format );
+    RawImage2D ret( width, height, format, ImageAllocFlags::UNINITIALIZED );
     memcpy( ret.data.get(), data.get(), TotalBytes() );
     return ret;
 }
@@ -165,7 +165,7 @@ FloatImage2D FloatImage2D::Resize( int newWidth, int newHeight ) const
         return *this;
     }
 
-    FloatImage2D outputImage( newWidth, newHeight, numChannels );
+    FloatImage2D outputImage( newWidth, newHeight, numChannels, ImageAllocFlags::UNINITIALIZED );
     if ( width == 1 && height == 1 )
     {
         float p[4];
@@ -189,7 +189,7 @@ FloatImage2D FloatImage2D::Resize( int newWidth, int newHeight ) const
 
 FloatImage2D FloatImage2D::Clone() const
 {
-    FloatImage2D ret( width, height, numChannels );
+    FloatImage2D ret( width, height, numChannels, ImageAllocFlags::UNINITIALIZED );
     size_t size = width * height;
     memcpy( ret.data.get(), data.get(), size * numChannels * sizeof( float ) );
     return ret;
@@ -353,38 +353,156 @@ std::vector<RawImage2D> RawImage2DFromFloatImages( const std::vector<FloatImage2
     return rawImages;
 }
 
-std::vector<FloatImage2D> GenerateMipmaps( const FloatImage2D& image, const MipmapGenerationSettings& settings )
-{
-    std::vector<FloatImage2D> mips;
+// Below this, the OpenMP fork/join costs more than the loop itself
+static constexpr int MIN_PIXELS_FOR_PARALLEL_LOOP = 128 * 128;
 
-    uint32_t numMips = CalculateNumMips( image.width, image.height );
+// The (at most 4) source texels and weights that make up one destination texel along one axis
+struct BoxTaps
+{
+    int index[4];
+    float weight[4];
+    int count;
+};
+
+// Each destination texel covers exactly srcSize / dstSize source texels, so for odd sizes the texels on the boundaries between
+// destination texels get split between both, weighted by how much of them is covered. The footprints never leave the image
+static void CalcBoxTaps( int srcSize, int dstSize, std::vector<BoxTaps>& taps )
+{
+    taps.resize( dstSize );
+    double scale = srcSize / (double)dstSize;
+    for ( int i = 0; i < dstSize; ++i )
+    {
+        double start = i * scale;
+        double end   = Min( ( i + 1 ) * scale, (double)srcSize );
+        BoxTaps& t   = taps[i];
+        t.count      = 0;
+        for ( int s = (int)start; s < end && t.count < 4; ++s )
+        {
+            double covered = Min( end, s + 1.0 ) - Max( start, (double)s );
+            if ( covered > 1e-6 )
+            {
+                t.index[t.count]  = s;
+                t.weight[t.count] = (float)( covered / scale );
+                ++t.count;
+            }
+        }
+    }
+}
 
-    int w           = image.width;
-    int h           = image.height;
-    int numChannels = image.numChannels;
-    stbir_edge edgeModeU = settings.clampHorizontal ? STBIR_EDGE_CLAMP : STBIR_EDGE_WRAP;
-    stbir_edge edgeModeV = settings.clampVertical ? STBIR_EDGE_CLAMP : STBIR_EDGE_WRAP;
-    for ( uint32_t mipLevel = 0; mipLevel < numMips; ++mipLevel )
+template <int Channels>
+static void DownsampleBox2x2( ImageView<const float, Channels> src, ImageView<float, Channels> dst )
+{
+    int dstW = dst.width;
+    int dstH = dst.height;
+    if ( src.width == 2 * dstW && src.height == 2 * dstH )
     {
-        FloatImage2D mip( w, h, image.numChannels );
-        if ( mipLevel == 0 )
+        #pragma omp parallel for if ( dstW * dstH >= MIN_PIXELS_FOR_PARALLEL_LOOP )
+        for ( int row = 0; row < dstH; ++row )
         {
-            memcpy( mip.data.get(), image.data.get(), w * h * numChannels * sizeof( float ) );
+            const float* r0 = src.Row( 2 * row );
+            const float* r1 = src.Row( 2 * row + 1 );
+            float* out      = dst.Row( row );
+            for ( int i = 0; i < dstW * Channels; ++i )
+            {
+                int col  = i / Channels;
+                int chan = i - col * Channels;
+                int s    = 2 * col * Channels + chan;
+                out[i]   = 0.25f * ( ( r0[s] + r0[s + Channels] ) + ( r1[s] + r1[s + Channels] ) );
+            }
         }
-        else
+        return;
+    }
+
+    std::vector<BoxTaps> colTaps, rowTaps;
+    CalcBoxTaps( src.width, dstW, colTaps );
+    CalcBoxTaps( src.height, dstH, rowTaps );
+    #pragma omp parallel for if ( dstW * dstH >= MIN_PIXELS_FOR_PARALLEL_LOOP )
+    for ( int row = 0; row < dstH; ++row )
+    {
+        const BoxTaps& ty = rowTaps[row];
+        float* out        = dst.Row( row );
+        for ( int col = 0; col < dstW; ++col, out += Channels )
         {
-            // NOTE!!! With STBIR_EDGE_WRAP and STBIR_FILTER_MITCHELL, im seeing artifacts, at least for non-even dimensioned images.
-            // Both the top and right edges have dark lines near them, and some seemingly garbage pixels
-            int alphaChannel            = STBIR_ALPHA_CHANNEL_NONE;
-            const FloatImage2D& prevMip = mips[mipLevel - 1];
-            stbir_resize( prevMip.data.get(), prevMip.width, prevMip.height, prevMip.width * numChannels * sizeof( float ), mip.data.get(),
-                w, h, w * numChannels * sizeof( float ), STBIR_TYPE_FLOAT, numChannels, alphaChannel, 0, edgeModeU, edgeModeV,
-                STBIR_FILTER_BOX, STBIR_FILTER_BOX, STBIR_COLORSPACE_LINEAR, NULL );
+            const BoxTaps& tx = colTaps[col];
+            float sum[Channels] = {};
+            for ( int y = 0; y < ty.count; ++y )
+            {
+                const float* srcRow = src.Row( ty.index[y] );
+                for ( int x = 0; x < tx.count; ++x )
+                {
+                    float w        = ty.weight[y] * tx.weight[x];
+                    const float* p = srcRow + tx.index[x] * Channels;
+                    for ( int chan = 0; chan < Channels; ++chan )
+                        sum[chan] += w * p[chan];
+                }
+            }
+            for ( int chan = 0; chan < Channels; ++chan )
+                out[chan] = sum[chan];
         }
+    }
+}
+
+void DownsampleBox2x2( const FloatImage2D& src, FloatImage2D& dst )
+{
+    PG_ASSERT( dst.width == Max( 1, src.width / 2 ) && dst.height == Max( 1, src.height / 2 ) && dst.numChannels == src.numChannels );
+    switch ( src.numChannels )
+    {
+    case 1: DownsampleBox2x2<1>( src.View<1>(), dst.View<1>() ); break;
+    case 2: DownsampleBox2x2<2>( src.View<2>(), dst.View<2>() ); break;
+    case 3: DownsampleBox2x2<3>( src.View<3>(), dst.View<3>() ); break;
+    case 4: DownsampleBox2x2<4>( src.View<4>(), dst.View<4>() ); break;
+    default: PG_ASSERT( false, "Unsupported channel count %d", src.numChannels );
+    }
+}
+
+FloatImage2D DownsampleBox2x2( const FloatImage2D& src )
+{
+    FloatImage2D dst( Max( 1, src.width / 2 ), Max( 1, src.height / 2 ), src.numChannels, ImageAllocFlags::UNINITIALIZED );
+    DownsampleBox2x2( src, dst );
+    return dst;
+}
 
+std::vector<FloatImage2D> AllocateMipChain( int width, int height, int numChannels, uint32_t firstMip, uint32_t numMips, ImageAllocFlags allocFlags )
+{
+    // keep every level cache line aligned
+    constexpr size_t LEVEL_ALIGNMENT = IMAGE_ALIGNMENT / sizeof( float );
+    std::vector<size_t> offsets;
+    size_t totalFloats = 0;
+    for ( uint32_t mipLevel = firstMip; mipLevel < numMips; ++mipLevel )
+    {
+        offsets.push_back( totalFloats );
+        size_t levelFloats = (size_t)Max( 1, width >> mipLevel ) * Max( 1, height >> mipLevel ) * numChannels;
+        totalFloats       += ( levelFloats + LEVEL_ALIGNMENT - 1 ) / LEVEL_ALIGNMENT * LEVEL_ALIGNMENT;
+    }
+    if ( offsets.empty() )
+        return {};
+
+    std::shared_ptr<float[]> chain = AllocateImageData<float>( totalFloats, allocFlags );
+    std::vector<FloatImage2D> mips( offsets.size() );
+    for ( size_t i = 0; i < mips.size(); ++i )
+    {
+        uint32_t mipLevel   = firstMip + (uint32_t)i;
+        mips[i].width       = Max( 1, width >> mipLevel );
+        mips[i].height      = Max( 1, height >> mipLevel );
+        mips[i].numChannels = numChannels;
+        mips[i].data        = std::shared_ptr<float[]>( chain, chain.get() + offsets[i] ); // aliasing: shares ownership of 'chain'
+    }
+
+    return mips;
+}
+
+std::vector<FloatImage2D> GenerateMipmaps( const FloatImage2D& image, const MipmapGenerationSettings& settings )
+{
+    uint32_t numMips = CalculateNumMips( image.width, image.height );
+    if ( numMips == 0 )
+        return {};
+
+    std::vector<FloatImage2D> mips = { image };
+    std::vector<FloatImage2D> chain = AllocateMipChain( image.width, image.height, image.numChannels, 1, numMips, ImageAllocFlags::UNINITIALIZED );
+    for ( FloatImage2D& mip : chain )
+    {
+        DownsampleBox2x2( mips.back(), mip );
         mips.push_back( mip );
-        w = Max( 1, w >> 1 );
-        h = Max( 1, h >> 1 );
     }
 
     return mips;
@@ -414,30 +532,34 @@ double FloatImageMSE( const FloatImage2D& img1, const FloatImage2D& img2, uint32
     int height      = img1.height;
     int numChannels = img1.numChannels;
 
-    double mse = 0;
-    for ( int pixelIdx = 0; pixelIdx < width * height; ++pixelIdx )
-    {
-        for ( int chan = 0; chan < numChannels; ++chan )
-        {
-            if ( channelsToCalc & ( 1 << ( 3 - chan ) ) )
-            {
-                float x = img1.data[numChannels * pixelIdx + chan];
-                float y = img2.data[numChannels * pixelIdx + chan];
-                mse += ( x - y ) * ( x - y );
-            }
-        }
-    }
-
+    int channels[4];
     int numActualChannels = 0;
     for ( int chan = 0; chan < numChannels; ++chan )
     {
         if ( channelsToCalc & ( 1 << ( 3 - chan ) ) )
+            channels[numActualChannels++] = chan;
+    }
+
+    double mse = 0;
+    #pragma omp parallel for reduction( + : mse ) if ( width * height >= MIN_PIXELS_FOR_PARALLEL_LOOP )
+    for ( int row = 0; row < height; ++row )
+    {
+        const float* p1 = img1.data.get() + (size_t)row * width * numChannels;
+        const float* p2 = img2.data.get() + (size_t)row * width * numChannels;
+        double rowMSE   = 0;
+        for ( int col = 0; col < width * numChannels; col += numChannels )
         {
-            ++numActualChannels;
+            for ( int c = 0; c < numActualChannels; ++c )
+            {
+                float x = p1[col + channels[c]];
+                float y = p2[col + channels[c]];
+                rowMSE += ( x - y ) * ( x - y );
+            }
         }
+        mse += rowMSE;
     }
 
-    mse /= ( width * height * numActualChannels );
+    mse /= ( (double)width * height * numActualChannels );
     return mse;
 }
 
@@ -465,6 +587,28 @@ static vec3 UnpackNormal_32Bit( const vec3& v )
     return Normalize( 2.0f * v - vec3( 1.0f ) );
 }
 
+// For two channel normal maps (BC5, BC3n, etc), Z is reconstructed from X and Y
+static vec3 ReconstructNormalZ( float x, float y )
+{
+    float z = std::sqrt( Max( 0.0f, 1.0f - x * x - y * y ) );
+    return Normalize( vec3( x, y, z ) );
+}
+
+static vec3 UnpackNormalXY_8Bit( const uint8_t* v )
+{
+    return ReconstructNormalZ( (v[0] - 128) / 127.0f, (v[1] - 128) / 127.0f );
+}
+
+static vec3 UnpackNormalXY_16Bit( const uint16_t* v )
+{
+    return ReconstructNormalZ( (v[0] - 32768) / 32767.0f, (v[1] - 32768) / 32767.0f );
+}
+
+static vec3 UnpackNormalXY_32Bit( const vec2& v )
+{
+    return ReconstructNormalZ( 2.0f * v.x - 1.0f, 2.0f * v.y - 1.0f );
+}
+
 static vec3 ScaleNormal( vec3 n, float scale )
 {
     n.x *= scale;
@@ -475,38 +619,45 @@ static vec3 ScaleNormal( vec3 n, float scale )
 
 // Unpack the normals such that the error on neutral normals is 0, at the cost of higher error elsewhere
 // http://www.aclockworkberry.com/normal-unpacking-quantization-errors/
-FloatImage2D LoadNormalMap( const std::string& filename, float slopeScale, bool flipY, bool flipX )
+FloatImage2D DecodeNormalMap( const void* data, int width, int height, ImageFormat format, size_t pixelStride, size_t rowStride, float slopeScale,
+    bool flipY, bool flipX )
 {
-    RawImage2D rawImg;
-    if ( !rawImg.Load( filename ) )
+    const int numChannels = NumChannels( format );
+    if ( !data || width <= 0 || height <= 0 || numChannels < 2 || IsFormat16BitFloat( format ) )
         return {};
 
-    FloatImage2D normalMap;
-    if ( IsFormat16BitFloat( rawImg.format ) || IsFormat32BitFloat( rawImg.format ) )
-    {
-        normalMap = FloatImageFromRawImage2D( rawImg );
-        for ( int i = 0; i < normalMap.width * normalMap.height; ++i )
-        {
-            vec3 normal = UnpackNormal_32Bit( normalMap.Get( i ) );
-            if ( flipY )
-                normal.y *= -1;
-            if ( flipX )
-                normal.x *= -1;
+    const bool isTwoChannel = numChannels == 2;
+    if ( pixelStride == 0 )
+        pixelStride = BitsPerPixel( format ) / 8;
+    if ( rowStride == 0 )
+        rowStride = width * pixelStride;
+    if ( pixelStride < BitsPerPixel( format ) / 8 || rowStride < width * pixelStride )
+        return {};
 
-            normal = ScaleNormal( normal, slopeScale );
-            normalMap.Set( i, normal );
-        }
-    }
-    else
+    FloatImage2D normalMap( width, height, 3, ImageAllocFlags::UNINITIALIZED );
+    ImageView<float, 3> normals = normalMap.View<3>();
+    #pragma omp parallel for if ( width * height >= MIN_PIXELS_FOR_PARALLEL_LOOP )
+    for ( int row = 0; row < height; ++row )
     {
-        normalMap = FloatImage2D( rawImg.width, rawImg.height, 3 );
-        for ( int i = 0; i < normalMap.width * normalMap.height; ++i )
+        const uint8_t* rowStart = reinterpret_cast<const uint8_t*>( data ) + row * rowStride;
+        for ( int col = 0; col < width; ++col )
         {
+            const uint8_t* pixel = rowStart + col * pixelStride;
             vec3 normal;
-            if ( IsFormat8BitUnorm( rawImg.format ) )
-                normal = UnpackNormal_8Bit( rawImg.Raw<uint8_t>() + i * rawImg.NumChannels() );
+            if ( IsFormat32BitFloat( format ) )
+            {
+                const float* v = reinterpret_cast<const float*>( pixel );
+                normal         = isTwoChannel ? UnpackNormalXY_32Bit( vec2( v[0], v[1] ) ) : UnpackNormal_32Bit( vec3( v[0], v[1], v[2] ) );
+            }
+            else if ( IsFormat8BitUnorm( format ) )
+            {
+                normal = isTwoChannel ? UnpackNormalXY_8Bit( pixel ) : UnpackNormal_8Bit( pixel );
+            }
             else
-                normal = UnpackNormal_16Bit( rawImg.Raw<uint16_t>() + i * rawImg.NumChannels() );
+            {
+                const uint16_t* v = reinterpret_cast<const uint16_t*>( pixel );
+                normal            = isTwoChannel ? UnpackNormalXY_16Bit( v ) : UnpackNormal_16Bit( v );
+            }
 
             if ( flipY )
                 normal.y *= -1;
@@ -514,9 +665,35 @@ FloatImage2D LoadNormalMap( const std::string& filename, float slopeScale, bool
                 normal.x *= -1;
 
             normal = ScaleNormal( normal, slopeScale );
-            normalMap.Set( i, normal );
+            normals.Set( row, col, normal );
         }
     }
 
     return normalMap;
-}
\ No newline at end of file
+}
+
+static FloatImage2D DecodeNormalMap( RawImage2D rawImg, float slopeScale, bool flipY, bool flipX )
+{
+    if ( IsFormat16BitFloat( rawImg.format ) )
+        rawImg = RawImage2DFromFloatImage( FloatImageFromRawImage2D( rawImg ) );
+
+    return DecodeNormalMap( rawImg.data.get(), rawImg.width, rawImg.height, rawImg.format, 0, 0, slopeScale, flipY, flipX );
+}
+
+FloatImage2D LoadNormalMap( const std::string& filename, float slopeScale, bool flipY, bool flipX )
+{
+    RawImage2D rawImg;
+    if ( !rawImg.Load( filename ) )
+        return {};
+
+    return DecodeNormalMap( rawImg, slopeScale, flipY, flipX );
+}
+
+FloatImage2D LoadNormalMapFromMemory( const uint8_t* fileData, size_t size, const std::string& ext, float slopeScale, bool flipY, bool flipX )
+{
+    RawImage2D rawImg;
+    if ( !rawImg.LoadFromMemory( fileData, size, ext ) )
+        return {};
+
+    return DecodeNormalMap( rawImg, slopeScale, flipY, flipX );
+}
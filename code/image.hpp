@@ -1,5 +1,8 @@
 #pragma once
 
+#include "image_alloc.hpp"
+#include "image_view.hpp"
+#include "shared/assert.hpp"
 #include "shared/core_defines.hpp"
 #include "shared/float_conversions.hpp"
 #include "shared/math_vec.hpp"
@@ -17,7 +20,9 @@ PG_DEFINE_ENUM_OPS( ImageLoadFlags );
 enum class ImageSaveFlags : uint32_t
 {
     DEFAULT               = 0,
-    KEEP_FLOATS_AS_32_BIT = ( 1u << 0 ), // will convert f32 to fp16 by default if applicable, like when saving EXRs
+    KEEP_FLOATS_AS_32_BIT = ( 1u << 0 ), // will convert f32 to fp16 by default if applicable, like when saving EXRs or TIFs
+    TIFF_USE_LZW          = ( 1u << 1 ), // TIFs are deflate compressed by default
+    GENERATE_MIPMAPS      = ( 1u << 2 ), // only applicable to DDS and KTX2 files. Mips are generated with wrapping edges
 };
 PG_DEFINE_ENUM_OPS( ImageSaveFlags );
 
@@ -144,10 +149,10 @@ struct RawImage2D
     std::shared_ptr<uint8_t[]> data;
 
     RawImage2D() = default;
-    RawImage2D( int inWidth, int inHeight, ImageFormat inFormat ) : width( inWidth ), height( inHeight ), format( inFormat )
+    RawImage2D( int inWidth, int inHeight, ImageFormat inFormat, ImageAllocFlags allocFlags = ImageAllocFlags::DEFAULT )
+        : width( inWidth ), height( inHeight ), format( inFormat )
     {
-        size_t totalBytes = TotalBytes();
-        data              = std::make_shared<uint8_t[]>( totalBytes );
+        data = AllocateImageMemory( TotalBytes(), allocFlags );
     }
     RawImage2D( uint32_t inWidth, uint32_t inHeight, ImageFormat inFormat, uint8_t* srcData )
         : width( inWidth ), height( inHeight ), format( inFormat )
@@ -158,9 +163,16 @@ struct RawImage2D
 
     bool Load( const std::string& filename, ImageLoadFlags loadFlags = ImageLoadFlags::DEFAULT );
 
+    // Same as Load, but decodes a file that is already in memory. 'ext' picks the decoder (like ".png"). If it's empty, the
+    // format is detected with GetImageExtensionFromMagic
+    bool LoadFromMemory( const uint8_t* fileData, size_t size, std::string ext = "", ImageLoadFlags loadFlags = ImageLoadFlags::DEFAULT );
+
     // If the file format doesn't support saving the current Format, then the pixels will be converted to an appropriate format for that file
     bool Save( const std::string& filename, ImageSaveFlags saveFlags = ImageSaveFlags::DEFAULT ) const;
 
+    // Same as Save, but encodes the file into 'fileData' instead. 'ext' picks the file format, like ".png"
+    bool SaveToMemory( std::vector<uint8_t>& fileData, const std::string& ext, ImageSaveFlags saveFlags = ImageSaveFlags::DEFAULT ) const;
+
     // Returns a new image with same size + pixel data as the current image, but in the desired Format
     RawImage2D Convert( ImageFormat dstFormat ) const;
 
@@ -175,7 +187,7 @@ struct RawImage2D
     uint32_t BitsPerPixel() const { return ::BitsPerPixel( format ); }
     uint32_t NumChannels() const { return ::NumChannels( format ); }
 
-    size_t TotalBytes() const { return width * height * BitsPerPixel() / 8; }
+    size_t TotalBytes() const { return (size_t)width * height * BitsPerPixel() / 8; }
 
     template <typename T = uint8_t>
     T* Raw()
@@ -188,6 +200,21 @@ struct RawImage2D
     {
         return reinterpret_cast<const T*>( data.get() );
     }
+
+    // T and Channels have to match the format, like View<uint16_t, 2>() for R16_G16_UNORM
+    template <typename T, int Channels>
+    ImageView<T, Channels> View()
+    {
+        PG_ASSERT( sizeof( T ) * Channels * 8 == BitsPerPixel() && Channels == (int)NumChannels() );
+        return ImageView<T, Channels>( Raw<T>(), width, height );
+    }
+
+    template <typename T, int Channels>
+    ImageView<const T, Channels> View() const
+    {
+        PG_ASSERT( sizeof( T ) * Channels * 8 == BitsPerPixel() && Channels == (int)NumChannels() );
+        return ImageView<const T, Channels>( Raw<T>(), width, height );
+    }
 };
 
 struct FloatImage2D
@@ -198,10 +225,16 @@ struct FloatImage2D
     std::shared_ptr<float[]> data;
 
     FloatImage2D() = default;
-    FloatImage2D( int inWidth, int inHeight, int inNumChannels )
+    FloatImage2D( int inWidth, int inHeight, int inNumChannels, ImageAllocFlags allocFlags = ImageAllocFlags::DEFAULT )
         : width( inWidth ), height( inHeight ), numChannels( inNumChannels )
     {
-        data = std::make_shared<float[]>( width * height * numChannels );
+        data = AllocateImageData<float>( (size_t)width * height * numChannels, allocFlags );
+    }
+    // Doesn't take ownership of srcData, the caller has to keep it alive for as long as the image is used
+    FloatImage2D( int inWidth, int inHeight, int inNumChannels, float* srcData )
+        : width( inWidth ), height( inHeight ), numChannels( inNumChannels )
+    {
+        data = std::shared_ptr<float[]>( srcData, []( float* x ) {} );
     }
 
     // Currently just calls RawImage2D::Load, and then FloatImageFromRawImage2D
@@ -242,6 +275,21 @@ struct FloatImage2D
     void Set( int pixelIndex, const vec4& pixel );
     void Set( int row, int col, const vec4& pixel );
 
+    // Channels has to match numChannels. Prefer these over Get/Set in hot loops
+    template <int Channels>
+    ImageView<float, Channels> View()
+    {
+        PG_ASSERT( Channels == numChannels );
+        return ImageView<float, Channels>( data.get(), width, height );
+    }
+
+    template <int Channels>
+    ImageView<const float, Channels> View() const
+    {
+        PG_ASSERT( Channels == numChannels );
+        return ImageView<const float, Channels>( data.get(), width, height );
+    }
+
     operator bool() const { return width && height && numChannels && data != nullptr; }
 };
 
@@ -257,16 +305,52 @@ RawImage2D RawImage2DFromFloatImage( const FloatImage2D& floatImage, ImageFormat
 std::vector<RawImage2D> RawImage2DFromFloatImages(
     const std::vector<FloatImage2D>& floatImages, ImageFormat format = ImageFormat::INVALID );
 
+// Box filters 'src' down into 'dst', which has to be Max( 1, width / 2 ) x Max( 1, height / 2 ) with the same channel count.
+// Odd dimensions are area weighted (the source texels straddling two destination texels are split between them), so the
+// footprints never leave the image, and the mean is preserved
+void DownsampleBox2x2( const FloatImage2D& src, FloatImage2D& dst );
+FloatImage2D DownsampleBox2x2( const FloatImage2D& src );
+
+// Allocates mip levels [firstMip, numMips) of a width x height image as a single block. Every returned level keeps the block alive
+std::vector<FloatImage2D> AllocateMipChain( int width, int height, int numChannels, uint32_t firstMip, uint32_t numMips,
+    ImageAllocFlags allocFlags = ImageAllocFlags::DEFAULT );
+
 struct MipmapGenerationSettings
 {
+    // The box footprints never leave the image, so these don't change the results. Kept for filters that might read past the edges
     bool clampHorizontal = false;
     bool clampVertical   = false;
 };
 
+// mips[0] is 'floatImage' itself (not a copy), the rest are DownsampleBox2x2'd from each other into one AllocateMipChain block
 std::vector<FloatImage2D> GenerateMipmaps( const FloatImage2D& floatImage, const MipmapGenerationSettings& settings );
 
+// Saves every mip level into a single file. Currently only DDS and KTX2 are supported, which are saved as BC4 (first channel only)
+bool SaveMipChain( const std::string& filename, const std::vector<FloatImage2D>& mips );
+bool SaveMipChainToMemory( std::vector<uint8_t>& fileData, const std::string& ext, const std::vector<FloatImage2D>& mips );
+
+// zlib compresses 'data' with the same deflate implementation that the PNG writer uses. quality: the zlib level, 1-9
+bool ZlibCompress( const uint8_t* data, size_t size, std::vector<uint8_t>& compressed, int quality );
+
 uint32_t CalculateNumMips( int width, int height );
 double FloatImageMSE( const FloatImage2D& img1, const FloatImage2D& img2, uint32_t channelsToCalc = 0b1111 );
 double MSEToPSNR( double mse, double maxValue = 1.0 );
 
-FloatImage2D LoadNormalMap( const std::string& filename, float slopeScale, bool flipY, bool flipX );
\ No newline at end of file
+// Returns the file extension (like ".png") that matches the file's magic bytes, or an empty string if it isn't recognized.
+// TGA files have no magic bytes, so they are never detected
+std::string GetImageExtensionFromMagic( const uint8_t* fileData, size_t size );
+
+// Only reads the file header. Returns false if the file can't be opened, or the format isn't supported by RawImage2D::Load
+bool GetImageDimensions( const std::string& filename, int& width, int& height );
+
+// Unpacks the normals in a caller-owned buffer into a 3 channel float image. 'format' can be any 8 or 16-bit unorm, or 32-bit float format
+// with 2 (Z is reconstructed), 3, or 4 channels (alpha is ignored). Strides are in bytes, and 0 == tightly packed. Returns an empty
+// image if the strides would overlap pixels or rows
+FloatImage2D DecodeNormalMap( const void* data, int width, int height, ImageFormat format, size_t pixelStride, size_t rowStride, float slopeScale,
+    bool flipY, bool flipX );
+
+// Loads the file, and then calls DecodeNormalMap on it
+FloatImage2D LoadNormalMap( const std::string& filename, float slopeScale, bool flipY, bool flipX );
+
+// Same as LoadNormalMap, but for a file that is already in memory. See RawImage2D::LoadFromMemory for 'ext'
+FloatImage2D LoadNormalMapFromMemory( const uint8_t* fileData, size_t size, const std::string& ext, float slopeScale, bool flipY, bool flipX );
\ No newline at end of file
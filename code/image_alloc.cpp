@@ -0,0 +1,51 @@
+#include "image_alloc.hpp"
+#include "shared/platform_defines.hpp"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#if USING( LINUX_PROGRAM )
+#include <sys/mman.h>
+#endif
+
+static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+static void* AlignedAlloc( size_t alignment, size_t numBytes )
+{
+#if USING( WINDOWS_PROGRAM )
+    return _aligned_malloc( numBytes, alignment );
+#else
+    void* ptr = nullptr;
+    return posix_memalign( &ptr, alignment, numBytes ) == 0 ? ptr : nullptr;
+#endif
+}
+
+static void AlignedFree( void* ptr )
+{
+#if USING( WINDOWS_PROGRAM )
+    _aligned_free( ptr );
+#else
+    free( ptr );
+#endif
+}
+
+std::shared_ptr<uint8_t[]> AllocateImageMemory( size_t numBytes, ImageAllocFlags flags )
+{
+    bool useHugePages = numBytes >= IMAGE_HUGE_PAGE_THRESHOLD;
+    size_t alignment  = useHugePages ? HUGE_PAGE_SIZE : IMAGE_ALIGNMENT;
+    // round the size up too, so that the huge pages cover the whole allocation
+    size_t allocBytes = ( std::max<size_t>( numBytes, 1 ) + alignment - 1 ) / alignment * alignment;
+    uint8_t* ptr      = static_cast<uint8_t*>( AlignedAlloc( alignment, allocBytes ) );
+    if ( !ptr )
+        throw std::bad_alloc();
+
+#if USING( LINUX_PROGRAM )
+    // has to happen before the pages are first touched. It's only a hint, so failures (like THP being disabled) are fine
+    if ( useHugePages )
+        madvise( ptr, allocBytes, MADV_HUGEPAGE );
+#endif
+    if ( !IsSet( flags, ImageAllocFlags::UNINITIALIZED ) )
+        memset( ptr, 0, numBytes );
+
+    return std::shared_ptr<uint8_t[]>( ptr, []( uint8_t* p ) { AlignedFree( p ); } );
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "shared/core_defines.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+enum class ImageAllocFlags : uint32_t
+{
+    DEFAULT       = 0,
+    UNINITIALIZED = ( 1u << 0 ), // skip zeroing the memory. Only for images that have every pixel written before any are read
+};
+PG_DEFINE_ENUM_OPS( ImageAllocFlags );
+
+// Every image allocation is aligned to at least a cache line
+constexpr size_t IMAGE_ALIGNMENT = 64;
+
+// Allocations at least this big are aligned to 2MB and (on Linux) marked for transparent huge pages, to cut down on TLB misses
+// when sweeping over large images
+constexpr size_t IMAGE_HUGE_PAGE_THRESHOLD = 4 * 1024 * 1024;
+
+// The returned memory is freed when the last shared_ptr to it goes away. Throws std::bad_alloc on failure, like make_shared
+std::shared_ptr<uint8_t[]> AllocateImageMemory( size_t numBytes, ImageAllocFlags flags = ImageAllocFlags::DEFAULT );
+
+template <typename T>
+std::shared_ptr<T[]> AllocateImageData( size_t count, ImageAllocFlags flags = ImageAllocFlags::DEFAULT )
+{
+    return std::reinterpret_pointer_cast<T[]>( AllocateImageMemory( count * sizeof( T ), flags ) );
+}
@@ -1,4 +1,6 @@
 #include "image.hpp"
+#include "bc_compression.hpp"
+#include "dds.hpp"
 #include "shared/filesystem.hpp"
 #include "shared/logger.hpp"
 #define STBI_NO_PIC
@@ -6,48 +8,180 @@
 #define STBI_NO_GIF
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
-#include "tiffio.h"
+#include "tiff_mem_stream.hpp"
 #include "tinyexr/tinyexr.h"
+#include <climits>
+#include <vector>
 
-bool RawImage2D::Load( const std::string& filename, ImageLoadFlags loadFlags )
+std::string GetImageExtensionFromMagic( const uint8_t* fileData, size_t size )
 {
-    std::string ext = GetFileExtension( filename );
-    if ( ext == ".jpg" || ext == ".png" || ext == ".tga" || ext == ".bmp" || ext == ".ppm" || ext == ".pbm" || ext == ".hdr" )
+    auto StartsWith = [&]( const char* magic, size_t magicLen ) { return size >= magicLen && memcmp( fileData, magic, magicLen ) == 0; };
+
+    if ( StartsWith( "\x89PNG", 4 ) )
+        return ".png";
+    if ( StartsWith( "\xFF\xD8\xFF", 3 ) )
+        return ".jpg";
+    if ( StartsWith( "II*\0", 4 ) || StartsWith( "MM\0*", 4 ) )
+        return ".tif";
+    if ( StartsWith( "\x76\x2F\x31\x01", 4 ) )
+        return ".exr";
+    if ( StartsWith( "DDS ", 4 ) )
+        return ".dds";
+    if ( StartsWith( "#?RADIANCE", 10 ) || StartsWith( "#?RGBE", 6 ) )
+        return ".hdr";
+    if ( StartsWith( "BM", 2 ) )
+        return ".bmp";
+    if ( StartsWith( "P5", 2 ) || StartsWith( "P6", 2 ) )
+        return ".ppm";
+
+    return "";
+}
+
+static bool GetBCFormatFromDDS( const DDSHeader& header, const DDSHeaderDX10* dx10Header, BCFormat& format )
+{
+    if ( dx10Header )
     {
-        FILE* file = fopen( filename.c_str(), "rb" );
-        if ( file == NULL )
+        switch ( dx10Header->dxgiFormat )
         {
-            LOG_ERR( "RawImage2D::Load: Could not open file '%s'", filename.c_str() );
-            return false;
+        case DXGI_FORMAT_BC1_UNORM: format = BCFormat::BC1; return true;
+        case DXGI_FORMAT_BC3_UNORM: format = BCFormat::BC3; return true;
+        case DXGI_FORMAT_BC4_UNORM: format = BCFormat::BC4; return true;
+        case DXGI_FORMAT_BC4_SNORM: format = BCFormat::BC4_SNORM; return true;
+        case DXGI_FORMAT_BC5_UNORM: format = BCFormat::BC5; return true;
+        case DXGI_FORMAT_BC5_SNORM: format = BCFormat::BC5_SNORM; return true;
+        default: return false;
         }
+    }
+
+    if ( !( header.ddspf.flags & DDPF_FOURCC ) )
+        return false;
+
+    bool isNormalMap = header.ddspf.flags & DDPF_NORMAL;
+    switch ( header.ddspf.fourCC )
+    {
+    case DDS_MAKE_FOURCC( 'D', 'X', 'T', '1' ): format = BCFormat::BC1; return true;
+    case DDS_MAKE_FOURCC( 'D', 'X', 'T', '5' ): format = isNormalMap ? BCFormat::BC3N : BCFormat::BC3; return true;
+    case DDS_MAKE_FOURCC( 'A', 'T', 'I', '1' ):
+    case DDS_MAKE_FOURCC( 'B', 'C', '4', 'U' ): format = BCFormat::BC4; return true;
+    case DDS_MAKE_FOURCC( 'B', 'C', '4', 'S' ): format = BCFormat::BC4_SNORM; return true;
+    case DDS_MAKE_FOURCC( 'A', 'T', 'I', '2' ):
+    case DDS_MAKE_FOURCC( 'B', 'C', '5', 'U' ): format = BCFormat::BC5; return true;
+    case DDS_MAKE_FOURCC( 'B', 'C', '5', 'S' ): format = BCFormat::BC5_SNORM; return true;
+    default: return false;
+    }
+}
+
+// Has to fit in an int, with room to round up to whole blocks
+static bool ValidDDSDimensions( const DDSHeader& header )
+{
+    return header.width != 0 && header.height != 0 && header.width <= INT_MAX - 3 && header.height <= INT_MAX - 3;
+}
+
+// Only loads the first mip of BC1, BC3, BC4, and BC5 DDS images. The blocks get decoded into 8-bit unorm images
+static bool LoadDDS( const uint8_t* fileData, size_t size, RawImage2D& image, const char* name )
+{
+    uint32_t magic;
+    DDSHeader header;
+    DDSHeaderDX10 dx10Header;
+    size_t offset      = sizeof( magic ) + sizeof( header );
+    bool hasDX10Header = false;
+    bool validHeader   = size >= offset;
+    if ( validHeader )
+    {
+        memcpy( &magic, fileData, sizeof( magic ) );
+        memcpy( &header, fileData + sizeof( magic ), sizeof( header ) );
+        validHeader = magic == DDS_MAGIC && header.size == sizeof( DDSHeader );
+    }
+    if ( validHeader && ( header.ddspf.flags & DDPF_FOURCC ) && header.ddspf.fourCC == DDS_MAKE_FOURCC( 'D', 'X', '1', '0' ) )
+    {
+        hasDX10Header = true;
+        validHeader   = size >= offset + sizeof( dx10Header );
+        if ( validHeader )
+            memcpy( &dx10Header, fileData + offset, sizeof( dx10Header ) );
+        offset += sizeof( dx10Header );
+    }
+    if ( !validHeader )
+    {
+        LOG_ERR( "RawImage2D::Load: invalid DDS header in image '%s'", name );
+        return false;
+    }
+
+    BCFormat bcFormat;
+    if ( !GetBCFormatFromDDS( header, hasDX10Header ? &dx10Header : nullptr, bcFormat ) )
+    {
+        LOG_ERR( "RawImage2D::Load: unsupported DDS format in image '%s'. Only BC1, BC3, BC4, and BC5 are supported", name );
+        return false;
+    }
+
+    if ( !ValidDDSDimensions( header ) )
+    {
+        LOG_ERR( "RawImage2D::Load: DDS image '%s' has invalid dimensions %ux%u", name, header.width, header.height );
+        return false;
+    }
+    int w = static_cast<int>( header.width );
+    int h = static_cast<int>( header.height );
+    if ( size - offset < BCTotalBytes( bcFormat, w, h ) )
+    {
+        LOG_ERR( "RawImage2D::Load: DDS image '%s' is truncated", name );
+        return false;
+    }
+
+    ImageFormat format = static_cast<ImageFormat>( Underlying( ImageFormat::R8_UNORM ) + BCNumDecodedChannels( bcFormat ) - 1 );
+    image              = RawImage2D( w, h, format, ImageAllocFlags::UNINITIALIZED );
+    DecodeBCImage( bcFormat, fileData + offset, w, h, image.Raw() );
+
+    return true;
+}
 
+static bool ReadFileBytes( const std::string& filename, std::vector<uint8_t>& bytes )
+{
+    FILE* file = fopen( filename.c_str(), "rb" );
+    if ( file == NULL )
+        return false;
+
+    fseek( file, 0, SEEK_END );
+    long size = ftell( file );
+    fseek( file, 0, SEEK_SET );
+    bytes.resize( size > 0 ? size : 0 );
+    bool success = size >= 0 && fread( bytes.data(), 1, bytes.size(), file ) == bytes.size();
+    fclose( file );
+
+    return success;
+}
+
+// 'name' is only used for error messages
+static bool DecodeImageFile( RawImage2D& image, const uint8_t* fileData, size_t size, const std::string& ext, const char* name )
+{
+    if ( ext == ".jpg" || ext == ".png" || ext == ".tga" || ext == ".bmp" || ext == ".ppm" || ext == ".pbm" || ext == ".hdr" )
+    {
         int w, h, numChannels;
+        int len = static_cast<int>( size );
         ImageFormat startFormat;
         uint8_t* pixels;
         if ( ext == ".hdr" )
         {
             startFormat = ImageFormat::R32_FLOAT;
-            pixels      = (uint8_t*)stbi_loadf( filename.c_str(), &w, &h, &numChannels, 0 );
+            pixels      = (uint8_t*)stbi_loadf_from_memory( fileData, len, &w, &h, &numChannels, 0 );
         }
-        else if ( stbi_is_16_bit_from_file( file ) )
+        else if ( stbi_is_16_bit_from_memory( fileData, len ) )
         {
             startFormat = ImageFormat::R16_UNORM;
-            pixels      = (uint8_t*)stbi_load_from_file_16( file, &w, &h, &numChannels, 0 );
+            pixels      = (uint8_t*)stbi_load_16_from_memory( fileData, len, &w, &h, &numChannels, 0 );
         }
         else
         {
             startFormat = ImageFormat::R8_UNORM;
-            pixels      = stbi_load_from_file( file, &w, &h, &numChannels, 0 );
+            pixels      = stbi_load_from_memory( fileData, len, &w, &h, &numChannels, 0 );
         }
         if ( !pixels )
         {
-            LOG_ERR( "RawImage2D::Load: error while loading image '%s'", filename.c_str() );
+            LOG_ERR( "RawImage2D::Load: error while loading image '%s'", name );
             return false;
         }
-        data   = std::shared_ptr<uint8_t[]>( pixels, []( void* p ) { stbi_image_free( p ); } );
-        width  = static_cast<uint32_t>( w );
-        height = static_cast<uint32_t>( h );
-        format = static_cast<ImageFormat>( (int)startFormat + numChannels - 1 );
+        image.data   = std::shared_ptr<uint8_t[]>( pixels, []( void* p ) { stbi_image_free( p ); } );
+        image.width  = static_cast<uint32_t>( w );
+        image.height = static_cast<uint32_t>( h );
+        image.format = static_cast<ImageFormat>( (int)startFormat + numChannels - 1 );
     }
     else if ( ext == ".tif" || ext == ".tiff" )
     {
@@ -56,120 +190,226 @@ bool RawImage2D::Load( const std::string& filename, ImageLoadFlags loadFlags )
         // TIFFSetErrorHandler( NULL );
         // TIFFSetErrorHandlerExt( NULL );
 
-        TIFF* tif = TIFFOpen( filename.c_str(), "rb" );
-        if ( tif )
+        TiffMemStream stream;
+        stream.readOnlyData = fileData;
+        stream.readOnlySize = size;
+        TIFF* tif           = TiffMemOpen( stream, name, "r" );
+        if ( !tif )
         {
-            if ( TIFFIsTiled( tif ) )
-            {
-                LOG_ERR( "Tiled TIF images not currently supported (image '%s')", filename.c_str() );
-                TIFFClose( tif );
-                return false;
-            }
+            LOG_ERR( "RawImage2D::Load: error while loading image '%s'", name );
+            return false;
+        }
 
-            uint16_t config;
-            TIFFGetField( tif, TIFFTAG_PLANARCONFIG, &config );
-            if ( config != PLANARCONFIG_CONTIG )
-            {
-                LOG_ERR( "Separate planar TIF images not currently supported (image '%s')", filename.c_str() );
-                TIFFClose( tif );
-                return false;
-            }
+        if ( TIFFIsTiled( tif ) )
+        {
+            LOG_ERR( "Tiled TIF images not currently supported (image '%s')", name );
+            TIFFClose( tif );
+            return false;
+        }
 
-            uint16_t numChannels, numBitsPerChannel;
-            TIFFGetField( tif, TIFFTAG_SAMPLESPERPIXEL, &numChannels );
-            TIFFGetField( tif, TIFFTAG_BITSPERSAMPLE, &numBitsPerChannel );
-            if ( numBitsPerChannel != 8 && numBitsPerChannel != 16 && numBitsPerChannel != 32 )
-            {
-                LOG_ERR( "%u bit TIF images not currently supported (image '%s')", numBitsPerChannel, filename.c_str() );
-                TIFFClose( tif );
-                return false;
-            }
+        uint16_t config;
+        TIFFGetField( tif, TIFFTAG_PLANARCONFIG, &config );
+        if ( config != PLANARCONFIG_CONTIG )
+        {
+            LOG_ERR( "Separate planar TIF images not currently supported (image '%s')", name );
+            TIFFClose( tif );
+            return false;
+        }
+
+        uint16_t numChannels, numBitsPerChannel, sampleFormat;
+        TIFFGetField( tif, TIFFTAG_SAMPLESPERPIXEL, &numChannels );
+        TIFFGetField( tif, TIFFTAG_BITSPERSAMPLE, &numBitsPerChannel );
+        TIFFGetFieldDefaulted( tif, TIFFTAG_SAMPLEFORMAT, &sampleFormat );
+        if ( numBitsPerChannel != 8 && numBitsPerChannel != 16 && numBitsPerChannel != 32 )
+        {
+            LOG_ERR( "%u bit TIF images not currently supported (image '%s')", numBitsPerChannel, name );
+            TIFFClose( tif );
+            return false;
+        }
 
-            TIFFGetField( tif, TIFFTAG_IMAGEWIDTH, &width );
-            TIFFGetField( tif, TIFFTAG_IMAGELENGTH, &height );
+        uint32_t width, height;
+        TIFFGetField( tif, TIFFTAG_IMAGEWIDTH, &width );
+        TIFFGetField( tif, TIFFTAG_IMAGELENGTH, &height );
 
-            ImageFormat format = ImageFormat::R8_UNORM;
-            if ( numBitsPerChannel == 16 )
-                format = ImageFormat::R16_UNORM;
-            else if ( numBitsPerChannel == 32 )
-                format = ImageFormat::R32_FLOAT;
+        ImageFormat format = ImageFormat::R8_UNORM;
+        if ( numBitsPerChannel == 16 )
+            format = sampleFormat == SAMPLEFORMAT_IEEEFP ? ImageFormat::R16_FLOAT : ImageFormat::R16_UNORM;
+        else if ( numBitsPerChannel == 32 )
+            format = ImageFormat::R32_FLOAT;
 
-            format = static_cast<ImageFormat>( Underlying( format ) + numChannels - 1 );
-            *this  = RawImage2D( width, height, format );
+        format = static_cast<ImageFormat>( Underlying( format ) + numChannels - 1 );
+        image  = RawImage2D( width, height, format );
 
-            size_t stripSize   = TIFFStripSize( tif );
-            uint32_t numStrips = TIFFNumberOfStrips( tif );
-            uint32_t rowsPerStrip;
-            TIFFGetFieldDefaulted( tif, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip );
-            uint8_t* buf = static_cast<uint8_t*>( _TIFFmalloc( stripSize ) );
+        size_t stripSize   = TIFFStripSize( tif );
+        uint32_t numStrips = TIFFNumberOfStrips( tif );
+        uint32_t rowsPerStrip;
+        TIFFGetFieldDefaulted( tif, TIFFTAG_ROWSPERSTRIP, &rowsPerStrip );
+        uint8_t* buf = static_cast<uint8_t*>( _TIFFmalloc( stripSize ) );
 
-            uint32_t bytesPerPixel = numChannels * numBitsPerChannel / 8;
-            uint32_t bytesPerRow   = width * bytesPerPixel;
+        uint32_t bytesPerPixel = numChannels * numBitsPerChannel / 8;
+        uint32_t bytesPerRow   = width * bytesPerPixel;
 
-            int totalRowsRead = 0;
-            for ( uint32_t strip = 0; strip < numStrips; strip++ )
+        uint32_t totalRowsRead = 0;
+        for ( uint32_t strip = 0; strip < numStrips; strip++ )
+        {
+            if ( TIFFReadEncodedStrip( tif, strip, buf, (tsize_t)-1 ) == -1 )
             {
-                if ( TIFFReadEncodedStrip( tif, strip, buf, (tsize_t)-1 ) == -1 )
-                {
-                    LOG_ERR( "TIFFReadEncodedStrip error while processing TIF '%s'", filename.c_str() );
-                    _TIFFfree( buf );
-                    TIFFClose( tif );
-                    return false;
-                }
+                LOG_ERR( "TIFFReadEncodedStrip error while processing TIF '%s'", name );
+                _TIFFfree( buf );
+                TIFFClose( tif );
+                return false;
+            }
 
-                for ( uint32_t r = 0; r < rowsPerStrip; ++r )
+            for ( uint32_t r = 0; r < rowsPerStrip; ++r )
+            {
+                if ( totalRowsRead < height )
                 {
-                    if ( totalRowsRead < height )
-                    {
-                        memcpy( Raw() + totalRowsRead * bytesPerRow, buf + r * bytesPerRow, bytesPerRow );
-                        ++totalRowsRead;
-                    }
+                    memcpy( image.Raw() + totalRowsRead * bytesPerRow, buf + r * bytesPerRow, bytesPerRow );
+                    ++totalRowsRead;
                 }
             }
-            _TIFFfree( buf );
-            TIFFClose( tif );
         }
+        _TIFFfree( buf );
+        TIFFClose( tif );
+    }
+    else if ( ext == ".dds" )
+    {
+        if ( !LoadDDS( fileData, size, image, name ) )
+            return false;
     }
     else if ( ext == ".exr" )
     {
         const char* err = nullptr;
         float* pixels;
         int w, h;
-        bool success = LoadEXR( &pixels, &w, &h, filename.c_str(), &err ) == TINYEXR_SUCCESS;
+        bool success = LoadEXRFromMemory( &pixels, &w, &h, fileData, size, &err ) == TINYEXR_SUCCESS;
         if ( !success )
         {
-            LOG_ERR( "RawImage2D::Load: error while loading image '%s'", filename.c_str() );
+            LOG_ERR( "RawImage2D::Load: error while loading image '%s'", name );
             if ( err )
             {
                 LOG_ERR( "\tTinyexr error '%s'", err );
             }
             return false;
         }
-        data   = std::shared_ptr<uint8_t[]>( (uint8_t*)pixels, []( void* p ) { free( p ); } );
-        width  = static_cast<uint32_t>( w );
-        height = static_cast<uint32_t>( h );
-        format = ImageFormat::R32_G32_B32_A32_FLOAT;
+        image.data   = std::shared_ptr<uint8_t[]>( (uint8_t*)pixels, []( void* p ) { free( p ); } );
+        image.width  = static_cast<uint32_t>( w );
+        image.height = static_cast<uint32_t>( h );
+        image.format = ImageFormat::R32_G32_B32_A32_FLOAT;
     }
     else
     {
-        LOG_ERR( "Image filetype '%s' for image '%s' is not supported", ext.c_str(), filename.c_str() );
+        LOG_ERR( "Image filetype '%s' for image '%s' is not supported", ext.c_str(), name );
+        return false;
+    }
+
+    return true;
+}
+
+static void FlipVertically( RawImage2D& image )
+{
+    int bytesPerRow = image.width * image.BitsPerPixel() / 8;
+    uint8_t* tmpRow = new uint8_t[bytesPerRow];
+    for ( int row = 0; row < image.height / 2; ++row )
+    {
+        uint8_t* upperRow = image.data.get() + row * bytesPerRow;
+        uint8_t* lowerRow = image.data.get() + ( image.height - row - 1 ) * bytesPerRow;
+        memcpy( tmpRow, upperRow, bytesPerRow );
+        memcpy( upperRow, lowerRow, bytesPerRow );
+        memcpy( lowerRow, tmpRow, bytesPerRow );
+    }
+    delete[] tmpRow;
+}
+
+bool RawImage2D::Load( const std::string& filename, ImageLoadFlags loadFlags )
+{
+    std::vector<uint8_t> fileData;
+    if ( !ReadFileBytes( filename, fileData ) )
+    {
+        LOG_ERR( "RawImage2D::Load: Could not open file '%s'", filename.c_str() );
         return false;
     }
+    if ( !DecodeImageFile( *this, fileData.data(), fileData.size(), GetFileExtension( filename ), filename.c_str() ) )
+        return false;
 
     if ( IsSet( loadFlags, ImageLoadFlags::FLIP_VERTICALLY ) )
+        FlipVertically( *this );
+
+    return true;
+}
+
+bool RawImage2D::LoadFromMemory( const uint8_t* fileData, size_t size, std::string ext, ImageLoadFlags loadFlags )
+{
+    if ( ext.empty() )
+        ext = GetImageExtensionFromMagic( fileData, size );
+    if ( ext.empty() )
+    {
+        LOG_ERR( "RawImage2D::LoadFromMemory: could not detect the image format" );
+        return false;
+    }
+    if ( !DecodeImageFile( *this, fileData, size, ext, ext.c_str() ) )
+        return false;
+
+    if ( IsSet( loadFlags, ImageLoadFlags::FLIP_VERTICALLY ) )
+        FlipVertically( *this );
+
+    return true;
+}
+
+bool GetImageDimensions( const std::string& filename, int& width, int& height )
+{
+    std::string ext = GetFileExtension( filename );
+    if ( ext == ".jpg" || ext == ".png" || ext == ".tga" || ext == ".bmp" || ext == ".ppm" || ext == ".pbm" || ext == ".hdr" )
     {
-        int bytesPerRow = width * BitsPerPixel() / 8;
-        uint8_t* tmpRow = new uint8_t[bytesPerRow];
-        for ( int row = 0; row < height / 2; ++row )
+        int numChannels;
+        return stbi_info( filename.c_str(), &width, &height, &numChannels ) != 0;
+    }
+    else if ( ext == ".tif" || ext == ".tiff" )
+    {
+        TIFF* tif = TIFFOpen( filename.c_str(), "rb" );
+        if ( !tif )
+            return false;
+        uint32_t w = 0, h = 0;
+        TIFFGetField( tif, TIFFTAG_IMAGEWIDTH, &w );
+        TIFFGetField( tif, TIFFTAG_IMAGELENGTH, &h );
+        TIFFClose( tif );
+        width  = static_cast<int>( w );
+        height = static_cast<int>( h );
+        return true;
+    }
+    else if ( ext == ".dds" )
+    {
+        FILE* file = fopen( filename.c_str(), "rb" );
+        if ( file == NULL )
+            return false;
+        uint32_t magic;
+        DDSHeader header;
+        bool success = fread( &magic, sizeof( magic ), 1, file ) == 1 && magic == DDS_MAGIC && fread( &header, sizeof( header ), 1, file ) == 1;
+        success      = success && ValidDDSDimensions( header );
+        fclose( file );
+        if ( success )
+        {
+            width  = static_cast<int>( header.width );
+            height = static_cast<int>( header.height );
+        }
+        return success;
+    }
+    else if ( ext == ".exr" )
+    {
+        EXRVersion version;
+        EXRHeader header;
+        InitEXRHeader( &header );
+        if ( ParseEXRVersionFromFile( &version, filename.c_str() ) != TINYEXR_SUCCESS ||
+             ParseEXRHeaderFromFile( &header, &version, filename.c_str(), nullptr ) != TINYEXR_SUCCESS )
         {
-            uint8_t* upperRow = data.get() + row * bytesPerRow;
-            uint8_t* lowerRow = data.get() + ( height - row - 1 ) * bytesPerRow;
-            memcpy( tmpRow, upperRow, bytesPerRow );
-            memcpy( upperRow, lowerRow, bytesPerRow );
-            memcpy( lowerRow, tmpRow, bytesPerRow );
+            FreeEXRHeader( &header );
+            return false;
         }
-        delete[] tmpRow;
+        width  = header.data_window.max_x - header.data_window.min_x + 1;
+        height = header.data_window.max_y - header.data_window.min_y + 1;
+        FreeEXRHeader( &header );
+        return true;
     }
 
-    return true;
+    return false;
 }
@@ -0,0 +1,231 @@
+#include "image_metrics.hpp"
+#include "shared/logger.hpp"
+#include <algorithm>
+#include <cmath>
+#include <omp.h>
+
+static constexpr int SSIM_BLOCK_SIZE       = 8;
+static constexpr int ANGLE_BINS_PER_DEGREE = 100;
+static constexpr int NUM_ANGLE_BINS        = 180 * ANGLE_BINS_PER_DEGREE + 1;
+
+// One per thread, aligned to a cache line so that the threads don't false share
+struct alignas( 64 ) MetricAccumulator
+{
+    double squaredError    = 0;
+    double ssimSum         = 0;
+    uint64_t numSSIMBlocks = 0;
+
+    // only used for normal maps
+    double dotSquaredError = 0;
+    double angleSum        = 0;
+    double maxAngle        = 0;
+    uint64_t numNonFinite  = 0;
+    std::vector<uint64_t> angleHistogram;
+};
+
+struct SSIMSums
+{
+    double x, y, xx, yy, xy;
+    int numPixels;
+};
+
+static double BlockSSIM( const SSIMSums& s, double numPixels, double C1, double C2 )
+{
+    double muX   = s.x / numPixels;
+    double muY   = s.y / numPixels;
+    double varX  = std::max( 0.0, s.xx / numPixels - muX * muX );
+    double varY  = std::max( 0.0, s.yy / numPixels - muY * muY );
+    double covXY = s.xy / numPixels - muX * muY;
+
+    return ( ( 2 * muX * muY + C1 ) * ( 2 * covXY + C2 ) ) / ( ( muX * muX + muY * muY + C1 ) * ( varX + varY + C2 ) );
+}
+
+// Streams over both images in bands of SSIM_BLOCK_SIZE rows, accumulating the squared error and SSIM of 'channels' into the
+// calling thread's accumulator. perPixel( accumulator, pixel1, pixel2 ) is called on every pixel, for any extra metrics, and returns
+// false to leave the pixel out. Pixels with a non-finite value in any of 'channels' are always left out, and counted in numNonFinite
+template <typename PixelFunc>
+static void StreamImagePair( const FloatImage2D& img1, const FloatImage2D& img2, const std::vector<int>& channels, double maxValue,
+    std::vector<MetricAccumulator>& accumulators, PixelFunc perPixel )
+{
+    int width       = img1.width;
+    int height      = img1.height;
+    int numChannels = img1.numChannels;
+    int numChans    = (int)channels.size();
+    int numBlocksX  = ( width + SSIM_BLOCK_SIZE - 1 ) / SSIM_BLOCK_SIZE;
+    int numBands    = ( height + SSIM_BLOCK_SIZE - 1 ) / SSIM_BLOCK_SIZE;
+    double C1       = ( 0.01 * maxValue ) * ( 0.01 * maxValue );
+    double C2       = ( 0.03 * maxValue ) * ( 0.03 * maxValue );
+
+    #pragma omp parallel
+    {
+        MetricAccumulator& acc = accumulators[omp_get_thread_num()];
+        std::vector<SSIMSums> blockSums( numBlocksX * numChans );
+
+        #pragma omp for schedule( static )
+        for ( int band = 0; band < numBands; ++band )
+        {
+            std::fill( blockSums.begin(), blockSums.end(), SSIMSums{} );
+            int rowStart = band * SSIM_BLOCK_SIZE;
+            int rowEnd   = std::min( rowStart + SSIM_BLOCK_SIZE, height );
+            for ( int row = rowStart; row < rowEnd; ++row )
+            {
+                const float* p1 = img1.data.get() + (size_t)row * width * numChannels;
+                const float* p2 = img2.data.get() + (size_t)row * width * numChannels;
+                for ( int col = 0; col < width; ++col, p1 += numChannels, p2 += numChannels )
+                {
+                    bool finite = true;
+                    for ( int c = 0; c < numChans; ++c )
+                        finite = finite && std::isfinite( p1[channels[c]] ) && std::isfinite( p2[channels[c]] );
+                    if ( !finite || !perPixel( acc, p1, p2 ) )
+                    {
+                        ++acc.numNonFinite;
+                        continue;
+                    }
+
+                    SSIMSums* sums = &blockSums[( col / SSIM_BLOCK_SIZE ) * numChans];
+                    for ( int c = 0; c < numChans; ++c )
+                    {
+                        double x = p1[channels[c]];
+                        double y = p2[channels[c]];
+                        acc.squaredError += ( x - y ) * ( x - y );
+                        sums[c].x  += x;
+                        sums[c].y  += y;
+                        sums[c].xx += x * x;
+                        sums[c].yy += y * y;
+                        sums[c].xy += x * y;
+                        sums[c].numPixels += 1;
+                    }
+                }
+            }
+
+            for ( const SSIMSums& sums : blockSums )
+            {
+                if ( sums.numPixels == 0 )
+                    continue;
+                acc.ssimSum += BlockSSIM( sums, sums.numPixels, C1, C2 );
+                acc.numSSIMBlocks += 1;
+            }
+        }
+    }
+}
+
+static bool ValidateImagePair( const FloatImage2D& img1, const FloatImage2D& img2, int minChannels )
+{
+    if ( img1.width != img2.width || img1.height != img2.height || img1.numChannels != img2.numChannels )
+    {
+        LOG_ERR( "Images must be same size and channel count to compare them" );
+        return false;
+    }
+    if ( img1.numChannels < minChannels || img1.width * img1.height == 0 )
+    {
+        LOG_ERR( "Images must have at least %d channels and 1 pixel to compare them", minChannels );
+        return false;
+    }
+
+    return true;
+}
+
+ImageMetrics CompareImages( const FloatImage2D& img1, const FloatImage2D& img2, uint32_t channelsToCalc, double maxValue )
+{
+    ImageMetrics metrics;
+    if ( !ValidateImagePair( img1, img2, 1 ) )
+        return metrics;
+
+    std::vector<int> channels;
+    for ( int chan = 0; chan < img1.numChannels; ++chan )
+    {
+        if ( channelsToCalc & ( 1 << ( 3 - chan ) ) )
+            channels.push_back( chan );
+    }
+    if ( channels.empty() )
+        return metrics;
+
+    std::vector<MetricAccumulator> accumulators( omp_get_max_threads() );
+    StreamImagePair( img1, img2, channels, maxValue, accumulators, []( MetricAccumulator&, const float*, const float* ) { return true; } );
+
+    double squaredError = 0;
+    double ssimSum      = 0;
+    uint64_t numBlocks  = 0;
+    for ( const MetricAccumulator& acc : accumulators )
+    {
+        squaredError += acc.squaredError;
+        ssimSum      += acc.ssimSum;
+        numBlocks    += acc.numSSIMBlocks;
+        metrics.nonFinitePixels += acc.numNonFinite;
+    }
+
+    double numPixels = (double)img1.width * img1.height - metrics.nonFinitePixels;
+    if ( numPixels == 0 )
+        return metrics;
+
+    metrics.mse  = squaredError / ( numPixels * channels.size() );
+    metrics.psnr = MSEToPSNR( metrics.mse, maxValue );
+    metrics.ssim = ssimSum / numBlocks;
+    return metrics;
+}
+
+NormalMapMetrics CompareNormalMapsDetailed( const FloatImage2D& img1, const FloatImage2D& img2, double percentile )
+{
+    NormalMapMetrics metrics;
+    if ( !ValidateImagePair( img1, img2, 3 ) )
+        return metrics;
+
+    std::vector<MetricAccumulator> accumulators( omp_get_max_threads() );
+    for ( MetricAccumulator& acc : accumulators )
+        acc.angleHistogram.resize( NUM_ANGLE_BINS, 0 );
+
+    StreamImagePair( img1, img2, { 0, 1, 2 }, 2.0, accumulators,
+        []( MetricAccumulator& acc, const float* n1, const float* n2 )
+        {
+            // the components are finite, but the dot can still overflow
+            float dot = n1[0] * n2[0] + n1[1] * n2[1] + n1[2] * n2[2];
+            if ( !std::isfinite( dot ) )
+                return false;
+            float d = -dot + 1;
+            acc.dotSquaredError += d * d;
+
+            double angle = acos( std::clamp( (double)dot, -1.0, 1.0 ) ) * ( 180.0 / PI );
+            acc.angleSum += angle;
+            acc.maxAngle  = std::max( acc.maxAngle, angle );
+            acc.angleHistogram[std::min( (int)( angle * ANGLE_BINS_PER_DEGREE + 0.5 ), NUM_ANGLE_BINS - 1 )] += 1;
+            return true;
+        } );
+
+    double dotSquaredError = 0;
+    double ssimSum = 0;
+    uint64_t numBlocks = 0;
+    std::vector<uint64_t> angleHistogram( NUM_ANGLE_BINS, 0 );
+    for ( const MetricAccumulator& acc : accumulators )
+    {
+        dotSquaredError += acc.dotSquaredError;
+        ssimSum         += acc.ssimSum;
+        numBlocks       += acc.numSSIMBlocks;
+        metrics.meanAngularError += acc.angleSum;
+        metrics.maxAngularError   = std::max( metrics.maxAngularError, acc.maxAngle );
+        metrics.nonFinitePixels  += acc.numNonFinite;
+        for ( int bin = 0; bin < NUM_ANGLE_BINS; ++bin )
+            angleHistogram[bin] += acc.angleHistogram[bin];
+    }
+
+    double numPixels = (double)img1.width * img1.height - metrics.nonFinitePixels;
+    if ( numPixels == 0 )
+        return metrics;
+
+    metrics.ssim = ssimSum / numBlocks;
+    metrics.psnr = MSEToPSNR( dotSquaredError / numPixels, 2.0 );
+    metrics.meanAngularError /= numPixels;
+
+    uint64_t target = (uint64_t)ceil( std::clamp( percentile, 0.0, 1.0 ) * numPixels );
+    uint64_t count  = 0;
+    for ( int bin = 0; bin < NUM_ANGLE_BINS; ++bin )
+    {
+        count += angleHistogram[bin];
+        if ( count >= target )
+        {
+            metrics.percentileAngularError = std::min( (double)bin / ANGLE_BINS_PER_DEGREE, metrics.maxAngularError );
+            break;
+        }
+    }
+
+    return metrics;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "image.hpp"
+
+// All of these stream over both images once, in parallel, without allocating any per-pixel intermediates (no diff images),
+// so they are fine to use on very large images.
+// SSIM is the mean of the SSIMs of every non-overlapping 8x8 block (smaller at the right and bottom edges), averaged over the channels.
+// Pixels with a NaN or infinite value (possible in float images) are left out of every metric, and only counted in nonFinitePixels
+
+struct ImageMetrics
+{
+    double mse  = 0;
+    double psnr = 0;
+    double ssim = 0;
+    uint64_t nonFinitePixels = 0;
+};
+
+// channelsToCalc: same mask as FloatImageMSE. maxValue: the dynamic range of the images, for the PSNR and SSIM
+ImageMetrics CompareImages( const FloatImage2D& img1, const FloatImage2D& img2, uint32_t channelsToCalc = 0b1111, double maxValue = 1.0 );
+
+struct NormalMapMetrics
+{
+    double psnr = 0; // same as CompareNormalMaps
+    double ssim = 0; // of the XYZ components, with a dynamic range of 2 (unpacked normals)
+    double meanAngularError = 0; // all angular errors are in degrees
+    double maxAngularError  = 0;
+    double percentileAngularError = 0; // the error that 'percentile' of the pixels are at or below. Accurate to 0.01 degrees
+    uint64_t nonFinitePixels = 0; // including ones where the dot product of the normals overflows
+};
+
+// Both images are expected to be unpacked normal maps (-1 to 1), with at least 3 channels
+NormalMapMetrics CompareNormalMapsDetailed( const FloatImage2D& img1, const FloatImage2D& img2, double percentile = 0.99 );
@@ -1,15 +1,43 @@
 #include "image.hpp"
+#include "bc_compression.hpp"
+#include "dds.hpp"
 #include "shared/assert.hpp"
 #include "shared/filesystem.hpp"
 #include "shared/float_conversions.hpp"
 #include "shared/logger.hpp"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb/stb_image_write.h"
-#include "tiffio.h"
+#include "tiff_mem_stream.hpp"
 #include "tinyexr/tinyexr.h"
+#include <climits>
 #include <memory>
+#include <vector>
 
-static bool SaveExr( const std::string& filename, int width, int height, int numChannels, float* pixels, bool saveAsFP16 )
+static bool WriteFileBytes( const std::string& filename, const std::vector<uint8_t>& bytes )
+{
+    FILE* file = fopen( filename.c_str(), "wb" );
+    if ( !file )
+        return false;
+
+    bool success = fwrite( bytes.data(), 1, bytes.size(), file ) == bytes.size();
+    fclose( file );
+
+    return success;
+}
+
+static void AppendBytes( std::vector<uint8_t>& bytes, const void* data, size_t size )
+{
+    const uint8_t* src = static_cast<const uint8_t*>( data );
+    bytes.insert( bytes.end(), src, src + size );
+}
+
+static void StbWriteToVector( void* context, void* data, int size )
+{
+    AppendBytes( *static_cast<std::vector<uint8_t>*>( context ), data, size );
+}
+
+// Same as tinyexr's SaveEXR, but into memory
+static bool EncodeExr( std::vector<uint8_t>& fileData, int width, int height, int numChannels, const float* pixels, bool saveAsFP16 )
 {
     if ( numChannels == 2 )
     {
@@ -17,23 +45,316 @@ static bool SaveExr( const std::string& filename, int width, int height, int num
         return false;
     }
 
-    const char* err;
-    int ret = SaveEXR( pixels, width, height, numChannels, saveAsFP16, filename.c_str(), &err );
+    // EXR channels are planar, and most viewers expect them in (A)BGR order
+    static const char* channelNames[4][4] = { { "A" }, {}, { "B", "G", "R" }, { "A", "B", "G", "R" } };
+    int numPixels = width * height;
+    std::vector<std::vector<float>> planes( numChannels, std::vector<float>( numPixels ) );
+    float* planePtrs[4];
+    for ( int c = 0; c < numChannels; ++c )
+    {
+        int srcChannel = numChannels == 1 ? 0 : numChannels - 1 - c;
+        for ( int i = 0; i < numPixels; ++i )
+            planes[c][i] = pixels[i * numChannels + srcChannel];
+        planePtrs[c] = planes[c].data();
+    }
+
+    EXRImage image;
+    InitEXRImage( &image );
+    image.num_channels = numChannels;
+    image.images       = reinterpret_cast<unsigned char**>( planePtrs );
+    image.width        = width;
+    image.height       = height;
+
+    EXRChannelInfo channels[4] = {};
+    int pixelTypes[4], requestedPixelTypes[4];
+    for ( int c = 0; c < numChannels; ++c )
+    {
+        strcpy( channels[c].name, channelNames[numChannels - 1][c] );
+        pixelTypes[c]          = TINYEXR_PIXELTYPE_FLOAT;
+        requestedPixelTypes[c] = saveAsFP16 ? TINYEXR_PIXELTYPE_HALF : TINYEXR_PIXELTYPE_FLOAT;
+    }
+
+    EXRHeader header;
+    InitEXRHeader( &header );
+    header.compression_type      = ( width < 16 && height < 16 ) ? TINYEXR_COMPRESSIONTYPE_NONE : TINYEXR_COMPRESSIONTYPE_ZIP;
+    header.num_channels          = numChannels;
+    header.channels              = channels;
+    header.pixel_types           = pixelTypes;
+    header.requested_pixel_types = requestedPixelTypes;
+
+    unsigned char* memory = nullptr;
+    const char* err       = nullptr;
+    size_t size           = SaveEXRImageToMemory( &image, &header, &memory, &err );
+    if ( size == 0 )
+    {
+        LOG_ERR( "SaveExr error: '%s'", err ? err : "" );
+        FreeEXRErrorMessage( err );
+        return false;
+    }
+    fileData.assign( memory, memory + size );
+    free( memory );
+
+    return true;
+}
+
+static void SetTiffFields( TIFF* tif, const RawImage2D& img, uint32_t numRows, uint32_t rowsPerStrip, uint16_t compression )
+{
+    uint16_t numChannels = static_cast<uint16_t>( img.NumChannels() );
+    uint16_t bitsPerChannel = static_cast<uint16_t>( img.BitsPerPixel() / numChannels );
+    bool isFloat = IsFormat16BitFloat( img.format ) || IsFormat32BitFloat( img.format );
+
+    TIFFSetField( tif, TIFFTAG_IMAGEWIDTH, static_cast<uint32_t>( img.width ) );
+    TIFFSetField( tif, TIFFTAG_IMAGELENGTH, numRows );
+    TIFFSetField( tif, TIFFTAG_SAMPLESPERPIXEL, numChannels );
+    TIFFSetField( tif, TIFFTAG_BITSPERSAMPLE, bitsPerChannel );
+    TIFFSetField( tif, TIFFTAG_SAMPLEFORMAT, isFloat ? SAMPLEFORMAT_IEEEFP : SAMPLEFORMAT_UINT );
+    TIFFSetField( tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG );
+    TIFFSetField( tif, TIFFTAG_PHOTOMETRIC, numChannels >= 3 ? PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK );
+    TIFFSetField( tif, TIFFTAG_ROWSPERSTRIP, rowsPerStrip );
+    TIFFSetField( tif, TIFFTAG_COMPRESSION, compression );
+    if ( compression != COMPRESSION_NONE )
+        TIFFSetField( tif, TIFFTAG_PREDICTOR, isFloat ? PREDICTOR_FLOATINGPOINT : PREDICTOR_HORIZONTAL );
+    if ( numChannels == 2 || numChannels == 4 )
+    {
+        uint16_t extraSample = numChannels == 4 ? EXTRASAMPLE_UNASSALPHA : EXTRASAMPLE_UNSPECIFIED;
+        TIFFSetField( tif, TIFFTAG_EXTRASAMPLES, 1, &extraSample );
+    }
+}
+
+// Each strip is compressed in parallel into its own in-memory TIFF, and then the already-compressed bytes are
+// written to the final TIFF sequentially with TIFFWriteRawStrip
+static bool EncodeTiff( std::vector<uint8_t>& fileData, const RawImage2D& img, uint16_t compression )
+{
+    constexpr uint32_t TARGET_STRIP_BYTES = 256 * 1024;
+    uint32_t bytesPerRow  = img.width * img.BitsPerPixel() / 8;
+    uint32_t rowsPerStrip = Max( 1u, TARGET_STRIP_BYTES / bytesPerRow );
+    uint32_t numStrips    = ( img.height + rowsPerStrip - 1 ) / rowsPerStrip;
+
+    std::vector<std::vector<uint8_t>> compressedStrips( numStrips );
+    bool stripsSuccessful = true;
+    #pragma omp parallel for schedule( dynamic )
+    for ( int strip = 0; strip < (int)numStrips; ++strip )
+    {
+        uint32_t startRow = strip * rowsPerStrip;
+        uint32_t numRows  = Min( rowsPerStrip, img.height - startRow );
+
+        TiffMemStream stream;
+        TIFF* memTif = TiffMemOpen( stream, "strip", "w" );
+        if ( !memTif )
+        {
+            stripsSuccessful = false;
+            continue;
+        }
+        SetTiffFields( memTif, img, numRows, numRows, compression );
+
+        // the predictor works in-place on the buffer it's given, so it needs a copy
+        std::vector<uint8_t> rows( img.Raw() + startRow * bytesPerRow, img.Raw() + ( startRow + numRows ) * bytesPerRow );
+        if ( TIFFWriteEncodedStrip( memTif, 0, rows.data(), rows.size() ) == -1 )
+        {
+            stripsSuccessful = false;
+        }
+        else
+        {
+            uint64_t offset = TIFFGetStrileOffset( memTif, 0 );
+            uint64_t size   = TIFFGetStrileByteCount( memTif, 0 );
+            compressedStrips[strip].assign( stream.bytes.begin() + offset, stream.bytes.begin() + offset + size );
+        }
+        TIFFClose( memTif );
+    }
+    if ( !stripsSuccessful )
+    {
+        LOG_ERR( "SaveTiff: failed to compress strips" );
+        return false;
+    }
+
+    TiffMemStream stream;
+    TIFF* tif = TiffMemOpen( stream, "image", "w" );
+    if ( !tif )
+        return false;
+
+    SetTiffFields( tif, img, img.height, rowsPerStrip, compression );
+    for ( uint32_t strip = 0; strip < numStrips; ++strip )
+    {
+        std::vector<uint8_t>& stripData = compressedStrips[strip];
+        if ( TIFFWriteRawStrip( tif, strip, stripData.data(), stripData.size() ) == -1 )
+        {
+            LOG_ERR( "SaveTiff: TIFFWriteRawStrip failed for strip %u", strip );
+            TIFFClose( tif );
+            return false;
+        }
+    }
+    TIFFClose( tif );
+    fileData = std::move( stream.bytes );
+
+    return true;
+}
+
+static void EncodeBC4DDS( std::vector<uint8_t>& fileData, const std::vector<FloatImage2D>& mips, const std::vector<std::vector<uint8_t>>& encodedMips )
+{
+    DDSHeader header              = {};
+    header.size                   = sizeof( DDSHeader );
+    header.flags                  = DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE;
+    header.width                  = mips[0].width;
+    header.height                 = mips[0].height;
+    header.pitchOrLinearSize      = static_cast<uint32_t>( encodedMips[0].size() );
+    header.mipMapCount            = static_cast<uint32_t>( mips.size() );
+    header.ddspf.size             = sizeof( DDSPixelFormat );
+    header.ddspf.flags            = DDPF_FOURCC;
+    header.ddspf.fourCC           = DDS_MAKE_FOURCC( 'D', 'X', '1', '0' );
+    header.caps                   = DDSCAPS_TEXTURE;
+    if ( mips.size() > 1 )
+    {
+        header.flags |= DDSD_MIPMAPCOUNT;
+        header.caps |= DDSCAPS_COMPLEX | DDSCAPS_MIPMAP;
+    }
+
+    DDSHeaderDX10 dx10Header     = {};
+    dx10Header.dxgiFormat        = DXGI_FORMAT_BC4_UNORM;
+    dx10Header.resourceDimension = DDS_DIMENSION_TEXTURE2D;
+    dx10Header.arraySize         = 1;
+
+    AppendBytes( fileData, &DDS_MAGIC, sizeof( DDS_MAGIC ) );
+    AppendBytes( fileData, &header, sizeof( header ) );
+    AppendBytes( fileData, &dx10Header, sizeof( dx10Header ) );
+    for ( const std::vector<uint8_t>& mip : encodedMips )
+        AppendBytes( fileData, mip.data(), mip.size() );
+}
+
+// https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+static void EncodeBC4KTX2( std::vector<uint8_t>& fileData, const std::vector<FloatImage2D>& mips, const std::vector<std::vector<uint8_t>>& encodedMips )
+{
+    constexpr uint8_t KTX2_IDENTIFIER[12]       = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+    constexpr uint32_t VK_FORMAT_BC4_UNORM_BLOCK = 139;
+    constexpr uint32_t KHR_DF_MODEL_BC4          = 131;
+    constexpr uint32_t BC4_BLOCK_BYTES           = 8;
+
+    uint32_t levelCount = static_cast<uint32_t>( mips.size() );
+    uint32_t header[9]  = { VK_FORMAT_BC4_UNORM_BLOCK, 1, static_cast<uint32_t>( mips[0].width ), static_cast<uint32_t>( mips[0].height ), 0,
+         0, 1, levelCount, 0 };
+
+    // Data format descriptor: a single basic descriptor block with one BC4 sample
+    uint32_t dfd[] =
+    {
+        44,                                            // dfdTotalSize
+        0,                                             // vendorId = KHRONOS, descriptorType = BASICFORMAT
+        2 | ( 40u << 16 ),                             // versionNumber = 2, descriptorBlockSize = 40
+        KHR_DF_MODEL_BC4 | ( 1u << 8 ) | ( 1u << 16 ), // colorModel, BT709 primaries, linear transfer, straight alpha
+        3 | ( 3u << 8 ),                               // 4x4x1x1 texel block
+        BC4_BLOCK_BYTES,                               // bytesPlane0-3
+        0,                                             // bytesPlane4-7
+        ( 63u << 16 ),                                 // bitOffset = 0, bitLength = 64, channelType = BC4 data
+        0,                                             // samplePosition
+        0,                                             // sampleLower
+        0xFFFFFFFF,                                    // sampleUpper
+    };
+
+    uint32_t levelIndexOffset = sizeof( KTX2_IDENTIFIER ) + sizeof( header ) + 32;
+    uint32_t dfdOffset        = levelIndexOffset + 24 * levelCount;
+    uint32_t index[4]         = { dfdOffset, sizeof( dfd ), 0, 0 }; // no key/value data
+    uint64_t sgdIndex[2]      = { 0, 0 };                           // no supercompression global data
+
+    // mip data is stored smallest level first, with each level aligned to the block size
+    std::vector<uint64_t> levelIndex( 3 * levelCount );
+    uint64_t offset = dfdOffset + sizeof( dfd );
+    for ( int level = (int)levelCount - 1; level >= 0; --level )
+    {
+        offset                    = ( offset + BC4_BLOCK_BYTES - 1 ) / BC4_BLOCK_BYTES * BC4_BLOCK_BYTES;
+        levelIndex[3 * level + 0] = offset;
+        levelIndex[3 * level + 1] = encodedMips[level].size();
+        levelIndex[3 * level + 2] = encodedMips[level].size();
+        offset += encodedMips[level].size();
+    }
 
-    if ( ret != TINYEXR_SUCCESS )
+    AppendBytes( fileData, KTX2_IDENTIFIER, sizeof( KTX2_IDENTIFIER ) );
+    AppendBytes( fileData, header, sizeof( header ) );
+    AppendBytes( fileData, index, sizeof( index ) );
+    AppendBytes( fileData, sgdIndex, sizeof( sgdIndex ) );
+    AppendBytes( fileData, levelIndex.data(), levelIndex.size() * sizeof( uint64_t ) );
+    AppendBytes( fileData, dfd, sizeof( dfd ) );
+    for ( int level = (int)levelCount - 1; level >= 0; --level )
     {
-        LOG_ERR( "SaveExr error: '%s'", err );
+        fileData.resize( levelIndex[3 * level], 0 ); // alignment padding
+        AppendBytes( fileData, encodedMips[level].data(), encodedMips[level].size() );
+    }
+}
+
+bool SaveMipChainToMemory( std::vector<uint8_t>& fileData, const std::string& ext, const std::vector<FloatImage2D>& mips )
+{
+    if ( mips.empty() || ( ext != ".dds" && ext != ".ktx2" ) )
+    {
+        LOG_ERR( "SaveMipChain: only DDS and KTX2 files are supported, not '%s'", ext.c_str() );
         return false;
     }
 
+    std::vector<std::vector<uint8_t>> encodedMips( mips.size() );
+    for ( size_t mipLevel = 0; mipLevel < mips.size(); ++mipLevel )
+    {
+        const FloatImage2D& mip = mips[mipLevel];
+        FloatImage2D firstChannel = mip;
+        if ( mip.numChannels != 1 )
+        {
+            firstChannel = FloatImage2D( mip.width, mip.height, 1, ImageAllocFlags::UNINITIALIZED );
+            for ( int i = 0; i < mip.width * mip.height; ++i )
+                firstChannel.data[i] = mip.data[i * mip.numChannels];
+        }
+
+        encodedMips[mipLevel].resize( BCTotalBytes( BCFormat::BC4, mip.width, mip.height ) );
+        EncodeBC4Image( firstChannel.data.get(), mip.width, mip.height, encodedMips[mipLevel].data() );
+    }
+
+    fileData.clear();
+    if ( ext == ".dds" )
+        EncodeBC4DDS( fileData, mips, encodedMips );
+    else
+        EncodeBC4KTX2( fileData, mips, encodedMips );
+
     return true;
 }
 
+bool ZlibCompress( const uint8_t* data, size_t size, std::vector<uint8_t>& compressed, int quality )
+{
+    if ( size > INT_MAX )
+        return false;
+
+    int compressedSize = 0;
+    unsigned char* zlib = stbi_zlib_compress( const_cast<unsigned char*>( data ), (int)size, &compressedSize, quality );
+    if ( !zlib )
+        return false;
+
+    compressed.assign( zlib, zlib + compressedSize );
+    STBIW_FREE( zlib );
+    return true;
+}
+
+bool SaveMipChain( const std::string& filename, const std::vector<FloatImage2D>& mips )
+{
+    std::vector<uint8_t> fileData;
+    bool saveSuccessful = SaveMipChainToMemory( fileData, GetFileExtension( filename ), mips ) && WriteFileBytes( filename, fileData );
+    if ( !saveSuccessful )
+    {
+        LOG_ERR( "Failed to save image '%s'", filename.c_str() );
+    }
+
+    return saveSuccessful;
+}
+
 bool RawImage2D::Save( const std::string& filename, ImageSaveFlags saveFlags ) const
+{
+    std::vector<uint8_t> fileData;
+    bool saveSuccessful = SaveToMemory( fileData, GetFileExtension( filename ), saveFlags ) && WriteFileBytes( filename, fileData );
+    if ( !saveSuccessful )
+    {
+        LOG_ERR( "Failed to save image '%s'", filename.c_str() );
+    }
+
+    return saveSuccessful;
+}
+
+bool RawImage2D::SaveToMemory( std::vector<uint8_t>& fileData, const std::string& ext, ImageSaveFlags saveFlags ) const
 {
     uint32_t numChannels = NumChannels();
-    std::string ext      = GetFileExtension( filename );
     bool saveSuccessful  = false;
+    fileData.clear();
     if ( ext == ".jpg" || ext == ".png" || ext == ".tga" || ext == ".bmp" )
     {
         RawImage2D imgToSave = *this;
@@ -45,10 +366,10 @@ bool RawImage2D::Save( const std::string& filename, ImageSaveFlags saveFlags ) c
         int ret = 1;
         switch ( ext[1] )
         {
-        case 'p': ret = stbi_write_png( filename.c_str(), width, height, numChannels, imgToSave.Raw(), width * numChannels ); break;
-        case 'j': ret = stbi_write_jpg( filename.c_str(), width, height, numChannels, imgToSave.Raw(), 95 ); break;
-        case 'b': ret = stbi_write_bmp( filename.c_str(), width, height, numChannels, imgToSave.Raw() ); break;
-        case 't': ret = stbi_write_tga( filename.c_str(), width, height, numChannels, imgToSave.Raw() ); break;
+        case 'p': ret = stbi_write_png_to_func( StbWriteToVector, &fileData, width, height, numChannels, imgToSave.Raw(), width * numChannels ); break;
+        case 'j': ret = stbi_write_jpg_to_func( StbWriteToVector, &fileData, width, height, numChannels, imgToSave.Raw(), 95 ); break;
+        case 'b': ret = stbi_write_bmp_to_func( StbWriteToVector, &fileData, width, height, numChannels, imgToSave.Raw() ); break;
+        case 't': ret = stbi_write_tga_to_func( StbWriteToVector, &fileData, width, height, numChannels, imgToSave.Raw() ); break;
         default: ret = 0;
         }
         saveSuccessful = ret != 0;
@@ -60,7 +381,7 @@ bool RawImage2D::Save( const std::string& filename, ImageSaveFlags saveFlags ) c
         {
             imgToSave = Convert( static_cast<ImageFormat>( Underlying( ImageFormat::R32_FLOAT ) + numChannels - 1 ) );
         }
-        saveSuccessful = 0 != stbi_write_hdr( filename.c_str(), width, height, numChannels, imgToSave.Raw<float>() );
+        saveSuccessful = 0 != stbi_write_hdr_to_func( StbWriteToVector, &fileData, width, height, numChannels, imgToSave.Raw<float>() );
     }
     else if ( ext == ".exr" )
     {
@@ -70,16 +391,34 @@ bool RawImage2D::Save( const std::string& filename, ImageSaveFlags saveFlags ) c
             imgToSave = Convert( static_cast<ImageFormat>( Underlying( ImageFormat::R32_FLOAT ) + numChannels - 1 ) );
         }
         bool saveAsFP16 = !IsSet( saveFlags, ImageSaveFlags::KEEP_FLOATS_AS_32_BIT );
-        saveSuccessful  = SaveExr( filename, width, height, numChannels, imgToSave.Raw<float>(), saveAsFP16 );
+        saveSuccessful  = EncodeExr( fileData, width, height, numChannels, imgToSave.Raw<float>(), saveAsFP16 );
     }
-    else
+    else if ( ext == ".tif" || ext == ".tiff" )
     {
-        LOG_ERR( "RawImage2D::Save: Unrecognized image extension when saving file '%s'", filename.c_str() );
+        // 8 and 16 bit unorm, fp16 and fp32 are all saved as-is. fp32 follows the same fp16 default as EXRs
+        RawImage2D imgToSave = *this;
+        if ( IsFormat32BitFloat( format ) && !IsSet( saveFlags, ImageSaveFlags::KEEP_FLOATS_AS_32_BIT ) )
+        {
+            imgToSave = Convert( static_cast<ImageFormat>( Underlying( ImageFormat::R16_FLOAT ) + numChannels - 1 ) );
+        }
+        uint16_t compression = IsSet( saveFlags, ImageSaveFlags::TIFF_USE_LZW ) ? COMPRESSION_LZW : COMPRESSION_ADOBE_DEFLATE;
+        saveSuccessful       = EncodeTiff( fileData, imgToSave, compression );
     }
+    else if ( ext == ".dds" || ext == ".ktx2" )
+    {
+        // saved as BC4, from the first channel
+        FloatImage2D floatImg = FloatImageFromRawImage2D( *this );
+        std::vector<FloatImage2D> mips;
+        if ( IsSet( saveFlags, ImageSaveFlags::GENERATE_MIPMAPS ) )
+            mips = GenerateMipmaps( floatImg, MipmapGenerationSettings{} );
+        else
+            mips = { floatImg };
 
-    if ( !saveSuccessful )
+        saveSuccessful = SaveMipChainToMemory( fileData, ext, mips );
+    }
+    else
     {
-        LOG_ERR( "Failed to save image '%s'", filename.c_str() );
+        LOG_ERR( "RawImage2D::Save: Unrecognized image extension '%s'", ext.c_str() );
     }
 
     return saveSuccessful;
@@ -0,0 +1,52 @@
+#pragma once
+
+#include "shared/math_vec.hpp"
+#include <cstddef>
+#include <type_traits>
+
+// Non-owning, typed view of interleaved pixels with a compile-time channel count. Unlike FloatImage2D::Get/Set, accessing a pixel is
+// just a fixed-size strided load/store, which the compiler can unroll and vectorize. Use 'const T' for read-only views
+template <typename T, int Channels>
+struct ImageView
+{
+    static_assert( Channels >= 1 && Channels <= 4 );
+    using Scalar = std::remove_const_t<T>;
+    using Pixel  = glm::vec<Channels, Scalar>;
+
+    T* data      = nullptr;
+    int width    = 0;
+    int height   = 0;
+    size_t rowStride = 0; // in elements of T, not bytes
+
+    ImageView() = default;
+    // inRowStride == 0 means the rows are tightly packed
+    ImageView( T* inData, int inWidth, int inHeight, size_t inRowStride = 0 )
+        : data( inData ), width( inWidth ), height( inHeight ), rowStride( inRowStride ? inRowStride : (size_t)inWidth * Channels )
+    {
+    }
+
+    // a non-const view converts to a const one
+    operator ImageView<const Scalar, Channels>() const { return ImageView<const Scalar, Channels>( data, width, height, rowStride ); }
+
+    T* Row( int row ) const { return data + row * rowStride; }
+    T* PixelPtr( int row, int col ) const { return Row( row ) + col * Channels; }
+    T& operator()( int row, int col, int chan = 0 ) const { return PixelPtr( row, col )[chan]; }
+
+    Pixel Get( int row, int col ) const
+    {
+        const T* p = PixelPtr( row, col );
+        Pixel pixel;
+        for ( int chan = 0; chan < Channels; ++chan )
+            pixel[chan] = p[chan];
+
+        return pixel;
+    }
+
+    void Set( int row, int col, const Pixel& pixel ) const
+    {
+        static_assert( !std::is_const_v<T>, "can't write through a const view" );
+        T* p = PixelPtr( row, col );
+        for ( int chan = 0; chan < Channels; ++chan )
+            p[chan] = pixel[chan];
+    }
+};
@@ -0,0 +1,429 @@
+#include "incremental_solve.hpp"
+
+static constexpr int INCREMENTAL_MIN_MARGIN      = 16;  // pixels around the dirty rect that also get re-solved
+static constexpr int MIN_LOCAL_LEVEL_SIZE        = 8;   // texels, of the coarsest level of the local re-solve
+static constexpr int MAX_GLOBAL_CORRECTION_SIZE  = 128; // texels, of the finest level of the correction of the whole image
+
+// Same as Wrap, but for any offset
+static inline int WrapCoord( int v, int size )
+{
+    v %= size;
+    return v < 0 ? v + size : v;
+}
+
+static bool RectContains( const PixelRect& rect, int row, int col, int width, int height )
+{
+    return !rect.Empty() && WrapCoord( col - rect.x, width ) < rect.width && WrapCoord( row - rect.y, height ) < rect.height;
+}
+
+// The shortest (wrapping) range that covers every set flag, as the first index and the length. The complement of the longest run of
+// unset flags, so an edit that straddles the edge of a tiling texture doesn't turn into the whole image
+static std::pair<int, int> GetWrappingRange( const std::vector<uint8_t>& flags )
+{
+    int size = (int)flags.size();
+    int longestGap = 0, longestGapEnd = 0;
+    int gap = 0;
+    for ( int i = 0; i < 2 * size; ++i )
+    {
+        gap = flags[i % size] ? 0 : gap + 1;
+        if ( gap > longestGap )
+        {
+            longestGap    = Min( gap, size );
+            longestGapEnd = i % size;
+        }
+    }
+
+    return { ( longestGapEnd + 1 ) % size, size - longestGap };
+}
+
+PixelRect FindChangedRegion( const FloatImage2D& previousNormalMap, const FloatImage2D& normalMap, float threshold )
+{
+    int width  = normalMap.width;
+    int height = normalMap.height;
+    if ( previousNormalMap.width != width || previousNormalMap.height != height )
+        return { 0, 0, width, height };
+
+    ImageView<const float, 3> previous = previousNormalMap.View<3>();
+    ImageView<const float, 3> current  = normalMap.View<3>();
+    std::vector<uint8_t> changedRows( height, 0 );
+    std::vector<uint8_t> changedCols( width, 0 );
+    #pragma omp parallel if ( width * height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+    {
+        std::vector<uint8_t> threadChangedCols( width, 0 );
+        #pragma omp for
+        for ( int row = 0; row < height; ++row )
+        {
+            const float* a = previous.Row( row );
+            const float* b = current.Row( row );
+            for ( int i = 0; i < 3 * width; ++i )
+            {
+                if ( fabsf( a[i] - b[i] ) > threshold )
+                {
+                    changedRows[row]          = 1;
+                    threadChangedCols[i / 3] = 1;
+                }
+            }
+        }
+
+        #pragma omp critical
+        for ( int col = 0; col < width; ++col )
+            changedCols[col] |= threadChangedCols[col];
+    }
+
+    auto [y, rectHeight] = GetWrappingRange( changedRows );
+    auto [x, rectWidth]  = GetWrappingRange( changedCols );
+    if ( rectWidth == 0 )
+        return {};
+
+    return { x, y, rectWidth, rectHeight };
+}
+
+float EstimateHeightMapScale( const FloatImage2D& packedHeights, const FloatImage2D& normalMap, PixelRect exclude )
+{
+    int width  = normalMap.width;
+    int height = normalMap.height;
+    FloatImage2D dxdyImg = DxDyImageFromNormalMap( normalMap );
+    ImageView<const float, 2> dxdy = dxdyImg.View<2>();
+    const float* p = packedHeights.data.get();
+
+    // neighboring heights differ by the average of their slopes (see RelaxRow)
+    double sumPG = 0, sumPP = 0;
+    #pragma omp parallel for reduction( + : sumPG, sumPP ) if ( width * height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+    for ( int row = 0; row < height; ++row )
+    {
+        int down = Wrap( row + 1, height );
+        for ( int col = 0; col < width; ++col )
+        {
+            if ( RectContains( exclude, row, col, width, height ) )
+                continue;
+
+            int right = Wrap( col + 1, width );
+            float h   = p[row * width + col];
+            if ( !RectContains( exclude, row, right, width, height ) )
+            {
+                double dp = p[row * width + right] - h;
+                sumPG    += dp * 0.5 * ( dxdy( row, col, 0 ) + dxdy( row, right, 0 ) );
+                sumPP    += dp * dp;
+            }
+            if ( !RectContains( exclude, down, col, width, height ) )
+            {
+                double dp = p[down * width + col] - h;
+                sumPG    += dp * 0.5 * ( dxdy( row, col, 1 ) + dxdy( down, col, 1 ) );
+                sumPP    += dp * dp;
+            }
+        }
+    }
+
+    return sumPP > 0 ? (float)( sumPG / sumPP ) : 1.0f;
+}
+
+// The residual of the relaxation's equation, (the sum of the 4 neighbors + the divergence of the slopes) - 4h, for every texel of
+// the window except for its outermost ring, which is left at 0
+static void CalcWindowResidual( ImageView<const float, 2> dxdy, const float* h, float* residual )
+{
+    int width  = dxdy.width;
+    int height = dxdy.height;
+    memset( residual, 0, width * sizeof( float ) );
+    memset( residual + (size_t)( height - 1 ) * width, 0, width * sizeof( float ) );
+    #pragma omp parallel for if ( width * height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+    for ( int row = 1; row < height - 1; ++row )
+    {
+        const float* hUp      = h + (size_t)( row - 1 ) * width;
+        const float* hMid     = h + (size_t)row * width;
+        const float* hDown    = h + (size_t)( row + 1 ) * width;
+        const float* dxdyUp   = dxdy.Row( row - 1 );
+        const float* dxdyMid  = dxdy.Row( row );
+        const float* dxdyDown = dxdy.Row( row + 1 );
+        float* r = residual + (size_t)row * width;
+        r[0]         = 0;
+        r[width - 1] = 0;
+        for ( int col = 1; col < width - 1; ++col )
+        {
+            float sum = 0;
+            sum += hMid[col - 1] + 0.5f * dxdyMid[2 * ( col - 1 )];
+            sum += hMid[col + 1] - 0.5f * dxdyMid[2 * ( col + 1 )];
+            sum += hUp[col]      + 0.5f * dxdyUp[2 * col + 1];
+            sum += hDown[col]    - 0.5f * dxdyDown[2 * col + 1];
+            r[col] = sum - 4 * hMid[col];
+        }
+    }
+}
+
+// Sums every texel of src into the dst texel that covers it. Residuals add up like this, since the coarser equation's
+// 4e - (the sum of the 4 neighbors) is 4x the finer one's, for the same smooth correction
+static void RestrictResidual( const FloatImage2D& src, FloatImage2D& dst )
+{
+    memset( dst.data.get(), 0, (size_t)dst.width * dst.height * sizeof( float ) );
+    for ( int row = 0; row < src.height; ++row )
+    {
+        float* dstRow = dst.data.get() + (size_t)row * dst.height / src.height * dst.width;
+        for ( int col = 0; col < src.width; ++col )
+            dstRow[(size_t)col * dst.width / src.width] += src.data[(size_t)row * src.width + col];
+    }
+}
+
+// One jacobi update of the correction in 'row', for 4e - (the sum of its 4 neighbors) = residual. With a Dirichlet border,
+// the outermost texels are held at 0, instead of wrapping around
+template <bool MeasureResidual>
+static float RelaxCorrectionRow( const float* residual, int row, int width, int height, bool dirichlet, const float* eUp, const float* eMid,
+    const float* eDown, float* next )
+{
+    if ( dirichlet && ( row == 0 || row == height - 1 ) )
+    {
+        memset( next, 0, width * sizeof( float ) );
+        return 0;
+    }
+
+    int firstCol = dirichlet ? 1 : 0;
+    int lastCol  = dirichlet ? width - 2 : width - 1;
+    if ( dirichlet )
+    {
+        next[0]         = 0;
+        next[width - 1] = 0;
+    }
+
+    float squaredUpdates = 0;
+    for ( int col = firstCol; col <= lastCol; ++col )
+    {
+        int left  = Wrap( col - 1, width );
+        int right = Wrap( col + 1, width );
+        next[col] = ( eMid[left] + eMid[right] + eUp[col] + eDown[col] + residual[col] ) / 4;
+        if constexpr ( MeasureResidual )
+            squaredUpdates += ( next[col] - eMid[col] ) * ( next[col] - eMid[col] );
+    }
+
+    return squaredUpdates;
+}
+
+// Same as BuildDisplacement, but solves for the correction to a height map from its residualPyramid (RestrictResidual'd levels),
+// instead of for the heights from the slopes. The last level is taken to be 0
+static void BuildCorrection( const std::vector<FloatImage2D>& residualPyramid, float* scratchE, float* outputE, SweepScheduler& scheduler,
+    bool dirichlet, uint32_t level = 0 )
+{
+    const FloatImage2D& residual = residualPyramid[level];
+    int width  = residual.width;
+    int height = residual.height;
+    if ( level + 1 == residualPyramid.size() )
+    {
+        memset( outputE, 0, (size_t)width * height * sizeof( float ) );
+        return;
+    }
+
+    BuildCorrection( residualPyramid, scratchE, outputE, scheduler, dirichlet, level + 1 );
+    RelaxLevel( scheduler, level, width, height, scratchE, outputE,
+        [&]( auto measureResidual, int row, const float* eUp, const float* eMid, const float* eDown, float* nextRow )
+        {
+            return RelaxCorrectionRow<measureResidual>(
+                residual.data.get() + (size_t)row * width, row, width, height, dirichlet, eUp, eMid, eDown, nextRow );
+        } );
+}
+
+static void SolveCorrection( const std::vector<FloatImage2D>& residualPyramid, uint32_t iterations, float iterationMultiplier,
+    bool dirichlet, FloatImage2D& correction )
+{
+    correction = FloatImage2D( residualPyramid[0].width, residualPyramid[0].height, 1, ImageAllocFlags::UNINITIALIZED );
+    FloatImage2D scratch( correction.width, correction.height, 1, ImageAllocFlags::UNINITIALIZED );
+    SweepScheduler scheduler( GetSolverLevelSizes( residualPyramid ), iterations, iterationMultiplier, {}, PG::Time::GetTimePoint() );
+    BuildCorrection( residualPyramid, scratch.data.get(), correction.data.get(), scheduler, dirichlet );
+}
+
+static void GatherWindow( const float* h, int width, int height, const PixelRect& window, float* dst )
+{
+    #pragma omp parallel for if ( window.width * window.height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+    for ( int row = 0; row < window.height; ++row )
+    {
+        const float* src = h + (size_t)WrapCoord( window.y + row, height ) * width;
+        for ( int col = 0; col < window.width; ++col )
+            dst[(size_t)row * window.width + col] = src[WrapCoord( window.x + col, width )];
+    }
+}
+
+// Re-solves everything inside the outermost ring of the window, with the ring held fixed. dxdy: the slopes of the window
+static void ResolveWindow( float* h, int width, int height, const PixelRect& window, ImageView<const float, 2> dxdy, uint32_t numLevels,
+    uint32_t iterations, float iterationMultiplier )
+{
+    FloatImage2D windowH( window.width, window.height, 1, ImageAllocFlags::UNINITIALIZED );
+    std::vector<FloatImage2D> residuals = { FloatImage2D( window.width, window.height, 1, ImageAllocFlags::UNINITIALIZED ) };
+    GatherWindow( h, width, height, window, windowH.data.get() );
+    CalcWindowResidual( dxdy, windowH.data.get(), residuals[0].data.get() );
+    for ( uint32_t level = 1; level <= numLevels; ++level )
+    {
+        residuals.emplace_back( window.width >> level, window.height >> level, 1, ImageAllocFlags::UNINITIALIZED );
+        RestrictResidual( residuals[level - 1], residuals[level] );
+    }
+
+    FloatImage2D correction;
+    SolveCorrection( residuals, iterations, iterationMultiplier, true, correction );
+
+    #pragma omp parallel for if ( window.width * window.height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+    for ( int row = 1; row < window.height - 1; ++row )
+    {
+        float* hRow = h + (size_t)WrapCoord( window.y + row, height ) * width;
+        for ( int col = 1; col < window.width - 1; ++col )
+        {
+            size_t i = (size_t)row * window.width + col;
+            hRow[WrapCoord( window.x + col, width )] = windowH.data[i] + correction.data[i];
+        }
+    }
+}
+
+// Sums the residual of everything inside the outermost ring of the window into a coarse (1 << coarseLevel times smaller) version of
+// the whole image, and solves for the correction there, with wrapping like the full solve. Then upsamples it and adds it to every pixel
+static void ApplyGlobalCorrection( float* h, int width, int height, const PixelRect& window, ImageView<const float, 2> dxdy,
+    uint32_t coarseLevel, uint32_t iterations, float iterationMultiplier )
+{
+    FloatImage2D windowH( window.width, window.height, 1, ImageAllocFlags::UNINITIALIZED );
+    FloatImage2D windowResidual( window.width, window.height, 1, ImageAllocFlags::UNINITIALIZED );
+    GatherWindow( h, width, height, window, windowH.data.get() );
+    CalcWindowResidual( dxdy, windowH.data.get(), windowResidual.data.get() );
+
+    std::vector<FloatImage2D> residuals;
+    for ( uint32_t level = coarseLevel; residuals.empty() || ( residuals.back().width > 1 && residuals.back().height > 1 ); ++level )
+        residuals.emplace_back( Max( width >> level, 1 ), Max( height >> level, 1 ), 1, ImageAllocFlags::UNINITIALIZED );
+
+    FloatImage2D& coarseResidual = residuals[0];
+    memset( coarseResidual.data.get(), 0, (size_t)coarseResidual.width * coarseResidual.height * sizeof( float ) );
+    double residualSum = 0;
+    for ( int row = 1; row < window.height - 1; ++row )
+    {
+        int coarseRow = (int)( (int64_t)WrapCoord( window.y + row, height ) * coarseResidual.height / height );
+        for ( int col = 1; col < window.width - 1; ++col )
+        {
+            int coarseCol = (int)( (int64_t)WrapCoord( window.x + col, width ) * coarseResidual.width / width );
+            float r       = windowResidual.data[(size_t)row * window.width + col];
+            coarseResidual.data[(size_t)coarseRow * coarseResidual.width + coarseCol] += r;
+            residualSum += r;
+        }
+    }
+
+    // a wrapping solve only has a solution if the residuals sum to 0, which they only do over the whole image
+    float meanResidual = (float)( residualSum / ( (double)coarseResidual.width * coarseResidual.height ) );
+    for ( int i = 0; i < coarseResidual.width * coarseResidual.height; ++i )
+        coarseResidual.data[i] -= meanResidual;
+    for ( size_t level = 1; level < residuals.size(); ++level )
+        RestrictResidual( residuals[level - 1], residuals[level] );
+
+    FloatImage2D correction;
+    SolveCorrection( residuals, iterations, iterationMultiplier * ( 1 << coarseLevel ), false, correction );
+
+    std::vector<ProlongationTap> colTaps = CalcProlongationTaps( correction.width, width );
+    std::vector<ProlongationTap> rowTaps = CalcProlongationTaps( correction.height, height );
+    #pragma omp parallel if ( width * height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+    {
+        std::vector<float> upsampled( width );
+        #pragma omp for schedule( static )
+        for ( int row = 0; row < height; ++row )
+        {
+            ProlongRow( correction.data.get(), correction.width, rowTaps[row], colTaps, upsampled.data() );
+            float* hRow = h + (size_t)row * width;
+            for ( int col = 0; col < width; ++col )
+                hRow[col] += upsampled[col];
+        }
+    }
+}
+
+// The window that gets re-solved for the rect: the rect plus the margin, and a ring around that with the fixed boundary heights. Its
+// size is a multiple of the coarsest local level's texels, so that every level is exactly half of the one before it
+static PixelRect GetResolveWindow( const PixelRect& rect, int margin, uint32_t& numLevels )
+{
+    PixelRect window;
+    window.width  = rect.width + 2 * margin + 2;
+    window.height = rect.height + 2 * margin + 2;
+    numLevels     = 1;
+    while ( ( Min( window.width, window.height ) >> numLevels ) >= MIN_LOCAL_LEVEL_SIZE )
+        ++numLevels;
+    int alignment = 1 << ( numLevels - 1 );
+    window.width  = ( window.width + alignment - 1 ) / alignment * alignment;
+    window.height = ( window.height + alignment - 1 ) / alignment * alignment;
+    window.x      = rect.x - ( window.width - rect.width ) / 2;
+    window.y      = rect.y - ( window.height - rect.height ) / 2;
+
+    return window;
+}
+
+GenerationResults GetHeightMapFromNormalMap_Incremental( const FloatImage2D& normalMap, const GeneratedHeightMap& previousHeights,
+    PixelRect dirtyRect, uint32_t iterations, float iterationMultiplier, float* outputH )
+{
+    int width  = normalMap.width;
+    int height = normalMap.height;
+    if ( previousHeights.map.width != width || previousHeights.map.height != height )
+    {
+        LOG_WARN( "The previous height map is %dx%d, but the normal map is %dx%d. Solving the whole image instead", previousHeights.map.width,
+            previousHeights.map.height, width, height );
+        return GetHeightMapFromNormalMap( normalMap, iterations, iterationMultiplier, HeightMipMode::NONE, outputH );
+    }
+
+    int margin = Max( INCREMENTAL_MIN_MARGIN, Max( dirtyRect.width, dirtyRect.height ) / 2 );
+    uint32_t numLocalLevels;
+    PixelRect window = GetResolveWindow( dirtyRect, margin, numLocalLevels );
+    if ( !dirtyRect.Empty() && ( window.width + 2 > width || window.height + 2 > height ) )
+        return GetHeightMapFromNormalMap( normalMap, iterations, iterationMultiplier, HeightMipMode::NONE, outputH );
+
+    // The global correction is solved at about a quarter of the resolution of the window's coarsest level (or coarser, for small
+    // windows in big images, to keep it cheap). The second re-solve of the window reaches a couple of its texels further out, past
+    // where the correction's upsampling blurs the edge of the first window
+    uint32_t globalLevel = numLocalLevels > 3 ? numLocalLevels - 2 : 1;
+    while ( Max( width >> globalLevel, height >> globalLevel ) > MAX_GLOBAL_CORRECTION_SIZE )
+        ++globalLevel;
+    uint32_t numFinalLevels;
+    PixelRect finalWindow = GetResolveWindow( dirtyRect, margin + ( 2 << globalLevel ), numFinalLevels );
+    if ( finalWindow.width > width || finalWindow.height > height )
+    {
+        finalWindow    = window;
+        numFinalLevels = numLocalLevels;
+    }
+
+    auto startTime = PG::Time::GetTimePoint();
+
+    GenerationResults returnData;
+    returnData.heightMap = GeneratedHeightMap( width, height, outputH );
+    float* h = returnData.heightMap.map.data.get();
+    if ( h != previousHeights.map.data.get() || previousHeights.scale != 1 || previousHeights.bias != 0 )
+    {
+        #pragma omp parallel for if ( width * height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+        for ( int row = 0; row < height; ++row )
+        {
+            for ( int col = 0; col < width; ++col )
+                h[row * width + col] = previousHeights.GetH( row, col );
+        }
+    }
+
+    if ( !dirtyRect.Empty() )
+    {
+        // the slopes of the windows, including the pixels right around the first one, which the global correction also measures the
+        // residual of
+        PixelRect outerWindow = { window.x - 1, window.y - 1, window.width + 2, window.height + 2 };
+        PixelRect slopesRect  = finalWindow.width > window.width ? finalWindow : outerWindow;
+        FloatImage2D slopes( slopesRect.width, slopesRect.height, 2, ImageAllocFlags::UNINITIALIZED );
+        ImageView<const float, 3> normals = normalMap.View<3>();
+        ImageView<float, 2> dxdy = slopes.View<2>();
+        vec2 invSize = { 1.0f / width, 1.0f / height };
+        #pragma omp parallel for if ( slopesRect.width * slopesRect.height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+        for ( int row = 0; row < slopesRect.height; ++row )
+        {
+            int srcRow = WrapCoord( slopesRect.y + row, height );
+            for ( int col = 0; col < slopesRect.width; ++col )
+                dxdy.Set( row, col, DxDyFromNormal( normals.Get( srcRow, WrapCoord( slopesRect.x + col, width ) ) ) * invSize );
+        }
+        auto SubView = [&]( const PixelRect& rect )
+        {
+            return ImageView<const float, 2>( dxdy.PixelPtr( rect.y - slopesRect.y, rect.x - slopesRect.x ), rect.width, rect.height, dxdy.rowStride );
+        };
+
+        // First re-solve the window with the old heights around it. That's all it takes for edits that could have come from a change
+        // of the heights inside it (like adding a bump). Otherwise, the heights at the edge of the window don't agree with the slopes
+        // around them anymore, and that mismatch is the source of the change outside of the window. That's solved for on a coarse
+        // version of the whole image, and then the window is re-solved again, on top of that
+        ResolveWindow( h, width, height, window, SubView( window ), numLocalLevels, iterations, iterationMultiplier );
+        ApplyGlobalCorrection( h, width, height, outerWindow, SubView( outerWindow ), globalLevel, iterations, iterationMultiplier );
+        ResolveWindow( h, width, height, finalWindow, SubView( finalWindow ), numFinalLevels, iterations, iterationMultiplier );
+    }
+
+    auto stopTime = PG::Time::GetTimePoint();
+
+    returnData.heightMap.CalcMinMax();
+    returnData.iterations     = iterations;
+    returnData.timeToGenerate = (float)PG::Time::GetElapsedTime( startTime, stopTime ) / 1000.0f;
+
+    return returnData;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "normal_to_height.hpp"
+
+// A rectangle of pixels. It can extend past the edges of the image, in which case it wraps around them, like the solvers do
+struct PixelRect
+{
+    int x      = 0;
+    int y      = 0;
+    int width  = 0;
+    int height = 0;
+
+    bool Empty() const { return width <= 0 || height <= 0; }
+};
+
+// The bounding box of every pixel with a normal that differs by more than 'threshold' (in any component). Empty if none do, and
+// the whole image if the dimensions don't match
+PixelRect FindChangedRegion( const FloatImage2D& previousNormalMap, const FloatImage2D& normalMap, float threshold = 0 );
+
+// Least squares fit of the scale that makes the differences between neighboring texels of packedHeights match the slopes of
+// normalMap, ignoring the pixels in 'exclude'. For height maps that went through GeneratedHeightMap::Pack0To1 (like every saved one),
+// when the original scale is gone
+float EstimateHeightMapScale( const FloatImage2D& packedHeights, const FloatImage2D& normalMap, PixelRect exclude = {} );
+
+// Updates previousHeights, the RELAXATION solution of an older version of normalMap that only differed inside dirtyRect, instead
+// of solving the whole image again. Only dirtyRect, expanded by a margin, is re-solved, with the heights around it held fixed
+// (Dirichlet boundaries). Before that, the change is also solved for on a coarse version of the whole image, which catches the
+// low frequency part of it, that reaches far past the margin. So the cost mostly depends on the size of dirtyRect, apart from
+// that correction being upsampled and added to every pixel (and the copy, unless outputH is previousHeights.map's unpacked data).
+// Falls back to GetHeightMapFromNormalMap if the expanded region doesn't fit in the image. An empty dirtyRect just copies
+// previousHeights. iterations and iterationMultiplier: same as for GetHeightMapFromNormalMap, per level of the re-solve
+GenerationResults GetHeightMapFromNormalMap_Incremental( const FloatImage2D& normalMap, const GeneratedHeightMap& previousHeights,
+    PixelRect dirtyRect, uint32_t iterations, float iterationMultiplier = 1.0f, float* outputH = nullptr );
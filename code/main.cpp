@@ -1,46 +1,170 @@
 #include "normal_to_height.hpp"
 #include "normal_to_height_experimental.hpp"
 #include "height_to_normal.hpp"
+#include "batch_scheduler.hpp"
+#include "batched_solve.hpp"
+#include "height_cache.hpp"
+#include "incremental_solve.hpp"
+#include "solver_checkpoint.hpp"
+#include "image_metrics.hpp"
+#include "server.hpp"
 #include "getopt/getopt.h"
 #include "shared/filesystem.hpp"
 #include "shared/logger.hpp"
 #include "shared/time.hpp"
 #include <iostream>
+#include <map>
+#include <omp.h>
 #include <unordered_set>
+#if USING( WINDOWS_PROGRAM )
+#include <fcntl.h>
+#include <io.h>
+#endif
 
 
 struct Options
 {
     std::string normalMapPath;
+    std::vector<std::string> normalMapPaths; // every input given on the command line. Process() only looks at normalMapPath
+    int numThreads = 0; // 0 == all of them
     bool flipY = false;
     bool flipX = false;
     float slopeScale = 1.0f;
     HeightGenMethod heightGenMethod = HeightGenMethod::DEFAULT;
     uint32_t numIterations = 1024;
     float iterationMultiplier = 0.25f;
+    bool adaptiveSchedule = false;
+    float adaptiveBudget = 0; // in mip 0 sweeps. 0 == the same work as the fixed -i / --iterMultiplier schedule
+    float timeBudgetMs = 0; // 0 == no limit
     bool outputGenNormals = false;
+    uint32_t compareNormalMethods = 0; // bit N == NormalCalcMethod N. 0 == only use CROSS for outputGenNormals
     bool rangeOfIterations = false;
+    std::string heightMapExt; // empty == same extension as the normal map
+    uint32_t heightMapBits = 0; // 0 == default for the file type. Otherwise 16 or 32
+    HeightMipMode heightMipMode = HeightMipMode::NONE;
+    std::string outputDir; // empty == '[PATH_TO_NORMAL_MAP]_autogen/'
+    std::string serverSocketPath; // non-empty == run as a server instead of processing normalMapPaths
+    std::string inputFormat; // only used when reading the normal map from stdin. empty == detect it from the file's contents
+    bool writeToStdout = false; // write the height map to stdout instead of a file
+    HeightCacheSettings cache;
+    std::string checkpointDir; // empty == no checkpointing
+    float checkpointInterval = 60; // seconds
+    bool compressCheckpoints = false;
+    std::string previousHeightPath; // non-empty == incrementally update this height map, instead of solving from scratch
+    std::string previousNormalMapPath; // what previousHeightPath was generated from. Diffed to find dirtyRect, if given
+    PixelRect dirtyRect;
+    bool sequence = false; // normalMapPaths are the frames of an animation, solved in order, each warm started from the previous one
+    float residualTolerance = 0; // see RelaxationControls::residualTolerance. 0 == always run the whole schedule
 
     // the options below are only available when using heightGenMethod == LINEAR_SYSTEM
     bool linearSolveWithGuess = true;
 };
 
+struct ProcessOutput
+{
+    std::string heightMapPath;
+    uint32_t iterations;
+    float timeToGenerate; // seconds
+    float scale;
+    float bias;
+    double normalsPSNR; // only valid if Options::outputGenNormals or compareNormalMethods. The first compared method's PSNR
+    bool cached; // true == the solve was skipped, and the height map came from the cache
+    bool saved;  // false == the height map couldn't be written
+};
+
+// The default RelaxationControls::residualTolerance for --sequence. About as accurate as the default fixed schedule, for frames that
+// only differ slightly
+constexpr float DEFAULT_SEQUENCE_TOLERANCE = 5e-5f;
+
+// Images up to this size, that are the same size as each other, are solved MAX_BATCH_IMAGES at a time with
+// GetHeightMapsFromNormalMaps_Batched, because their own solves are too small to keep every thread busy
+constexpr uint64_t MAX_BATCHED_IMAGE_PIXELS = 512 * 512;
+constexpr size_t MAX_BATCH_IMAGES           = 32;
+
+// A normal map that ProcessAll already loaded and solved, as part of a batch. An empty normalMap means it failed to load
+struct PresolvedImage
+{
+    FloatImage2D normalMap;
+    GenerationResults result;
+};
+
+struct ProcessResults
+{
+    std::string normalMapPath;
+    bool success = false;
+    double totalTime = 0; // milliseconds, including loading and saving
+    std::vector<ProcessOutput> outputs;
+};
+
 static void DisplayHelp()
 {
     auto msg =
-        "Usage: NormalToHeight [options] PATH_TO_NORMAL_MAP\n"
+        "Usage: NormalToHeight [options] PATH_TO_NORMAL_MAP [MORE_PATHS...]\n"
+        "       NormalToHeight --server=SOCKET_PATH [options]\n"
+        "       cat NORMAL_MAP | NormalToHeight --stdout --heightExt=EXT [options] - > HEIGHT_MAP\n"
         "Will generate height map(s) and will create and output them in a directory called '[PATH_TO_NORMAL_MAP]__autogen/'\n"
+        "Paths can also be directories, in which case every supported image directly inside of them is processed.\n"
+        "A path of '-' reads the normal map from stdin\n"
+        "Multiple images are processed concurrently, with small images sharing the machine and large images getting all of it.\n"
+        "Small images of the same size are solved together, in batches\n"
         "Note: this tool expects the normal map to have +X to the right, and +Y down. See the --flipY option if the +Y direction is up\n\n"
         "Options\n"
+        "      --adaptive[=N]    Only applicable with HeightGenMethod::RELAXATION*. Instead of the fixed -i / --iterMultiplier\n"
+        "                            schedule, measure how fast each mip level converges and move on once it stops paying off,\n"
+        "                            using at most N mip 0 sweeps of work in total. Default N is the work of the fixed schedule.\n"
+        "                            The chosen schedule is logged\n"
+        "      --cacheDir=DIR    Cache generated height maps in DIR, keyed by the normal map's pixels and the options that affect the\n"
+        "                            result. Reprocessing an unchanged normal map skips the solve. Default is no caching\n"
+        "      --cacheSizeMB=N   Size budget for --cacheDir. Least recently used entries are evicted past it. Default is 1024\n"
+        "      --checkpointDir=DIR Periodically save the solver's state to DIR while generating a height map, and resume from it\n"
+        "                            if the same job is started again after being interrupted. The checkpoint is deleted once\n"
+        "                            the height map is finished. Not applicable with --timeBudgetMs. Default is no checkpoints\n"
+        "      --checkpointInterval=X Seconds between checkpoints with --checkpointDir. Default is 60\n"
+        "      --checkpointCompress Losslessly compress the checkpoints. Slower to write, but usually a fraction of the size\n"
+        "      --compareMethods[=LIST] Generate normal maps from the generated height map with each NormalCalcMethod in LIST\n"
+        "                            (comma separated, like 'cross,sobel'. Default is all of them), and log how well each\n"
+        "                            matches the original. The normal maps are only saved if -g is also given\n"
+        "      --dirtyRect=X,Y,W,H The part of the normal map that changed since --previousHeight, in pixels. Instead of --previousNormal\n"
         "  -g, --genNormalMap    Generate the normal map from the generated height map to compare to the original\n"
         "  -h, --help            Print this message and exit\n"
+        "      --heightExt=EXT   File extension for the generated height maps, like '.tif' or '.exr'. Default is the normal map's extension\n"
+        "      --heightBits=N    Bits per channel for the generated height maps (16 or 32). 16 == unorm16, or fp16 for EXRs.\n"
+        "                            32 == fp32. Only applicable to EXR, TIF, and PNG (16 only). Default is 16 for EXR (fp16)\n"
+        "                            and TIF (unorm16)\n"
+        "      --heightMips[=N]  Also output the full height map mip chain. DDS and KTX2 (BC4) files store all mips in one file, other\n"
+        "                            formats output one '_mipN' file per mip. N == 0: box filter the final height map (default).\n"
+        "                            N == 1: reuse the solver's own coarse solutions (RELAXATION* only, no extra cost)\n"
+        "      --inputFormat=EXT Format of the normal map read from stdin, like 'png'. Default is detecting it from the file's contents\n"
         "  -i, --iterations=N    How many iterations to use while generating the height map. Default is 512\n"
         "      --iterMultipier=X Only applicable with HeightGenMethod::RELAXATION*. The lower this is, the fewer iterations happen on the largest mips. (0, 1]\n"
+        "      --previousHeight=PATH Only applicable with HeightGenMethod::RELAXATION. Update PATH, a height map generated from an\n"
+        "                            older version of the normal map, by only re-solving the part of the normal map that changed\n"
+        "                            (and a coarse correction of the rest), instead of the whole image. The part that changed\n"
+        "                            comes from --previousNormal or --dirtyRect. Only a single normal map is allowed\n"
+        "      --previousNormal=PATH The normal map that --previousHeight was generated from, to find the part that changed\n"
+        "  -o, --outputDir=DIR   Directory to output everything into, instead of '[PATH_TO_NORMAL_MAP]_autogen/'\n"
         "  -m  --method          Which method to use to generate the height map (0 == RELAXATION, 1 == RELAXTION_EDGE_AWARE, 2 == LINEAR_SYSTEM). The outputted\n"
         "                            height maps will have '_gh_', '_ghe_', or '_ghl_' in their postfixes, respectively.\n"
         "  -r, --range           If specified, will output several images, with a range of iterations (ignoring the -i command).\n"
         "                        This can take a long time, especially for large images. Suggested on 1024 or smaller images\n"
+        "      --sequence[=TOL]  Only applicable with HeightGenMethod::RELAXATION*. The normal maps are the frames of an animation (in\n"
+        "                            the given order, with the files in a directory sorted by name), all the same size. They are\n"
+        "                            solved one after another, with every level of each one starting from the previous frame's\n"
+        "                            solution, and stopping once a sweep changes the heights by less than TOL texels (RMS).\n"
+        "                            Nearly identical frames then only take a few sweeps. Default TOL is 5e-5\n"
+        "      --server=PATH     Keep running and accept jobs over a Unix domain socket at PATH, which avoids paying the process\n"
+        "                            and thread startup costs per job. Each connection sends one line with the same arguments\n"
+        "                            as the command line (minus the program name) and receives a single line of JSON with the\n"
+        "                            per-image results and timings. Requests are handled one at a time, in the order they\n"
+        "                            arrive, so a slow one delays the ones behind it. Send all of the images in one request\n"
+        "                            to have them scheduled together. Sending 'shutdown' stops the server\n"
         "  -s, --slopeScale=X    How much to scale the normals by, before generating the height map. Default is 1.0\n"
+        "      --stdout          Write the height map to stdout instead of a file. All logging goes to stderr. Only DDS and KTX2\n"
+        "                            can include --heightMips, and only a single normal map without --range is allowed\n"
+        "  -t, --threads=N       How many threads to use in total. Default is all of them\n"
+        "      --timeBudgetMs=X  Only applicable with HeightGenMethod::RELAXATION*. Stop refining once generating a height map would\n"
+        "                            take longer than X milliseconds, and upsample the finest solution so far to full resolution.\n"
+        "                            The mip level it reached is logged. Time budgeted results are never cached\n"
         "  -w, --withoutGuess    Only applicable with HeightGenMethod::LINEAR_SYSTEM. By default, it generates a height map using RELAXATION, and uses that\n"
         "                            as the initial guess for the solver\n"
         "  -x, --flipX           Flip the X direction on the normal map when loading it\n"
@@ -50,6 +174,34 @@ static void DisplayHelp()
     LOG( "%s", msg );
 }
 
+static void LogSweepSchedule( const GenerationResults& result, int numPixels )
+{
+    std::string schedule;
+    for ( size_t mipLevel = 0; mipLevel + 1 < result.levelSweeps.size(); ++mipLevel )
+        schedule += ( mipLevel ? ", " : "" ) + std::to_string( result.levelSweeps[mipLevel] );
+    LOG( "\tSweeps per mip level (mip 0 first): %s. Total work = %.1f mip 0 sweeps", schedule.c_str(), result.pixelUpdates / (double)numPixels );
+}
+
+// The bits that a height map with the extension 'ext' actually gets. TIFs default to unorm16, same as an explicit --heightBits=16
+static uint32_t GetHeightMapBits( const std::string& ext, uint32_t heightMapBits )
+{
+    if ( heightMapBits == 0 && ( ext == ".tif" || ext == ".tiff" ) )
+        return 16;
+
+    return heightMapBits;
+}
+
+static bool ValidateHeightMapBits( const std::string& heightMapExt, uint32_t heightMapBits )
+{
+    if ( heightMapBits == 32 && heightMapExt == ".png" )
+    {
+        LOG_ERR( "PNG height maps can't be 32 bit, only --heightBits=16" );
+        return false;
+    }
+
+    return true;
+}
+
 static bool ParseCommandLineArgs( int argc, char** argv, Options& options )
 {
     if ( argc == 1 )
@@ -60,13 +212,33 @@ static bool ParseCommandLineArgs( int argc, char** argv, Options& options )
 
     static struct option long_options[] =
     {
+        { "adaptive",       optional_argument, 0, 1010 },
+        { "cacheDir",       required_argument, 0, 1005 },
+        { "cacheSizeMB",    required_argument, 0, 1006 },
+        { "checkpointDir",  required_argument, 0, 1012 },
+        { "checkpointInterval", required_argument, 0, 1013 },
+        { "checkpointCompress", no_argument,   0, 1014 },
+        { "compareMethods", optional_argument, 0, 1009 },
+        { "dirtyRect",      required_argument, 0, 1017 },
         { "genNormalMap",   no_argument,       0, 'g' },
         { "help",           no_argument,       0, 'h' },
+        { "heightExt",      required_argument, 0, 1001 },
+        { "heightBits",     required_argument, 0, 1002 },
+        { "heightMips",     optional_argument, 0, 1003 },
+        { "inputFormat",    required_argument, 0, 1007 },
         { "iterations",     required_argument, 0, 'i' },
         { "iterMultiplier", required_argument, 0, 1000 },
         { "method",         required_argument, 0, 'm' },
+        { "outputDir",      required_argument, 0, 'o' },
+        { "previousHeight", required_argument, 0, 1015 },
+        { "previousNormal", required_argument, 0, 1016 },
         { "range",          no_argument,       0, 'r' },
+        { "sequence",       optional_argument, 0, 1018 },
+        { "server",         required_argument, 0, 1004 },
         { "slopeScale",     required_argument, 0, 's' },
+        { "stdout",         no_argument,       0, 1008 },
+        { "threads",        required_argument, 0, 't' },
+        { "timeBudgetMs",   required_argument, 0, 1011 },
         { "withoutGuess",   no_argument,       0, 'w' },
         { "flipX",          no_argument,       0, 'x' },
         { "flipY",          no_argument,       0, 'y' },
@@ -75,7 +247,7 @@ static bool ParseCommandLineArgs( int argc, char** argv, Options& options )
 
     int option_index  = 0;
     int c             = -1;
-    while ( ( c = getopt_long( argc, argv, "ghi:m:rs:wxy", long_options, &option_index ) ) != -1 )
+    while ( ( c = getopt_long( argc, argv, "ghi:m:o:rs:t:wxy", long_options, &option_index ) ) != -1 )
     {
         switch ( c )
         {
@@ -91,15 +263,117 @@ static bool ParseCommandLineArgs( int argc, char** argv, Options& options )
         case 1000:
             options.iterationMultiplier = std::stof( optarg );
             break;
+        case 1001:
+            options.heightMapExt = optarg;
+            if ( !options.heightMapExt.empty() && options.heightMapExt[0] != '.' )
+                options.heightMapExt = "." + options.heightMapExt;
+            break;
+        case 1002:
+            options.heightMapBits = std::stoul( optarg );
+            if ( options.heightMapBits != 16 && options.heightMapBits != 32 )
+            {
+                LOG_ERR( "--heightBits must be 16 or 32" );
+                return false;
+            }
+            break;
+        case 1003:
+            options.heightMipMode = ( optarg && std::stoi( optarg ) == 1 ) ? HeightMipMode::SOLVER : HeightMipMode::GENERATE;
+            break;
+        case 1004:
+            options.serverSocketPath = optarg;
+            break;
+        case 1005:
+            options.cache.directory = optarg;
+            break;
+        case 1006:
+            options.cache.maxSizeInBytes = std::stoull( optarg ) * 1024 * 1024;
+            break;
+        case 1007:
+            options.inputFormat = optarg;
+            if ( !options.inputFormat.empty() && options.inputFormat[0] != '.' )
+                options.inputFormat = "." + options.inputFormat;
+            break;
+        case 1008:
+            options.writeToStdout = true;
+            break;
+        case 1010:
+            options.adaptiveSchedule = true;
+            options.adaptiveBudget   = optarg ? std::stof( optarg ) : 0.0f;
+            break;
+        case 1011:
+            options.timeBudgetMs = std::stof( optarg );
+            break;
+        case 1012:
+            options.checkpointDir = optarg;
+            break;
+        case 1013:
+            options.checkpointInterval = std::stof( optarg );
+            break;
+        case 1014:
+            options.compressCheckpoints = true;
+            break;
+        case 1015:
+            options.previousHeightPath = optarg;
+            break;
+        case 1016:
+            options.previousNormalMapPath = optarg;
+            break;
+        case 1017:
+        {
+            PixelRect& rect = options.dirtyRect;
+            if ( sscanf( optarg, "%d,%d,%d,%d", &rect.x, &rect.y, &rect.width, &rect.height ) != 4 || rect.Empty() )
+            {
+                LOG_ERR( "--dirtyRect must be 'X,Y,W,H', with a non-zero width and height" );
+                return false;
+            }
+            break;
+        }
+        case 1018:
+            options.sequence          = true;
+            options.residualTolerance = optarg ? std::stof( optarg ) : DEFAULT_SEQUENCE_TOLERANCE;
+            break;
+        case 1009:
+            options.compareNormalMethods = ( 1u << Underlying( NormalCalcMethod::COUNT ) ) - 1;
+            if ( optarg )
+            {
+                options.compareNormalMethods = 0;
+                std::string methods = optarg;
+                for ( size_t start = 0; start <= methods.size(); )
+                {
+                    size_t end = std::min( methods.find( ',', start ), methods.size() );
+                    NormalCalcMethod method = StrToNormalCalcMethod( methods.substr( start, end - start ) );
+                    if ( method == NormalCalcMethod::COUNT )
+                    {
+                        LOG_ERR( "Unknown normal calculation method '%s'", methods.substr( start, end - start ).c_str() );
+                        return false;
+                    }
+                    options.compareNormalMethods |= 1u << Underlying( method );
+                    start = end + 1;
+                }
+            }
+            break;
         case 'm':
             options.heightGenMethod = (HeightGenMethod)std::clamp( std::stoi( optarg ), 0, (int)HeightGenMethod::COUNT - 1 );
             break;
+        case 'o':
+            options.outputDir = optarg;
+            if ( !options.outputDir.empty() && options.outputDir.back() != '/' && options.outputDir.back() != '\\' )
+                options.outputDir += '/';
+            break;
         case 'r':
             options.rangeOfIterations = true;
             break;
         case 's':
             options.slopeScale = std::stof( optarg );
             break;
+        case 't':
+            options.numThreads = std::stoi( optarg );
+            if ( options.numThreads < 1 )
+            {
+                LOG_ERR( "-t must be at least 1" );
+                return false;
+            }
+            break;
         case 'w':
             options.linearSolveWithGuess = false;
             break;
@@ -115,27 +389,251 @@ static bool ParseCommandLineArgs( int argc, char** argv, Options& options )
         }
     }
 
-    if ( optind >= argc )
+    if ( optind >= argc && options.serverSocketPath.empty() )
     {
         DisplayHelp();
         return false;
     }
-    options.normalMapPath = argv[optind];
+    for ( int i = optind; i < argc; ++i )
+    {
+        std::string path = argv[i];
+        if ( path == "-" || !IsDirectory( path ) )
+        {
+            options.normalMapPaths.push_back( path );
+            continue;
+        }
+
+        // sorted, so that --sequence frames come out in order
+        std::vector<std::string> files = GetFilesInDir( path, false );
+        std::sort( files.begin(), files.end() );
+        int width, height;
+        for ( const std::string& file : files )
+        {
+            if ( GetImageDimensions( file, width, height ) )
+                options.normalMapPaths.push_back( file );
+        }
+    }
+
+    if ( options.normalMapPaths.empty() && options.serverSocketPath.empty() )
+    {
+        LOG_ERR( "No supported normal maps found" );
+        return false;
+    }
+
+    for ( const std::string& path : options.normalMapPaths )
+    {
+        std::string heightMapExt = options.heightMapExt;
+        if ( heightMapExt.empty() )
+            heightMapExt = path == "-" ? options.inputFormat : GetFileExtension( path );
+        if ( !ValidateHeightMapBits( heightMapExt, options.heightMapBits ) )
+            return false;
+    }
+
+    bool readsStdin = std::find( options.normalMapPaths.begin(), options.normalMapPaths.end(), "-" ) != options.normalMapPaths.end();
+    if ( ( readsStdin || options.writeToStdout ) && options.normalMapPaths.size() > 1 )
+    {
+        LOG_ERR( "Reading from stdin or writing to stdout only supports a single normal map" );
+        return false;
+    }
+    if ( options.writeToStdout && options.rangeOfIterations )
+    {
+        LOG_ERR( "--stdout can only output a single height map, and can't be used with --range" );
+        return false;
+    }
+    if ( !options.previousHeightPath.empty() )
+    {
+        if ( options.normalMapPaths.size() > 1 || options.heightGenMethod != HeightGenMethod::RELAXATION )
+        {
+            LOG_ERR( "--previousHeight only supports a single normal map, with HeightGenMethod::RELAXATION" );
+            return false;
+        }
+        if ( options.previousNormalMapPath.empty() == options.dirtyRect.Empty() )
+        {
+            LOG_ERR( "--previousHeight needs exactly one of --previousNormal or --dirtyRect" );
+            return false;
+        }
+    }
+    if ( options.sequence && ( options.heightGenMethod == HeightGenMethod::LINEAR_SYSTEM || options.rangeOfIterations ||
+                                 !options.previousHeightPath.empty() ) )
+    {
+        LOG_ERR( "--sequence only supports HeightGenMethod::RELAXATION*, without --range or --previousHeight" );
+        return false;
+    }
 
     return true;
 }
 
-bool Process( const Options& options )
+static bool SaveHeightMapImage( const FloatImage2D& map, const std::string& filename, uint32_t heightMapBits )
+{
+    std::string ext = GetFileExtension( filename );
+    bool isFloatFormat = ext == ".exr" || ext == ".hdr";
+    heightMapBits = GetHeightMapBits( ext, heightMapBits );
+    if ( heightMapBits == 32 )
+        return map.Save( filename, ImageSaveFlags::KEEP_FLOATS_AS_32_BIT );
+    if ( heightMapBits == 16 && !isFloatFormat )
+        return RawImage2DFromFloatImage( map, ImageFormat::R16_UNORM ).Save( filename );
+
+    return map.Save( filename );
+}
+
+static bool SaveHeightMap( const GeneratedHeightMap& heightMap, const std::string& filename, const Options& options )
+{
+    std::string ext = GetFileExtension( filename );
+    if ( !heightMap.mips.empty() && ( ext == ".dds" || ext == ".ktx2" ) )
+    {
+        std::vector<FloatImage2D> mips = { heightMap.map };
+        mips.insert( mips.end(), heightMap.mips.begin(), heightMap.mips.end() );
+        return SaveMipChain( filename, mips );
+    }
+
+    // tinyexr can't write multi-level EXRs, so every other format gets one file per mip
+    bool success = SaveHeightMapImage( heightMap.map, filename, options.heightMapBits );
+    std::string filenameBase = GetFilenameMinusExtension( filename );
+    for ( size_t mipLevel = 1; mipLevel <= heightMap.mips.size(); ++mipLevel )
+    {
+        std::string mipFilename = filenameBase + "_mip" + std::to_string( mipLevel ) + ext;
+        success = SaveHeightMapImage( heightMap.mips[mipLevel - 1], mipFilename, options.heightMapBits ) && success;
+    }
+
+    return success;
+}
+
+// Only DDS and KTX2 can hold the whole mip chain in a single file, every other format just gets mip 0
+static bool WriteHeightMapToStdout( const GeneratedHeightMap& heightMap, const std::string& ext, const Options& options )
+{
+    std::vector<uint8_t> fileData;
+    bool success;
+    if ( !heightMap.mips.empty() && ( ext == ".dds" || ext == ".ktx2" ) )
+    {
+        std::vector<FloatImage2D> mips = { heightMap.map };
+        mips.insert( mips.end(), heightMap.mips.begin(), heightMap.mips.end() );
+        success = SaveMipChainToMemory( fileData, ext, mips );
+    }
+    else
+    {
+        if ( !heightMap.mips.empty() )
+            LOG_WARN( "Only DDS and KTX2 height maps can include mips when writing to stdout. Only writing mip 0" );
+
+        bool isFloatFormat = ext == ".exr" || ext == ".hdr";
+        uint32_t heightMapBits = GetHeightMapBits( ext, options.heightMapBits );
+        ImageFormat format = heightMapBits == 16 && !isFloatFormat ? ImageFormat::R16_UNORM : ImageFormat::R32_FLOAT;
+        ImageSaveFlags flags = heightMapBits == 32 ? ImageSaveFlags::KEEP_FLOATS_AS_32_BIT : ImageSaveFlags::DEFAULT;
+        success = RawImage2DFromFloatImage( heightMap.map, format ).SaveToMemory( fileData, ext, flags );
+    }
+
+    if ( !success || fwrite( fileData.data(), 1, fileData.size(), stdout ) != fileData.size() || fflush( stdout ) != 0 )
+    {
+        LOG_ERR( "Failed to write the height map to stdout" );
+        return false;
+    }
+
+    return true;
+}
+
+static bool ReadStdin( std::vector<uint8_t>& bytes )
+{
+#if USING( WINDOWS_PROGRAM )
+    _setmode( _fileno( stdin ), _O_BINARY );
+#endif
+    uint8_t buffer[65536];
+    size_t numRead;
+    while ( ( numRead = fread( buffer, 1, sizeof( buffer ), stdin ) ) > 0 )
+        bytes.insert( bytes.end(), buffer, buffer + numRead );
+
+    return !ferror( stdin ) && !bytes.empty();
+}
+
+// Loads Options::previousHeightPath, and finds which part of normalMap changed since it was generated. Saved height maps are
+// packed to [0, 1], so their scale is estimated from the unchanged part of normalMap
+static bool LoadPreviousHeightMap( const Options& options, const FloatImage2D& normalMap, GeneratedHeightMap& previousHeights, PixelRect& dirtyRect )
+{
+    FloatImage2D heights;
+    if ( !heights.Load( options.previousHeightPath ) )
+    {
+        LOG_ERR( "Could not load the previous height map '%s'", options.previousHeightPath.c_str() );
+        return false;
+    }
+
+    previousHeights.map = FloatImage2D( heights.width, heights.height, 1 );
+    for ( int i = 0; i < heights.width * heights.height; ++i )
+        previousHeights.map.data[i] = heights.data[i * heights.numChannels];
+
+    dirtyRect = options.dirtyRect;
+    if ( !options.previousNormalMapPath.empty() )
+    {
+        FloatImage2D previousNormalMap = LoadNormalMap( options.previousNormalMapPath, 1.0f, options.flipY, options.flipX );
+        if ( !previousNormalMap )
+            return false;
+        dirtyRect = FindChangedRegion( previousNormalMap, normalMap );
+    }
+
+    previousHeights.scale = EstimateHeightMapScale( previousHeights.map, normalMap, dirtyRect );
+    previousHeights.bias  = 0;
+    LOG( "Re-solving the %dx%d region at (%d, %d) of the previous height map", dirtyRect.width, dirtyRect.height, dirtyRect.x, dirtyRect.y );
+
+    return true;
+}
+
+// warmStart: with --sequence, the previous frame's unpacked solution (empty for the first frame). Replaced with this frame's.
+// presolved: skips loading and solving the normal map, if it was done as part of a batch
+bool Process( const Options& options, ProcessResults* results = nullptr, GeneratedHeightMap* warmStart = nullptr,
+    const PresolvedImage* presolved = nullptr )
 {
     LOG( "Processing %s...", options.normalMapPath.c_str() );
+    auto startTime = PG::Time::GetTimePoint();
+    if ( results )
+        results->normalMapPath = options.normalMapPath;
 
-    FloatImage2D normalMap = LoadNormalMap( options.normalMapPath, 1.0f, options.flipY, options.flipX );
+    FloatImage2D normalMap;
+    std::string normalMapExt;
+    std::string normalMapStem;
+    if ( options.normalMapPath == "-" )
+    {
+        std::vector<uint8_t> fileData;
+        if ( !ReadStdin( fileData ) )
+        {
+            LOG_ERR( "Could not read the normal map from stdin" );
+            return false;
+        }
+        normalMap     = LoadNormalMapFromMemory( fileData.data(), fileData.size(), options.inputFormat, 1.0f, options.flipY, options.flipX );
+        normalMapExt  = options.inputFormat.empty() ? GetImageExtensionFromMagic( fileData.data(), fileData.size() ) : options.inputFormat;
+        normalMapStem = "stdin";
+    }
+    else
+    {
+        normalMap     = presolved ? presolved->normalMap : LoadNormalMap( options.normalMapPath, 1.0f, options.flipY, options.flipX );
+        normalMapExt  = GetFileExtension( options.normalMapPath );
+        normalMapStem = GetFilenameStem( options.normalMapPath );
+    }
     if ( !normalMap )
         return false;
-    std::string normalMapExt = GetFileExtension( options.normalMapPath );
+    std::string heightMapExt = options.heightMapExt.empty() ? normalMapExt : options.heightMapExt;
+    if ( !ValidateHeightMapBits( heightMapExt, options.heightMapBits ) )
+        return false;
 
-    std::string outputDir = GetFilenameMinusExtension( options.normalMapPath ) + "_autogen/";
-    CreateDirectory( outputDir );
+    std::string outputDir = options.outputDir;
+    if ( outputDir.empty() )
+        outputDir = ( options.normalMapPath == "-" ? normalMapStem : GetFilenameMinusExtension( options.normalMapPath ) ) + "_autogen/";
+    if ( ( !options.writeToStdout || options.outputGenNormals ) && !CreateDirectory( outputDir ) )
+    {
+        LOG_ERR( "Could not create the output directory '%s'", outputDir.c_str() );
+        return false;
+    }
+
+    HeightCacheKey normalMapKey;
+    if ( !options.cache.directory.empty() || !options.checkpointDir.empty() )
+        normalMapKey = HashNormalMap( normalMap );
+    if ( !options.checkpointDir.empty() && !CreateDirectory( options.checkpointDir ) )
+    {
+        LOG_ERR( "Could not create the checkpoint directory '%s'", options.checkpointDir.c_str() );
+        return false;
+    }
+
+    bool incremental = !options.previousHeightPath.empty();
+    GeneratedHeightMap previousHeights;
+    PixelRect dirtyRect;
+    if ( incremental && !LoadPreviousHeightMap( options, normalMap, previousHeights, dirtyRect ) )
+        return false;
 
     std::vector<uint32_t> iterationsList;
     if ( options.rangeOfIterations )
@@ -143,68 +641,406 @@ bool Process( const Options& options )
     else
         iterationsList = { options.numIterations };
 
+    bool allSaved = true;
     for ( size_t i = 0; i < iterationsList.size(); ++i )
     {
         std::string postfixH = ""; // for generated height maps
         std::string postfixN = ""; // for normal maps generated from the generated height maps
         GenerationResults result;
+
+        HeightCacheKey cacheKey = normalMapKey;
+        cacheKey.Add( options.heightGenMethod );
+        cacheKey.Add( iterationsList[i] );
+        cacheKey.Add( options.iterationMultiplier );
+        cacheKey.Add( options.slopeScale );
+        cacheKey.Add( options.flipX );
+        cacheKey.Add( options.flipY );
+        cacheKey.Add( options.heightMipMode );
+        cacheKey.Add( options.linearSolveWithGuess );
+        cacheKey.Add( options.adaptiveSchedule );
+        cacheKey.Add( options.adaptiveBudget );
+        cacheKey.Add( options.residualTolerance );
+        // time budgeted results depend on how fast the machine was at the time, so they aren't reproducible enough to cache.
+        // Incremental and warm started ones depend on the previous height map, which isn't part of the key
+        bool useCache = !options.cache.directory.empty() && options.timeBudgetMs <= 0 && !incremental && !warmStart;
+        bool cached   = useCache && LoadCachedHeightMap( options.cache, cacheKey, result );
+
+        RelaxationControls relaxationControls;
+        relaxationControls.adaptive     = options.adaptiveSchedule;
+        relaxationControls.workBudget   = (uint64_t)( options.adaptiveBudget * normalMap.width * normalMap.height );
+        relaxationControls.timeBudgetMs = options.timeBudgetMs;
+        relaxationControls.residualTolerance = options.residualTolerance;
+        if ( warmStart && warmStart->map )
+            relaxationControls.warmStart = warmStart;
+        // warm starting needs the solution of every level
+        HeightMipMode solverMipMode = warmStart ? HeightMipMode::SOLVER : options.heightMipMode;
+
+        // time budgeted solves can't be resumed deterministically either
+        std::string checkpointPath;
+        SolverCheckpoint resumeCheckpoint;
+        if ( !cached && !options.checkpointDir.empty() && options.timeBudgetMs <= 0 && !incremental && !warmStart )
+        {
+            char name[32];
+            snprintf( name, sizeof( name ), "%016llx.n2hc", (unsigned long long)cacheKey.hash );
+            checkpointPath = options.checkpointDir + "/" + name;
+            if ( LoadSolverCheckpoint( checkpointPath, cacheKey.hash, resumeCheckpoint ) )
+            {
+                LOG( "Resuming from checkpoint '%s' at mip level %u, after %u iterations", checkpointPath.c_str(), resumeCheckpoint.mipLevel,
+                    resumeCheckpoint.sweeps );
+                relaxationControls.checkpoints.resumeFrom = &resumeCheckpoint;
+            }
+
+            relaxationControls.checkpoints.interval     = options.checkpointInterval;
+            relaxationControls.checkpoints.onCheckpoint = [&]( const SolverCheckpoint& checkpoint )
+            { SaveSolverCheckpoint( checkpointPath, cacheKey.hash, checkpoint, options.compressCheckpoints ); };
+        }
+
         if ( options.heightGenMethod == HeightGenMethod::RELAXATION )
         {
             postfixH = "_gh_";
             postfixN = "_gn_";
-            result = GetHeightMapFromNormalMap( normalMap, iterationsList[i], options.iterationMultiplier );
+            if ( incremental )
+            {
+                result = GetHeightMapFromNormalMap_Incremental( normalMap, previousHeights, dirtyRect, iterationsList[i], options.iterationMultiplier );
+                CompleteHeightMapMips( result.heightMap, options.heightMipMode == HeightMipMode::NONE ? HeightMipMode::NONE : HeightMipMode::GENERATE );
+            }
+            else if ( presolved )
+                result = presolved->result;
+            else if ( !cached )
+                result = GetHeightMapFromNormalMap(
+                    normalMap, iterationsList[i], options.iterationMultiplier, solverMipMode, nullptr, relaxationControls );
         }
-        else if ( options.heightGenMethod == HeightGenMethod::RELAXATION )
+        else if ( options.heightGenMethod == HeightGenMethod::RELAXTION_EDGE_AWARE )
         {
             postfixH = "_ghe_";
             postfixN = "_gne_";
-            result = GetHeightMapFromNormalMap_WithEdges( normalMap, iterationsList[i], options.iterationMultiplier );
+            if ( !cached )
+                result = GetHeightMapFromNormalMap_WithEdges(
+                    normalMap, iterationsList[i], options.iterationMultiplier, solverMipMode, nullptr, relaxationControls );
         }
         else
         {
             postfixH = "_ghl_";
             postfixN = "_gnl_";
-            result = GetHeightMapFromNormalMap_LinearSolve( normalMap, iterationsList[i], options.linearSolveWithGuess );
+            if ( !cached )
+                result = GetHeightMapFromNormalMap_LinearSolve( normalMap, iterationsList[i], options.linearSolveWithGuess,
+                    options.heightMipMode, nullptr, relaxationControls.checkpoints );
+        }
+        if ( !checkpointPath.empty() )
+            DeleteFile( checkpointPath );
+        if ( warmStart )
+        {
+            // the height map gets packed in place before it's saved, so the next frame needs its own copy
+            *warmStart     = result.heightMap;
+            warmStart->map = result.heightMap.map.Clone();
+            if ( options.heightMipMode == HeightMipMode::SOLVER )
+            {
+                for ( FloatImage2D& mip : warmStart->mips )
+                    mip = mip.Clone();
+            }
+            else
+            {
+                result.heightMap.mips.clear();
+                CompleteHeightMapMips( result.heightMap, options.heightMipMode );
+            }
         }
 
-        LOG( "Finished %dx%d image with %u iterations in %.3f seconds", normalMap.width, normalMap.height, result.iterations, result.timeToGenerate );
+        if ( cached )
+        {
+            LOG( "Using cached %dx%d height map with %u iterations", normalMap.width, normalMap.height, result.iterations );
+        }
+        else
+        {
+            LOG( "Finished %dx%d image with %u iterations in %.3f seconds", normalMap.width, normalMap.height, result.iterations, result.timeToGenerate );
+            if ( useCache )
+                StoreCachedHeightMap( options.cache, cacheKey, result );
+            if ( ( options.adaptiveSchedule || options.timeBudgetMs > 0 || options.residualTolerance > 0 ) && !result.levelSweeps.empty() )
+                LogSweepSchedule( result, normalMap.width * normalMap.height );
+            if ( result.outOfTime )
+                LOG( "\tRan out of the %.1fms time budget. Reached mip level %u", options.timeBudgetMs, result.achievedMipLevel );
+        }
         LOG( "\tGenerated Height Map: Scale = %f, Bias = %f", result.heightMap.maxH - result.heightMap.minH, result.heightMap.minH );
 
-        std::string outputPathBase = outputDir + GetFilenameStem( options.normalMapPath );
-        if ( options.outputGenNormals )
+        std::string outputPathBase = outputDir + normalMapStem;
+        ProcessOutput output;
+        output.heightMapPath  = options.writeToStdout ? "-" : outputPathBase + postfixH + std::to_string( iterationsList[i] ) + heightMapExt;
+        output.iterations     = result.iterations;
+        output.timeToGenerate = result.timeToGenerate;
+        output.scale          = result.heightMap.maxH - result.heightMap.minH;
+        output.bias           = result.heightMap.minH;
+        output.normalsPSNR    = 0;
+        output.cached         = cached;
+        if ( options.outputGenNormals || options.compareNormalMethods )
         {
-#if 0
+            bool compare = options.compareNormalMethods != 0;
+            uint32_t methods = compare ? options.compareNormalMethods : 1u << Underlying( NormalCalcMethod::CROSS );
+            std::vector<FloatImage2D> generatedNormalMaps;
+            NormalCalcMethodPSNRs PSNRs =
+                ScoreNormalCalcMethods( result.heightMap, normalMap, methods, options.outputGenNormals ? methods : 0, &generatedNormalMaps );
+
+            bool firstMethod = true;
             for ( uint32_t nIdx = 0; nIdx < Underlying( NormalCalcMethod::COUNT ); ++nIdx )
             {
+                if ( !( methods & ( 1u << nIdx ) ) )
+                    continue;
+
                 NormalCalcMethod method = (NormalCalcMethod)nIdx;
-                FloatImage2D generatedNormalMap = GetNormalMapFromHeightMap( result.heightMap, method );
-                double PSNR = CompareNormalMaps( normalMap, generatedNormalMap );
-                LOG( "\tGenerated Normal Method %s PSNR = %f", NormalCalcMethodToStr( method ), PSNR );
-                PackNormalMap( generatedNormalMap, options.flipY, options.flipX );
-                generatedNormalMap.Save( outputPathBase + postfixN + NormalCalcMethodToStr( method ) + normalMapExt );
-            }
-#else
-            FloatImage2D generatedNormalMap = GetNormalMapFromHeightMap( result.heightMap, NormalCalcMethod::CROSS );
-            double PSNR = CompareNormalMaps( normalMap, generatedNormalMap );
-            LOG( "\tGenerated Normals PSNR = %f", PSNR );
+                if ( compare )
+                    LOG( "\tGenerated Normal Method %s PSNR = %f", NormalCalcMethodToStr( method ), PSNRs[nIdx] );
+                else
+                    LOG( "\tGenerated Normals PSNR = %f", PSNRs[nIdx] );
+                if ( firstMethod )
+                    output.normalsPSNR = PSNRs[nIdx];
+                firstMethod = false;
 
-            //auto diffImg = DiffNormalMaps( normalMap, generatedNormalMap );
-            //diffImg.Save( outputPathBase + postfixN + "diff_" + std::to_string( iterationsList[i] ) + ".exr" );
+                //auto diffImg = DiffNormalMaps( normalMap, generatedNormalMap );
+                //diffImg.Save( outputPathBase + postfixN + "diff_" + std::to_string( iterationsList[i] ) + ".exr" );
 
-            PackNormalMap( generatedNormalMap, options.flipY, options.flipX );
-            generatedNormalMap.Save( outputPathBase + postfixN + std::to_string( iterationsList[i] ) + normalMapExt );
-#endif
+                if ( options.outputGenNormals )
+                {
+                    FloatImage2D& generatedNormalMap = generatedNormalMaps[nIdx];
+                    NormalMapMetrics metrics = CompareNormalMapsDetailed( normalMap, generatedNormalMap );
+                    LOG( "\t\tSSIM = %f, Angular Error (degrees): Mean = %f, Max = %f, 99th Percentile = %.2f", metrics.ssim,
+                        metrics.meanAngularError, metrics.maxAngularError, metrics.percentileAngularError );
+                    if ( metrics.nonFinitePixels )
+                        LOG_WARN( "%llu pixels had NaN or infinite normals, and were left out of those metrics",
+                            (unsigned long long)metrics.nonFinitePixels );
+
+                    PackNormalMap( generatedNormalMap, options.flipY, options.flipX );
+                    std::string methodPostfix = compare ? std::string( NormalCalcMethodToStr( method ) ) + "_" : "";
+                    generatedNormalMap.Save( outputPathBase + postfixN + methodPostfix + std::to_string( iterationsList[i] ) + normalMapExt );
+                }
+            }
         }
 
-        if ( normalMapExt != ".exr" )
+        if ( heightMapExt != ".exr" )
             result.heightMap.Pack0To1();
 
-        result.heightMap.map.Save( outputPathBase + postfixH + std::to_string( iterationsList[i] ) + GetFileExtension( options.normalMapPath ) );
+        bool saved = options.writeToStdout ? WriteHeightMapToStdout( result.heightMap, heightMapExt, options ) :
+                                             SaveHeightMap( result.heightMap, output.heightMapPath, options );
+        if ( !saved && options.writeToStdout )
+            return false;
+        allSaved     = allSaved && saved;
+        output.saved = saved;
+        if ( results )
+            results->outputs.push_back( output );
     }
 
     LOG( "" );
+    if ( results )
+    {
+        results->success   = allSaved;
+        results->totalTime = PG::Time::GetTimeSince( startTime );
+    }
 
-    return true;
+    return allSaved;
+}
+
+// If the images can be solved with GetHeightMapsFromNormalMaps_Batched, without changing the results
+static bool CanBatchImages( const Options& options )
+{
+    return options.heightGenMethod == HeightGenMethod::RELAXATION && !options.adaptiveSchedule && options.timeBudgetMs <= 0 &&
+           !options.rangeOfIterations && !options.sequence && options.previousHeightPath.empty() && options.cache.directory.empty() &&
+           options.checkpointDir.empty();
+}
+
+// Loads and solves the normal maps of 'indices' (all the same size) as one batch, and then saves them all concurrently
+static void ProcessBatch( const Options& options, const std::vector<size_t>& indices, std::vector<ProcessResults>* results,
+    const BatchSchedulerSettings& batchSettings )
+{
+    std::vector<PresolvedImage> presolved( indices.size() );
+    #pragma omp parallel for schedule( dynamic )
+    for ( int i = 0; i < (int)indices.size(); ++i )
+        presolved[i].normalMap = LoadNormalMap( options.normalMapPaths[indices[i]], 1.0f, options.flipY, options.flipX );
+
+    std::vector<FloatImage2D> normalMaps;
+    std::vector<PresolvedImage*> loaded;
+    for ( PresolvedImage& image : presolved )
+    {
+        if ( image.normalMap )
+        {
+            normalMaps.push_back( image.normalMap );
+            loaded.push_back( &image );
+        }
+    }
+    LOG( "Solving a batch of %zu %dx%d normal maps...", normalMaps.size(), normalMaps.empty() ? 0 : normalMaps[0].width,
+        normalMaps.empty() ? 0 : normalMaps[0].height );
+    std::vector<GenerationResults> solved =
+        GetHeightMapsFromNormalMaps_Batched( normalMaps, options.numIterations, options.iterationMultiplier, options.heightMipMode );
+    for ( size_t i = 0; i < solved.size(); ++i )
+        loaded[i]->result = std::move( solved[i] );
+
+    std::vector<BatchJob> jobs( indices.size() );
+    for ( size_t i = 0; i < jobs.size(); ++i )
+    {
+        Options jobOptions         = options;
+        jobOptions.normalMapPath   = options.normalMapPaths[indices[i]];
+        ProcessResults* jobResults = results ? &( *results )[indices[i]] : nullptr;
+        const PresolvedImage* job  = &presolved[i];
+        jobs[i].work = [jobOptions, jobResults, job]() { Process( jobOptions, jobResults, nullptr, job ); };
+        jobs[i].cost = job->normalMap ? (uint64_t)job->normalMap.width * job->normalMap.height : 0;
+    }
+    RunBatch( jobs, batchSettings );
+}
+
+// Processes every path in options.normalMapPaths. results (if non-null) gets one entry per path, in the same order
+static void ProcessAll( const Options& options, std::vector<ProcessResults>* results = nullptr )
+{
+    if ( results )
+        results->resize( options.normalMapPaths.size() );
+
+    if ( options.normalMapPaths.size() == 1 )
+    {
+        Options jobOptions       = options;
+        jobOptions.normalMapPath = options.normalMapPaths[0];
+        Process( jobOptions, results ? &( *results )[0] : nullptr );
+        return;
+    }
+
+    // every frame starts from the previous one's solution, so they can't run concurrently
+    if ( options.sequence )
+    {
+        GeneratedHeightMap warmStart;
+        for ( size_t i = 0; i < options.normalMapPaths.size(); ++i )
+        {
+            Options jobOptions       = options;
+            jobOptions.normalMapPath = options.normalMapPaths[i];
+            Process( jobOptions, results ? &( *results )[i] : nullptr, &warmStart );
+        }
+        return;
+    }
+
+    BatchSchedulerSettings batchSettings;
+    batchSettings.numThreads = options.numThreads;
+
+    std::vector<BatchJob> jobs;
+    std::map<std::pair<int, int>, std::vector<size_t>> smallImages; // that can be batched, by their dimensions
+    bool canBatch = CanBatchImages( options );
+    auto AddJob   = [&]( size_t i, uint64_t cost )
+    {
+        Options jobOptions         = options;
+        jobOptions.normalMapPath   = options.normalMapPaths[i];
+        ProcessResults* jobResults = results ? &( *results )[i] : nullptr;
+        jobs.push_back( { [jobOptions, jobResults]() { Process( jobOptions, jobResults ); }, cost } );
+    };
+    for ( size_t i = 0; i < options.normalMapPaths.size(); ++i )
+    {
+        // unknown dimensions just get the whole machine
+        int width, height;
+        uint64_t cost = GetImageDimensions( options.normalMapPaths[i], width, height ) ? (uint64_t)width * height : UINT64_MAX;
+        if ( canBatch && cost <= MAX_BATCHED_IMAGE_PIXELS )
+            smallImages[{ width, height }].push_back( i );
+        else
+            AddJob( i, cost );
+    }
+
+    for ( const auto& [dimensions, indices] : smallImages )
+    {
+        for ( size_t start = 0; start < indices.size(); start += MAX_BATCH_IMAGES )
+        {
+            std::vector<size_t> batch( indices.begin() + start, indices.begin() + Min( start + MAX_BATCH_IMAGES, indices.size() ) );
+            // a batch of 1 would just waste the padding lanes
+            if ( batch.size() == 1 )
+                AddJob( batch[0], (uint64_t)dimensions.first * dimensions.second );
+            else
+                ProcessBatch( options, batch, results, batchSettings );
+        }
+    }
+
+    RunBatch( jobs, batchSettings );
+}
+
+static std::string JsonEscape( const std::string& str )
+{
+    std::string escaped;
+    for ( char c : str )
+    {
+        if ( c == '"' || c == '\\' )
+        {
+            escaped += '\\';
+            escaped += c;
+        }
+        else if ( (unsigned char)c < 0x20 )
+        {
+            char buffer[8];
+            snprintf( buffer, sizeof( buffer ), "\\u%04x", c );
+            escaped += buffer;
+        }
+        else
+        {
+            escaped += c;
+        }
+    }
+
+    return escaped;
+}
+
+// The request is a line of command line arguments (minus the program name). The reply is a single line of JSON
+static std::string HandleServerRequest( const std::string& request )
+{
+    auto startTime = PG::Time::GetTimePoint();
+    std::vector<std::string> args = SplitServerRequest( request );
+    args.insert( args.begin(), "NormalToHeight" );
+    std::vector<char*> argv( args.size() );
+    for ( size_t i = 0; i < args.size(); ++i )
+        argv[i] = args[i].data();
+
+    Options options = {};
+    std::vector<ProcessResults> results;
+    // -t only applies to this request, every other one keeps the thread count that the server started with
+    int serverNumThreads = omp_get_max_threads();
+    // one bad request (like an unparsable number) shouldn't take down the whole server
+    try
+    {
+        optind = 0; // forces getopt to reinitialize, since it has already been used by previous requests
+        bool parsed = ParseCommandLineArgs( (int)argv.size(), argv.data(), options );
+        if ( !parsed || !options.serverSocketPath.empty() || options.writeToStdout || options.normalMapPaths.empty() ||
+             options.normalMapPaths[0] == "-" )
+            return "{\"success\":false,\"error\":\"invalid arguments\"}";
+
+        if ( options.numThreads > 0 )
+            omp_set_num_threads( options.numThreads );
+        ProcessAll( options, &results );
+        omp_set_num_threads( serverNumThreads );
+    }
+    catch ( const std::exception& e )
+    {
+        omp_set_num_threads( serverNumThreads );
+        LOG_ERR( "Request failed: %s", e.what() );
+        return "{\"success\":false,\"error\":\"" + JsonEscape( e.what() ) + "\"}";
+    }
+
+    bool allSucceeded = true;
+    std::string reply = "{\"jobs\":[";
+    char buffer[256];
+    for ( size_t i = 0; i < results.size(); ++i )
+    {
+        const ProcessResults& job = results[i];
+        allSucceeded = allSucceeded && job.success;
+        snprintf( buffer, sizeof( buffer ), "%s{\"success\":%s,\"totalMs\":%.3f,", i ? "," : "", job.success ? "true" : "false", job.totalTime );
+        reply += buffer;
+        reply += "\"normalMap\":\"" + JsonEscape( job.normalMapPath ) + "\",\"outputs\":[";
+        for ( size_t o = 0; o < job.outputs.size(); ++o )
+        {
+            const ProcessOutput& output = job.outputs[o];
+            reply += ( o ? ",{\"heightMap\":\"" : "{\"heightMap\":\"" ) + JsonEscape( output.heightMapPath ) + "\",";
+            snprintf( buffer, sizeof( buffer ), "\"iterations\":%u,\"generateMs\":%.3f,\"scale\":%g,\"bias\":%g,\"cached\":%s,\"saved\":%s",
+                output.iterations, output.timeToGenerate * 1000.0f, output.scale, output.bias, output.cached ? "true" : "false",
+                output.saved ? "true" : "false" );
+            reply += buffer;
+            if ( options.outputGenNormals || options.compareNormalMethods )
+            {
+                snprintf( buffer, sizeof( buffer ), ",\"normalsPSNR\":%f", output.normalsPSNR );
+                reply += buffer;
+            }
+            reply += "}";
+        }
+        reply += "]}";
+    }
+    snprintf( buffer, sizeof( buffer ), "],\"success\":%s,\"totalMs\":%.3f}", allSucceeded ? "true" : "false", PG::Time::GetTimeSince( startTime ) );
+    reply += buffer;
+
+    return reply;
 }
 
 int main( int argc, char** argv )
@@ -218,7 +1054,20 @@ int main( int argc, char** argv )
     {
         return 0;
     }
-    Process( options );
+    if ( options.writeToStdout )
+    {
+        // stdout only holds the height map, so the log goes to stderr instead
+        Logger_RemoveLogLocation( "stdout" );
+        Logger_AddLogLocation( "stderr", stderr );
+#if USING( WINDOWS_PROGRAM )
+        _setmode( _fileno( stdout ), _O_BINARY );
+#endif
+    }
+    omp_set_num_threads( options.numThreads > 0 ? options.numThreads : omp_get_num_procs() );
+    if ( !options.serverSocketPath.empty() )
+        RunServer( options.serverSocketPath, HandleServerRequest );
+    else
+        ProcessAll( options );
 
     /*
     float slopeScale = 1.0f;
@@ -23,6 +23,11 @@ void GeneratedHeightMap::Pack0To1()
         float h = map.data[i];
         map.data[i] = (h - bias) * invScale;
     }
+    for ( FloatImage2D& mip : mips )
+    {
+        for ( int i = 0; i < mip.width * mip.height; ++i )
+            mip.data[i] = (mip.data[i] - bias) * invScale;
+    }
 }
 
 void GeneratedHeightMap::Unpack0To1()
@@ -32,13 +37,18 @@ void GeneratedHeightMap::Unpack0To1()
         float h = map.data[i];
         map.data[i] = h * scale + minH;
     }
+    for ( FloatImage2D& mip : mips )
+    {
+        for ( int i = 0; i < mip.width * mip.height; ++i )
+            mip.data[i] = mip.data[i] * scale + minH;
+    }
     scale = 1;
     bias = 0;
 }
 
 float GeneratedHeightMap::GetH( int pixelIndex ) const
 {
-    float packed = map.Get( pixelIndex ).x;
+    float packed = map.data[pixelIndex];
     return packed * scale + bias;
 }
 
@@ -65,85 +75,461 @@ vec2 DxDyFromNormal( vec3 normal )
     return dxdy;
 }
 
-void BuildDisplacement( const FloatImage2D& dxdyImg, float* scratchH, float* outputH, uint32_t numIterations, float iterationMultiplier )
+FloatImage2D DxDyImageFromNormalMap( const FloatImage2D& normalMap )
 {
-    int width = dxdyImg.width;
-    int height = dxdyImg.height;
-    if ( width == 1 || height == 1 )
+    FloatImage2D dxdyImg = FloatImage2D( normalMap.width, normalMap.height, 2, ImageAllocFlags::UNINITIALIZED );
+    ImageView<const float, 3> normals = normalMap.View<3>();
+    ImageView<float, 2> dxdy = dxdyImg.View<2>();
+    vec2 invSize = { 1.0f / normalMap.width, 1.0f / normalMap.height };
+    #pragma omp parallel for if ( normalMap.width * normalMap.height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+    for ( int row = 0; row < normalMap.height; ++row )
     {
-        memset( outputH, 0, width * height * sizeof( float ) );
-        return;
+        for ( int col = 0; col < normalMap.width; ++col )
+            dxdy.Set( row, col, DxDyFromNormal( normals.Get( row, col ) ) * invSize );
     }
-    else
+
+    return dxdyImg;
+}
+
+void CompleteHeightMapMips( GeneratedHeightMap& heightMap, HeightMipMode mipMode )
+{
+    if ( mipMode == HeightMipMode::GENERATE )
     {
-        int halfW = Max( width / 2, 1 );
-        int halfH = Max( height / 2, 1 );
-        FloatImage2D halfDxDyImg = dxdyImg.Resize( halfW, halfH );
-        float scaleX = width / static_cast<float>( halfW );
-        float scaleY = height / static_cast<float>( halfH );
-        vec2 scales = vec2( scaleX, scaleY );
-        // update the slopes, to account for each texel having a bigger footprint now.
-        // Aka, re-correcting 'invSize' from the original 'DxDyFromNormal( normal ) * invSize' in mip0
-        for ( int i = 0; i < halfW * halfH; ++i )
-            halfDxDyImg.Set( i, scales * vec2( halfDxDyImg.Get( i ) ) );
+        heightMap.mips = GenerateMipmaps( heightMap.map, MipmapGenerationSettings{} );
+        heightMap.mips.erase( heightMap.mips.begin() );
+    }
+    else if ( mipMode == HeightMipMode::SOLVER )
+    {
+        uint32_t numMips = CalculateNumMips( heightMap.map.width, heightMap.map.height );
+        while ( heightMap.mips.size() + 1 < numMips )
+        {
+            const FloatImage2D& last = heightMap.mips.empty() ? heightMap.map : heightMap.mips.back();
+            heightMap.mips.push_back( DownsampleBox2x2( last ) );
+        }
+    }
+}
+
+void SaveCoarseHeightSolution( std::vector<FloatImage2D>* coarseMips, uint32_t mipLevel, const float* h, int width, int height )
+{
+    if ( !coarseMips || mipLevel == 0 )
+        return;
 
+    if ( coarseMips->size() < mipLevel )
+        coarseMips->resize( mipLevel );
+    FloatImage2D& mip = ( *coarseMips )[mipLevel - 1];
+    mip               = FloatImage2D( width, height, 1, ImageAllocFlags::UNINITIALIZED );
+    memcpy( mip.data.get(), h, width * height * sizeof( float ) );
+}
 
-        BuildDisplacement( halfDxDyImg, scratchH, outputH, numIterations, 2 * iterationMultiplier );
+std::vector<FloatImage2D> BuildDxDyPyramid( const FloatImage2D& dxdyImg )
+{
+    // the solvers stop recursing once either dimension hits 1
+    uint32_t numLevels = 1;
+    while ( ( dxdyImg.width >> ( numLevels - 1 ) ) > 1 && ( dxdyImg.height >> ( numLevels - 1 ) ) > 1 )
+        ++numLevels;
 
-        stbir_resize_float_generic( outputH, halfW, halfH, 0, scratchH, width, height, 0,
-            1, -1, 0, STBIR_EDGE_WRAP, STBIR_FILTER_BOX, STBIR_COLORSPACE_LINEAR, NULL );
-    }
-    
-    float* cur = scratchH;
-    float* next = outputH;
-    numIterations = static_cast<uint32_t>( Min( 1.0f, iterationMultiplier ) * numIterations );
-    numIterations += numIterations % 2; // ensure odd number
-    
-    for ( uint32_t iter = 0; iter < numIterations; ++iter )
+    std::vector<FloatImage2D> pyramid = AllocateMipChain( dxdyImg.width, dxdyImg.height, 2, 1, numLevels, ImageAllocFlags::UNINITIALIZED );
+    pyramid.insert( pyramid.begin(), dxdyImg );
+    for ( uint32_t mipLevel = 1; mipLevel < numLevels; ++mipLevel )
     {
-        #pragma omp parallel for
-        for ( int row = 0; row < height; ++row )
+        const FloatImage2D& src = pyramid[mipLevel - 1];
+        FloatImage2D& dst       = pyramid[mipLevel];
+        DownsampleBox2x2( src, dst );
+
+        // update the slopes, to account for each texel having a bigger footprint now.
+        // Aka, re-correcting 'invSize' from the original 'DxDyFromNormal( normal ) * invSize' in mip0
+        float scaleX = src.width / static_cast<float>( dst.width );
+        float scaleY = src.height / static_cast<float>( dst.height );
+        ImageView<float, 2> dxdy = dst.View<2>();
+        #pragma omp parallel for if ( dst.width * dst.height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+        for ( int row = 0; row < dst.height; ++row )
         {
-            float localDiff = 0;
-            int up = Wrap( row - 1, height );
-            int down = Wrap( row + 1, height );
-            
-            for ( int col = 0; col < width; ++col )
+            float* p = dxdy.Row( row );
+            for ( int col = 0; col < dst.width; ++col, p += 2 )
             {
-                int left = Wrap( col - 1, width );
-                int right = Wrap( col + 1, width );
-                
-                float h = 0;
-                h += cur[left  + row  * width]  + 0.5f * dxdyImg.Get( row, left ).x;
-                h += cur[right + row  * width]  - 0.5f * dxdyImg.Get( row, right ).x;
-                h += cur[col   + up   * width]  + 0.5f * dxdyImg.Get( up, col ).y;
-                h += cur[col   + down * width]  - 0.5f * dxdyImg.Get( down, col ).y;
-                
-                next[col + row * width] = h / 4;
+                p[0] *= scaleX;
+                p[1] *= scaleY;
             }
         }
+    }
+
+    return pyramid;
+}
+
+std::vector<ProlongationTap> CalcProlongationTaps( int coarseSize, int fineSize )
+{
+    std::vector<ProlongationTap> taps( fineSize );
+    double scale = coarseSize / (double)fineSize;
+    for ( int i = 0; i < fineSize; ++i )
+    {
+        // Fine texel i covers [a, b] in coarse texels. Average the parabola that has the same averages as the 3 closest
+        // coarse texels over that range, relative to the center of the middle one
+        double a  = i * scale;
+        double b  = ( i + 1 ) * scale;
+        int mid   = Min( (int)( ( a + b ) / 2 ), coarseSize - 1 );
+        a        -= mid + 0.5;
+        b        -= mid + 0.5;
+        double meanT  = ( a + b ) / 2;
+        double meanT2 = ( a * a + a * b + b * b ) / 3;
+        double curve  = meanT2 / 2 - 1.0 / 24;
+
+        ProlongationTap& t = taps[i];
+        t.index[0]  = Wrap( mid - 1, coarseSize );
+        t.index[1]  = mid;
+        t.index[2]  = Wrap( mid + 1, coarseSize );
+        t.weight[0] = (float)( -meanT / 2 + curve );
+        t.weight[1] = (float)( 1 - 2 * curve );
+        t.weight[2] = (float)( meanT / 2 + curve );
+    }
+
+    return taps;
+}
 
-        std::swap( cur, next );
+void ProlongRow( const float* coarseH, int coarseWidth, const ProlongationTap& rowTap, const std::vector<ProlongationTap>& colTaps, float* dst )
+{
+    const float* r0 = coarseH + (size_t)rowTap.index[0] * coarseWidth;
+    const float* r1 = coarseH + (size_t)rowTap.index[1] * coarseWidth;
+    const float* r2 = coarseH + (size_t)rowTap.index[2] * coarseWidth;
+    int width       = (int)colTaps.size();
+    for ( int col = 0; col < width; ++col )
+    {
+        const ProlongationTap& t = colTaps[col];
+        float h0 = t.weight[0] * r0[t.index[0]] + t.weight[1] * r0[t.index[1]] + t.weight[2] * r0[t.index[2]];
+        float h1 = t.weight[0] * r1[t.index[0]] + t.weight[1] * r1[t.index[1]] + t.weight[2] * r1[t.index[2]];
+        float h2 = t.weight[0] * r2[t.index[0]] + t.weight[1] * r2[t.index[1]] + t.weight[2] * r2[t.index[2]];
+        dst[col] = rowTap.weight[0] * h0 + rowTap.weight[1] * h1 + rowTap.weight[2] * h2;
     }
 }
 
-GenerationResults GetHeightMapFromNormalMap( const FloatImage2D& normalMap, uint32_t iterations, float iterationMultiplier )
+SweepScheduler::SweepScheduler( const std::vector<uint64_t>& inLevelSizes, uint32_t iterations, float iterationMultiplier,
+    const RelaxationControls& controls, PG::Time::Point inStartTime )
+    : adaptive( controls.adaptive ), workBudget( controls.workBudget ), timeBudgetMs( controls.timeBudgetMs ), startTime( inStartTime ),
+      onProgress( controls.onProgress ), progressInterval( controls.progressInterval ), cancel( controls.cancel ), levelSizes( inLevelSizes )
 {
-    GenerationResults returnData;
-    returnData.heightMap = GeneratedHeightMap( normalMap.width, normalMap.height );
+    uint32_t numLevels = (uint32_t)levelSizes.size();
+    fixedSweeps.resize( numLevels, 0 );
+    levelSweeps.resize( numLevels, 0 );
+    uint64_t fixedWork = 0;
+    for ( uint32_t mipLevel = 0; mipLevel + 1 < numLevels; ++mipLevel )
+    {
+        uint32_t sweeps = static_cast<uint32_t>( Min( 1.0f, iterationMultiplier ) * iterations );
+        sweeps += sweeps % 2; // ensure even number, so the last sweep writes into outputH
+        fixedSweeps[mipLevel] = Max( sweeps, 2u ); // the fused prolongation is always the first sweep
+        fixedWork += fixedSweeps[mipLevel] * levelSizes[mipLevel];
+        iterationMultiplier *= 2;
+    }
 
-    auto startTime = PG::Time::GetTimePoint();
+    if ( workBudget == 0 )
+        workBudget = fixedWork;
 
-    FloatImage2D dxdyImg = FloatImage2D( normalMap.width, normalMap.height, 2 );
-    vec2 invSize = { 1.0f / normalMap.width, 1.0f / normalMap.height };
-    for ( int i = 0; i < normalMap.width * normalMap.height; ++i )
+    // Everything since startTime (mostly computing the slopes and their pyramid) was a few passes over every level, which is an
+    // upper bound on what upsampling them costs, until the sweeps themselves can be timed. See HasTimeForSweep
+    uint64_t totalPixels = 0;
+    for ( uint64_t levelSize : levelSizes )
+        totalPixels += levelSize;
+    msPerUpsampledPixel = PG::Time::GetTimeSince( startTime ) / totalPixels;
+    lastSweepTime       = PG::Time::GetTimePoint();
+}
+
+uint32_t SweepScheduler::MaxSweeps( uint32_t mipLevel ) const
+{
+    if ( !adaptive )
+        return fixedSweeps[mipLevel];
+
+    uint64_t reserved = 0;
+    for ( uint32_t finerLevel = 0; finerLevel < mipLevel; ++finerLevel )
+        reserved += 2 * levelSizes[finerLevel];
+
+    uint64_t used      = pixelUpdates + reserved;
+    uint64_t available = workBudget > used ? workBudget - used : 0;
+    // leave at least half of it for the finer levels, in case this one is slow to converge
+    if ( mipLevel > 0 )
+        available /= 2;
+    uint32_t sweeps    = (uint32_t)Min<uint64_t>( MAX_ADAPTIVE_SWEEPS, available / levelSizes[mipLevel] );
+    sweeps            -= sweeps % 2;
+    return Max( sweeps, 2u );
+}
+
+bool SweepScheduler::ShouldContinue( uint32_t mipLevel, const std::vector<double>& residuals ) const
+{
+    size_t numSweeps = residuals.size();
+    if ( numSweeps < MIN_ADAPTIVE_SWEEPS )
+        return true;
+
+    // converged as far as floats allow
+    double residual = residuals[numSweeps - 1];
+    if ( residual <= 1e-6 * residuals[0] )
+        return false;
+
+    double reduction = 1.0 - residual / residuals[numSweeps - 3];
+    double threshold = ADAPTIVE_MIN_REDUCTION * pow( levelSizes[mipLevel] / (double)levelSizes[0], ADAPTIVE_COST_EXPONENT );
+    return reduction >= threshold;
+}
+
+bool SweepScheduler::HasTimeForSweep( uint32_t mipLevel, uint32_t sweepsDone )
+{
+    if ( timeBudgetMs <= 0 )
+        return true;
+    if ( outOfTime )
+        return false;
+
+    PG::Time::Point now = PG::Time::GetTimePoint();
+    double sweepMs      = PG::Time::GetElapsedTime( lastSweepTime, now );
+    double elapsedMs    = PG::Time::GetElapsedTime( startTime, now );
+    lastSweepTime       = now;
+    uint64_t finerPixels = 0;
+    for ( uint32_t finerLevel = 0; finerLevel < mipLevel; ++finerLevel )
+        finerPixels += levelSizes[finerLevel];
+
+    if ( sweepsDone == 1 )
+    {
+        // The first sweep is the one that also upsamples, so it's the best estimate of what the upsampling of the finer levels will
+        // cost. It gets more accurate as the levels get bigger, and the fixed costs of each sweep matter less
+        msPerUpsampledPixel = Min( msPerUpsampledPixel, sweepMs / levelSizes[mipLevel] );
+
+        // Like the adaptive work budget, every coarse level only gets half of the time that's left, so that most of it goes to the
+        // finest levels, that make the biggest difference
+        double levelStartMs = elapsedMs - sweepMs;
+        double levelMs      = timeBudgetMs - levelStartMs - finerPixels * msPerUpsampledPixel;
+        levelEndMs          = levelStartMs + ( mipLevel > 0 ? levelMs / 2 : levelMs );
+    }
+
+    // predict the next sweep from the last one
+    if ( elapsedMs + sweepMs + finerPixels * msPerUpsampledPixel > timeBudgetMs )
+    {
+        outOfTime      = true;
+        outOfTimeLevel = mipLevel;
+        return false;
+    }
+
+    return elapsedMs + sweepMs <= levelEndMs;
+}
+
+void SweepScheduler::FinishLevel( uint32_t mipLevel, uint32_t sweeps )
+{
+    levelSweeps[mipLevel] = sweeps;
+    pixelUpdates         += sweeps * levelSizes[mipLevel];
+    lastSweepTime         = PG::Time::GetTimePoint();
+}
+
+bool SweepScheduler::IsCancelled()
+{
+    cancelled = cancelled || ( cancel && cancel->load( std::memory_order_relaxed ) );
+    return cancelled;
+}
+
+void SweepScheduler::ReportProgress( uint32_t mipLevel, uint32_t sweeps, const float* h, int width, int height, bool levelFinished ) const
+{
+    if ( !onProgress )
+        return;
+
+    SolverProgress progress;
+    progress.heights       = ImageView<const float, 1>( h, width, height );
+    progress.mipLevel      = mipLevel;
+    progress.numMipLevels  = (uint32_t)levelSizes.size();
+    progress.sweeps        = sweeps;
+    progress.levelFinished = levelFinished;
+    onProgress( progress );
+}
+
+void SweepScheduler::SetupCheckpoints( const CheckpointControls& checkpoints, const std::vector<FloatImage2D>& dxdyPyramid,
+    std::vector<FloatImage2D>* inCoarseMips )
+{
+    onCheckpoint       = checkpoints.onCheckpoint;
+    checkpointInterval = checkpoints.interval;
+    lastCheckpointTime = PG::Time::GetTimePoint();
+    coarseMips         = inCoarseMips;
+
+    const SolverCheckpoint* resume = checkpoints.resumeFrom;
+    if ( !resume )
+        return;
+
+    uint32_t numLevels = (uint32_t)dxdyPyramid.size();
+    bool valid         = resume->mipLevel + 1 < numLevels && resume->sweeps > 0 && resume->levelSweeps.size() == numLevels;
+    valid              = valid && resume->heights.width == dxdyPyramid[resume->mipLevel].width &&
+                         resume->heights.height == dxdyPyramid[resume->mipLevel].height && resume->heights.numChannels == 1;
+    valid              = valid && ( !coarseMips || resume->coarseMips.size() + 1 == numLevels );
+    if ( !valid )
+    {
+        LOG_WARN( "The checkpoint doesn't match this solve. Starting from scratch" );
+        return;
+    }
+
+    resumeFrom   = resume;
+    levelSweeps  = resume->levelSweeps;
+    pixelUpdates = resume->pixelUpdates;
+    if ( coarseMips )
+        *coarseMips = resume->coarseMips;
+}
+
+const SolverCheckpoint* SweepScheduler::ResumeLevel( uint32_t mipLevel )
+{
+    if ( !ResumesAt( mipLevel ) )
+        return nullptr;
+
+    const SolverCheckpoint* resume = resumeFrom;
+    resumeFrom                     = nullptr;
+    return resume;
+}
+
+void SweepScheduler::CheckpointIfDue( uint32_t mipLevel, uint32_t sweeps, const float* h, int width, int height,
+    const std::vector<double>& residuals )
+{
+    if ( !onCheckpoint || PG::Time::GetTimeSince( lastCheckpointTime ) < checkpointInterval * 1000.0 )
+        return;
+
+    SolverCheckpoint checkpoint;
+    checkpoint.mipLevel     = mipLevel;
+    checkpoint.sweeps       = sweeps;
+    checkpoint.heights      = FloatImage2D( width, height, 1, const_cast<float*>( h ) );
+    checkpoint.levelSweeps  = levelSweeps;
+    checkpoint.pixelUpdates = pixelUpdates;
+    checkpoint.residuals    = residuals;
+    if ( coarseMips )
+        checkpoint.coarseMips = *coarseMips;
+    onCheckpoint( checkpoint );
+
+    // the interval starts after the checkpoint is written, so a slow write can't take over the whole solve
+    lastCheckpointTime = PG::Time::GetTimePoint();
+}
+
+void SweepScheduler::SetupWarmStart( const RelaxationControls& controls, const std::vector<FloatImage2D>& dxdyPyramid )
+{
+    residualTolerance = controls.residualTolerance / dxdyPyramid[0].width; // heights are in units of the image width
+    const GeneratedHeightMap* warm = controls.warmStart;
+    if ( !warm )
+        return;
+
+    bool valid = warm->scale == 1 && warm->bias == 0 && warm->mips.size() + 1 >= dxdyPyramid.size();
+    for ( size_t mipLevel = 0; mipLevel < dxdyPyramid.size() && valid; ++mipLevel )
+    {
+        const FloatImage2D& level = mipLevel == 0 ? warm->map : warm->mips[mipLevel - 1];
+        valid = level.width == dxdyPyramid[mipLevel].width && level.height == dxdyPyramid[mipLevel].height && level.numChannels == 1;
+    }
+    if ( !valid )
+    {
+        LOG_WARN( "The warm start height map doesn't match this solve (or is packed, or has no solver mips). Starting from scratch" );
+        return;
+    }
+
+    warmStart = warm;
+}
+
+const float* SweepScheduler::PrepareWarmStart( uint32_t mipLevel, float* coarseH ) const
+{
+    if ( !warmStart )
+        return nullptr;
+
+    const FloatImage2D& coarseWarm = warmStart->mips[mipLevel];
+    int numCoarse                  = coarseWarm.width * coarseWarm.height;
+    for ( int i = 0; i < numCoarse; ++i )
+        coarseH[i] -= coarseWarm.data[i];
+
+    return mipLevel == 0 ? warmStart->map.data.get() : warmStart->mips[mipLevel - 1].data.get();
+}
+
+void SweepScheduler::GetResults( GenerationResults& results ) const
+{
+    results.levelSweeps      = levelSweeps;
+    results.pixelUpdates     = pixelUpdates;
+    results.outOfTime        = outOfTime;
+    results.achievedMipLevel = outOfTime ? outOfTimeLevel : 0;
+    results.cancelled        = cancelled;
+}
+
+std::vector<uint64_t> GetSolverLevelSizes( const std::vector<FloatImage2D>& dxdyPyramid )
+{
+    std::vector<uint64_t> levelSizes;
+    for ( const FloatImage2D& level : dxdyPyramid )
+        levelSizes.push_back( (uint64_t)level.width * level.height );
+
+    return levelSizes;
+}
+
+// One jacobi update of every texel in 'row', given the current heights of it and the rows above and below it (wrapped).
+// Returns the sum of the squared updates if MeasureResidual. The first and last columns are the only ones that wrap, so they're
+// done separately, which leaves the rest of the row without any wrapping and lets it vectorize
+template <bool MeasureResidual, bool PowerOfTwo>
+static float RelaxRow( ImageView<const float, 2> dxdy, int row, const float* hUp, const float* hMid, const float* hDown, float* next )
+{
+    int width  = dxdy.width;
+    int height = dxdy.height;
+    const float* dxdyMid  = dxdy.Row( row );
+    const float* dxdyUp   = dxdy.Row( WrapTexel<PowerOfTwo>( row - 1, height ) );
+    const float* dxdyDown = dxdy.Row( WrapTexel<PowerOfTwo>( row + 1, height ) );
+
+    float residual = 0;
+    auto RelaxTexel = [&]( int col, int left, int right )
+    {
+        float h = 0;
+        h += hMid[left]  + 0.5f * dxdyMid[2 * left];
+        h += hMid[right] - 0.5f * dxdyMid[2 * right];
+        h += hUp[col]    + 0.5f * dxdyUp[2 * col + 1];
+        h += hDown[col]  - 0.5f * dxdyDown[2 * col + 1];
+
+        next[col] = h / 4;
+        if constexpr ( MeasureResidual )
+            residual += ( next[col] - hMid[col] ) * ( next[col] - hMid[col] );
+    };
+
+    // the solver never relaxes levels that are only 1 texel wide
+    RelaxTexel( 0, width - 1, WrapTexel<PowerOfTwo>( 1, width ) );
+    for ( int col = 1; col < width - 1; ++col )
+        RelaxTexel( col, col - 1, col + 1 );
+    RelaxTexel( width - 1, width - 2, 0 );
+
+    return residual;
+}
+
+void BuildDisplacement( const std::vector<FloatImage2D>& dxdyPyramid, float* scratchH, float* outputH, SweepScheduler& scheduler,
+    std::vector<FloatImage2D>* coarseMips = nullptr, uint32_t mipLevel = 0 )
+{
+    const FloatImage2D& dxdyImg = dxdyPyramid[mipLevel];
+    int width = dxdyImg.width;
+    int height = dxdyImg.height;
+    if ( width == 1 || height == 1 )
     {
-        vec3 normal = normalMap.Get( i );
-        dxdyImg.Set( i, DxDyFromNormal( normal ) * invSize );
+        memset( outputH, 0, width * height * sizeof( float ) );
+        SaveCoarseHeightSolution( coarseMips, mipLevel, outputH, width, height );
+        return;
     }
 
-    FloatImage2D scratchH = FloatImage2D( normalMap.width, normalMap.height, 1 );
-    BuildDisplacement( dxdyImg, scratchH.data.get(), returnData.heightMap.map.data.get(), iterations, iterationMultiplier );
+    if ( !scheduler.ResumesAt( mipLevel ) )
+        BuildDisplacement( dxdyPyramid, scratchH, outputH, scheduler, coarseMips, mipLevel + 1 );
+
+    ImageView<const float, 2> dxdy = dxdyImg.View<2>();
+    DispatchPowerOfTwo( width, height, [&]( auto powerOfTwo )
+    {
+        RelaxLevel( scheduler, mipLevel, width, height, scratchH, outputH,
+            [&]( auto measureResidual, int row, const float* hUp, const float* hMid, const float* hDown, float* nextRow )
+            {
+                return RelaxRow<measureResidual, powerOfTwo>( dxdy, row, hUp, hMid, hDown, nextRow );
+            } );
+    } );
+
+    SaveCoarseHeightSolution( coarseMips, mipLevel, outputH, width, height );
+}
+
+GenerationResults GetHeightMapFromNormalMap( const FloatImage2D& normalMap, uint32_t iterations, float iterationMultiplier, HeightMipMode mipMode,
+    float* outputH, const RelaxationControls& controls )
+{
+    GenerationResults returnData;
+    returnData.heightMap = GeneratedHeightMap( normalMap.width, normalMap.height, outputH );
+
+    auto startTime = PG::Time::GetTimePoint();
+
+    std::vector<FloatImage2D> dxdyPyramid = BuildDxDyPyramid( DxDyImageFromNormalMap( normalMap ) );
+
+    // every level writes its upsampled starting point into scratchH before reading it
+    FloatImage2D scratchH = FloatImage2D( normalMap.width, normalMap.height, 1, ImageAllocFlags::UNINITIALIZED );
+    std::vector<FloatImage2D>* coarseMips = mipMode == HeightMipMode::SOLVER ? &returnData.heightMap.mips : nullptr;
+    SweepScheduler scheduler( GetSolverLevelSizes( dxdyPyramid ), iterations, iterationMultiplier, controls, startTime );
+    scheduler.SetupCheckpoints( controls.checkpoints, dxdyPyramid, coarseMips );
+    scheduler.SetupWarmStart( controls, dxdyPyramid );
+    BuildDisplacement( dxdyPyramid, scratchH.data.get(), returnData.heightMap.map.data.get(), scheduler, coarseMips );
+    scheduler.GetResults( returnData );
+    if ( !returnData.cancelled )
+        CompleteHeightMapMips( returnData.heightMap, mipMode );
 
     auto stopTime = PG::Time::GetTimePoint();
 
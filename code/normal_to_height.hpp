@@ -3,7 +3,13 @@
 #include "image.hpp"
 #include "shared/logger.hpp"
 #include "shared/time.hpp"
-#include "stb/stb_image_resize.h"
+#include <cfloat>
+#include <cmath>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <utility>
 
 enum class HeightGenMethod
 {
@@ -15,15 +21,26 @@ enum class HeightGenMethod
     DEFAULT = RELAXATION
 };
 
+enum class HeightMipMode
+{
+    NONE     = 0,
+    GENERATE = 1, // box filter the final height map with GenerateMipmaps
+    SOLVER   = 2, // reuse the solver's own solutions from each of the coarser levels. Only applicable to HeightGenMethod::RELAXATION*
+
+    COUNT = 3
+};
+
 struct GeneratedHeightMap
 {
     GeneratedHeightMap() = default;
-    GeneratedHeightMap( int width, int height )
+    // srcData: optional caller-owned storage (width * height floats) for 'map', instead of allocating it
+    GeneratedHeightMap( int width, int height, float* srcData = nullptr )
     {
-        map = FloatImage2D( width, height, 1 );
+        map = srcData ? FloatImage2D( width, height, 1, srcData ) : FloatImage2D( width, height, 1 );
     }
 
     FloatImage2D map;
+    std::vector<FloatImage2D> mips; // optional. Mip 1 and smaller, mip 0 is just 'map'. Packed/unpacked along with 'map'
     float minH = FLT_MAX;
     float maxH = -FLT_MAX;
     float scale = 1;
@@ -44,8 +61,91 @@ struct GenerationResults
 
     // the parmeters below are only available when using heightGenMethod == LINEAR_SYSTEM
     float solverError;
+
+    // the parmeters below are only available when using heightGenMethod == RELAXATION*
+    std::vector<uint32_t> levelSweeps; // how many sweeps each level of the solver did, mip 0 first
+    uint64_t pixelUpdates = 0;         // total work of all of those sweeps
+    // The level that RelaxationControls::timeBudgetMs ran out on. The finer levels only got the single sweep that upsamples into
+    // them, so the height map is essentially that level's solution, upsampled to full resolution
+    uint32_t achievedMipLevel = 0;
+    bool outOfTime = false; // if the time budget cut any level short
+    bool cancelled = false; // if RelaxationControls::cancel stopped it. The height map is incomplete garbage in that case
+};
+
+// What RelaxationControls::onProgress gets to see
+struct SolverProgress
+{
+    ImageView<const float, 1> heights; // the current solution of mipLevel. Only valid during the callback
+    uint32_t mipLevel;
+    uint32_t numMipLevels; // of the solver, including the 1 texel wide/high level that never gets any sweeps
+    uint32_t sweeps;       // done on mipLevel so far
+    bool levelFinished;
+};
+
+// Everything needed to continue a solve from part way through it. See CheckpointControls and solver_checkpoint.hpp
+struct SolverCheckpoint
+{
+    uint32_t mipLevel = 0; // the solver level that 'heights' is the current solution of. Always 0 for LINEAR_SYSTEM
+    uint32_t sweeps   = 0; // how many sweeps (or linear solver iterations) of mipLevel are done
+    FloatImage2D heights;
+
+    // RELAXATION* only
+    std::vector<uint32_t> levelSweeps;    // of the finished coarser levels
+    uint64_t pixelUpdates = 0;
+    std::vector<double> residuals;        // adaptive only, of each sweep of mipLevel so far
+    std::vector<FloatImage2D> coarseMips; // HeightMipMode::SOLVER only. The finished coarser levels (the finer ones are empty)
+};
+
+struct CheckpointControls
+{
+    // Optional. Called with the current state of the solve about every 'interval' seconds, in between sweeps. The checkpoint
+    // points straight into the solver's buffers, so it's only valid during the call
+    std::function<void( const SolverCheckpoint& checkpoint )> onCheckpoint;
+    float interval = 60;
+
+    // Optional. A checkpoint of the exact same solve (same normal map and settings) to continue from, which gives the same result as
+    // if it was never stopped. Ignored, with a warning, if it doesn't match the solve
+    const SolverCheckpoint* resumeFrom = nullptr;
+};
+
+// Optional controls for the RELAXATION* solvers
+struct RelaxationControls
+{
+    // Instead of the fixed 'iterations' and 'iterationMultiplier' schedule, measure how fast each level is converging, and move on
+    // to the next level once it stops paying off. See SweepScheduler
+    bool adaptive = false;
+    uint64_t workBudget = 0; // adaptive only, in pixel updates. 0 == the total work of the fixed schedule
+
+    // "Anytime" mode: if > 0, stop relaxing once the whole generation would take longer than this many milliseconds, and upsample
+    // the current (coarser) solution the rest of the way to full resolution instead. Applies on top of either schedule.
+    // Best effort: the setup before the solve, and the upsampling itself, are never skipped
+    float timeBudgetMs = 0;
+
+    // Optional. The unpacked result of solving a similar normal map of the same size (like the previous frame of an animation) with
+    // HeightMipMode::SOLVER, so that it has the solution of every level. Each level then starts from that level's solution, plus
+    // the upsampled change of the coarser level, instead of from the coarser level alone. Ignored, with a warning, if it doesn't
+    // match the solve. The warm start has to come from the same HeightGenMethod
+    const GeneratedHeightMap* warmStart = nullptr;
+
+    // If > 0, each level stops once the RMS height update of a sweep drops to this many mip 0 texels, even if its schedule has
+    // sweeps left. Mostly useful with warmStart, where the levels of a nearly identical normal map start out close to converged
+    float residualTolerance = 0;
+
+    // Optional observer, called once each level is finished, and every progressInterval sweeps during a level (0 == never).
+    // It runs on the calling thread in between sweeps, so the solver waits on it
+    std::function<void( const SolverProgress& progress )> onProgress;
+    uint32_t progressInterval = 0;
+
+    // Optional. Checked between sweeps. Once it's true, the solver stops as soon as possible and returns with
+    // GenerationResults::cancelled set. Can be set from any thread, including from onProgress
+    const std::atomic<bool>* cancel = nullptr;
+
+    CheckpointControls checkpoints;
 };
 
+// Below this, the OpenMP fork/join for each relaxation sweep costs more than the sweep itself
+constexpr int MIN_PIXELS_FOR_PARALLEL_SWEEP = 128 * 128;
+
 static inline int Wrap( int v, int maxVal )
 {
     if ( v < 0 ) return v + maxVal;
@@ -53,6 +153,285 @@ static inline int Wrap( int v, int maxVal )
     else return v;
 }
 
+static inline bool IsPowerOfTwo( int v ) { return v > 0 && ( v & ( v - 1 ) ) == 0; }
+
+// Wrap, specialized for sizes that are a power of two, where wrapping is a single mask. That also handles the v +/- 2 that the
+// ACCURATE normals need, which the general version does with a modulo
+template <bool PowerOfTwo>
+static inline int WrapTexel( int v, int size )
+{
+    if constexpr ( PowerOfTwo ) return v & ( size - 1 );
+    else return Wrap( v, size );
+}
+
+// Calls func( std::true_type ) if width and height are both powers of two, and func( std::false_type ) otherwise, so that a kernel
+// can be compiled once for each, and picked at runtime
+template <typename Func>
+static inline decltype( auto ) DispatchPowerOfTwo( int width, int height, Func&& func )
+{
+    if ( IsPowerOfTwo( width ) && IsPowerOfTwo( height ) )
+        return func( std::true_type{} );
+    return func( std::false_type{} );
+}
+
+// The 3 (wrapped) coarse texels, and their weights, that a fine texel is interpolated from along one axis
+struct ProlongationTap
+{
+    int index[3];
+    float weight[3];
+};
+
+// Piecewise quadratic interpolation that preserves the coarse texel averages, so each 2x2 block of the upsample keeps the mean of its
+// coarse texel, like the box filtered slopes it was solved from. Plain bilinear blurs those means, and ends up as a worse starting point
+// than even nearest neighbor
+std::vector<ProlongationTap> CalcProlongationTaps( int coarseSize, int fineSize );
+
+// Writes one row of the wrapping upsample of coarseH (coarseWidth texels wide) into dst
+void ProlongRow( const float* coarseH, int coarseWidth, const ProlongationTap& rowTap, const std::vector<ProlongationTap>& colTaps, float* dst );
+
+// Does the first relaxation sweep of a level straight from the coarser level's solution. Each thread upsamples rows into a small
+// ring of 3 rows as it walks down its block, so the upsampled image is never written out and read back in.
+// relaxRow( measureResidual, row, hUp, hMid, hDown, nextRow ) relaxes a single row, given the current heights of it and the rows
+// around it. If measureResidual (a std::bool_constant, so the measuring can be compiled out) is true, it returns the sum of the squared
+// height updates of the row, which get written to rowResiduals[row]
+// baseH: optional heights of this level, that the upsample gets added to (see SweepScheduler::PrepareWarmStart)
+template <typename RelaxRowFunc>
+void ProlongAndRelax( const float* coarseH, int coarseWidth, int coarseHeight, int width, int height, float* next, float* rowResiduals,
+    RelaxRowFunc relaxRow, const float* baseH = nullptr )
+{
+    std::vector<ProlongationTap> colTaps = CalcProlongationTaps( coarseWidth, width );
+    std::vector<ProlongationTap> rowTaps = CalcProlongationTaps( coarseHeight, height );
+    auto Upsample = [&]( int row, float* dst )
+    {
+        ProlongRow( coarseH, coarseWidth, rowTaps[row], colTaps, dst );
+        if ( baseH )
+        {
+            const float* base = baseH + (size_t)row * width;
+            for ( int col = 0; col < width; ++col )
+                dst[col] += base[col];
+        }
+    };
+    #pragma omp parallel if ( width * height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+    {
+        std::vector<float> ring( 3 * width );
+        float* rows[3] = { ring.data(), ring.data() + width, ring.data() + 2 * width }; // up, mid, down
+        int lastRow    = -2;
+        #pragma omp for schedule( static )
+        for ( int row = 0; row < height; ++row )
+        {
+            if ( row == lastRow + 1 )
+            {
+                std::swap( rows[0], rows[1] );
+                std::swap( rows[1], rows[2] );
+                Upsample( Wrap( row + 1, height ), rows[2] );
+            }
+            else
+            {
+                Upsample( Wrap( row - 1, height ), rows[0] );
+                Upsample( row, rows[1] );
+                Upsample( Wrap( row + 1, height ), rows[2] );
+            }
+            lastRow = row;
+            rowResiduals[row] = relaxRow( std::true_type{}, row, rows[0], rows[1], rows[2], next + (size_t)row * width );
+        }
+    }
+}
+
+// Decides how many sweeps each level of the relaxation solvers does.
+// The fixed schedule is 'iterations', scaled by an 'iterationMultiplier' that doubles at every coarser level (capped at 1).
+// The adaptive schedule measures the RMS height update (the jacobi residual) of every sweep, and moves on to the next finer level
+// once a pair of sweeps stops reducing it by ADAPTIVE_MIN_REDUCTION. That threshold is scaled down by the level's cost relative to
+// mip 0 (to the ADAPTIVE_COST_EXPONENT), so the cheap coarse levels converge further before handing off, since whatever low frequency
+// error they leave behind takes the finer levels many more, and more expensive, sweeps to remove. Every coarse level can also only
+// use half of what is left of the work budget, after reserving the minimum 2 sweeps for each of the finer levels.
+// With a time budget, the cost of the last sweep is used to predict if there is time for another one, while still leaving enough time
+// to upsample the result through all of the finer levels. Once there isn't, every remaining level only gets the first sweep, that
+// upsamples into it. Every coarse level can also only use half of the time that is left.
+// With a residual tolerance, any level also stops as soon as a sweep's RMS height update is within it
+struct SweepScheduler
+{
+    static constexpr double ADAPTIVE_MIN_REDUCTION = 0.0125;
+    static constexpr double ADAPTIVE_COST_EXPONENT = 0.75;
+    static constexpr uint32_t MIN_ADAPTIVE_SWEEPS  = 4;
+    static constexpr uint32_t MAX_ADAPTIVE_SWEEPS  = 16384;
+
+    // levelSizes: the width * height of each solver level, mip 0 first (the last one is the 1 pixel wide level, with no sweeps)
+    // startTime: when the generation started, which the time budget is relative to. Construct it right before the first sweep
+    SweepScheduler( const std::vector<uint64_t>& levelSizes, uint32_t iterations, float iterationMultiplier, const RelaxationControls& controls,
+        PG::Time::Point startTime );
+
+    // Always even, and at least 2
+    uint32_t MaxSweeps( uint32_t mipLevel ) const;
+
+    // Adaptive only. residuals[i] is the RMS update of sweep i of the current level. Called after every pair of sweeps
+    bool ShouldContinue( uint32_t mipLevel, const std::vector<double>& residuals ) const;
+
+    // If there is enough of the time budget left for another sweep of this level, after sweepsDone (>= 1) of them. Always true
+    // without a time budget. Called before every sweep after the first
+    bool HasTimeForSweep( uint32_t mipLevel, uint32_t sweepsDone );
+
+    void FinishLevel( uint32_t mipLevel, uint32_t sweeps );
+
+    // Latches the first time RelaxationControls::cancel is seen as true
+    bool IsCancelled();
+
+    // Calls RelaxationControls::onProgress, if there is one
+    void ReportProgress( uint32_t mipLevel, uint32_t sweeps, const float* h, int width, int height, bool levelFinished ) const;
+
+    // Has to be called before the first level. Validates and restores checkpoints.resumeFrom, if there is one.
+    // coarseMips: same as for SaveCoarseHeightSolution
+    void SetupCheckpoints( const CheckpointControls& checkpoints, const std::vector<FloatImage2D>& dxdyPyramid,
+        std::vector<FloatImage2D>* coarseMips );
+
+    // If the solve is being resumed from this level, in which case none of the coarser levels should be solved again
+    bool ResumesAt( uint32_t mipLevel ) const { return resumeFrom && resumeFrom->mipLevel == mipLevel; }
+
+    // The checkpoint to resume this level from, if any. Only returns it once
+    const SolverCheckpoint* ResumeLevel( uint32_t mipLevel );
+
+    // Calls CheckpointControls::onCheckpoint if it's been long enough since the last one. h: the current solution of the level
+    void CheckpointIfDue( uint32_t mipLevel, uint32_t sweeps, const float* h, int width, int height, const std::vector<double>& residuals );
+
+    // Has to be called before the first level. Validates RelaxationControls::warmStart, and converts residualTolerance to height units
+    void SetupWarmStart( const RelaxationControls& controls, const std::vector<FloatImage2D>& dxdyPyramid );
+
+    // If there is a warm start, turns coarseH (the solution of mipLevel + 1) into its change from the warm start's solution of that
+    // level, and returns the warm start's solution of mipLevel, for that change to be upsampled on top of. Otherwise returns nullptr
+    const float* PrepareWarmStart( uint32_t mipLevel, float* coarseH ) const;
+
+    // If the RMS height update of every sweep has to be measured
+    bool MeasuresResiduals() const { return adaptive || residualTolerance > 0; }
+
+    // Fills out the RELAXATION* only members of results
+    void GetResults( GenerationResults& results ) const;
+
+    bool adaptive;
+    uint64_t workBudget;
+    float timeBudgetMs;
+    PG::Time::Point startTime;
+    PG::Time::Point lastSweepTime;
+    double msPerUpsampledPixel;
+    double levelEndMs = 0; // when the current level has to stop, relative to startTime
+    bool outOfTime = false;
+    uint32_t outOfTimeLevel = 0;
+    std::function<void( const SolverProgress& progress )> onProgress;
+    uint32_t progressInterval;
+    const std::atomic<bool>* cancel;
+    bool cancelled = false;
+    std::function<void( const SolverCheckpoint& checkpoint )> onCheckpoint;
+    float checkpointInterval = 0;
+    PG::Time::Point lastCheckpointTime;
+    const SolverCheckpoint* resumeFrom   = nullptr;
+    std::vector<FloatImage2D>* coarseMips = nullptr;
+    const GeneratedHeightMap* warmStart = nullptr;
+    double residualTolerance = 0;
+    uint64_t pixelUpdates = 0;
+    std::vector<uint64_t> levelSizes;
+    std::vector<uint32_t> fixedSweeps;
+    std::vector<uint32_t> levelSweeps; // what each level actually did
+};
+
+// Runs all of the sweeps of one level (width x height), as decided by the scheduler. The solution of the next coarser level has to be
+// in outputH, and the final solution of this level ends up there too. relaxRow is the same as for ProlongAndRelax
+template <typename RelaxRowFunc>
+void RelaxLevel( SweepScheduler& scheduler, uint32_t mipLevel, int width, int height, float* scratchH, float* outputH, RelaxRowFunc relaxRow )
+{
+    if ( scheduler.IsCancelled() )
+        return;
+
+    uint32_t maxSweeps = scheduler.MaxSweeps( mipLevel );
+    std::vector<float> rowResiduals( height );
+    std::vector<double> residuals;
+    uint32_t sweeps = 1;
+    float* cur      = scratchH;
+    float* next     = outputH;
+    auto AddResidual = [&]()
+    {
+        // summed serially, so that the adaptive schedule doesn't depend on the thread count
+        double sum = 0;
+        for ( int row = 0; row < height; ++row )
+            sum += rowResiduals[row];
+        residuals.push_back( sqrt( sum / ( (double)width * height ) ) );
+    };
+
+    if ( const SolverCheckpoint* resume = scheduler.ResumeLevel( mipLevel ) )
+    {
+        memcpy( outputH, resume->heights.data.get(), (size_t)width * height * sizeof( float ) );
+        sweeps    = resume->sweeps;
+        residuals = resume->residuals;
+        std::swap( cur, next );
+    }
+    else
+    {
+        // the coarse solution is in outputH, so the first sweep has to write into scratchH
+        const float* warmH = scheduler.PrepareWarmStart( mipLevel, outputH );
+        ProlongAndRelax( outputH, Max( width / 2, 1 ), Max( height / 2, 1 ), width, height, scratchH, rowResiduals.data(), relaxRow, warmH );
+        if ( scheduler.MeasuresResiduals() )
+            AddResidual();
+    }
+    auto Converged = [&]() { return scheduler.residualTolerance > 0 && !residuals.empty() && residuals.back() <= scheduler.residualTolerance; };
+
+    auto Sweep = [&]( auto measureResidual )
+    {
+        #pragma omp parallel for if ( width * height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+        for ( int row = 0; row < height; ++row )
+        {
+            const float* hUp   = cur + Wrap( row - 1, height ) * width;
+            const float* hDown = cur + Wrap( row + 1, height ) * width;
+            rowResiduals[row]  = relaxRow( measureResidual, row, hUp, cur + row * width, hDown, next + row * width );
+        }
+    };
+
+    while ( sweeps < maxSweeps && !Converged() && scheduler.HasTimeForSweep( mipLevel, sweeps ) && !scheduler.IsCancelled() )
+    {
+        if ( scheduler.MeasuresResiduals() )
+            Sweep( std::true_type{} );
+        else
+            Sweep( std::false_type{} );
+        std::swap( cur, next );
+        ++sweeps;
+
+        if ( scheduler.progressInterval && sweeps % scheduler.progressInterval == 0 && sweeps < maxSweeps )
+            scheduler.ReportProgress( mipLevel, sweeps, cur, width, height, false );
+
+        if ( scheduler.MeasuresResiduals() )
+            AddResidual();
+        if ( scheduler.adaptive && sweeps % 2 == 0 && !scheduler.ShouldContinue( mipLevel, residuals ) )
+            break;
+        scheduler.CheckpointIfDue( mipLevel, sweeps, cur, width, height, residuals );
+    }
+
+    // only possible if the time budget, or the residual tolerance, stopped it early
+    if ( cur != outputH )
+        memcpy( outputH, cur, (size_t)width * height * sizeof( float ) );
+
+    scheduler.FinishLevel( mipLevel, sweeps );
+    if ( !scheduler.cancelled )
+        scheduler.ReportProgress( mipLevel, sweeps, outputH, width, height, true );
+}
+
 vec2 DxDyFromNormal( vec3 normal );
 
-GenerationResults GetHeightMapFromNormalMap( const FloatImage2D& normalMap, uint32_t iterations, float iterationMultiplier = 1.0f );
\ No newline at end of file
+// 2 channel image of DxDyFromNormal( normal ) * invSize for every pixel of the (3 channel) normal map
+FloatImage2D DxDyImageFromNormalMap( const FloatImage2D& normalMap );
+
+// dxdyImg followed by its DownsampleBox2x2'd levels, down to the first level with a dimension of 1 (where the solvers stop recursing).
+// The slopes of each level are rescaled for its bigger texel footprint, so that every level's solution is in mip0 units
+std::vector<FloatImage2D> BuildDxDyPyramid( const FloatImage2D& dxdyImg );
+
+// The width * height of each level of a BuildDxDyPyramid, for SweepScheduler
+std::vector<uint64_t> GetSolverLevelSizes( const std::vector<FloatImage2D>& dxdyPyramid );
+
+// Fills out heightMap.mips for HeightMipMode::GENERATE, or finishes the tail of an incomplete SOLVER chain (non-square images
+// stop recursing once either dimension hits 1)
+void CompleteHeightMapMips( GeneratedHeightMap& heightMap, HeightMipMode mipMode );
+
+// Copies the solution 'h' of the given level into coarseMips[mipLevel - 1] (if coarseMips isn't null, and mipLevel > 0).
+// Since the solutions at each level share the mip0 units (the slopes get rescaled per level), and the wrapping jacobi sweeps
+// preserve the mean height, the coarse solutions can be used directly as the mips of the final height map
+void SaveCoarseHeightSolution( std::vector<FloatImage2D>* coarseMips, uint32_t mipLevel, const float* h, int width, int height );
+
+// outputH: optional caller-owned storage for the height map (normalMap.width * normalMap.height floats). If given, the solver
+// writes the final heights directly into it, and the returned heightMap.map just points to it
+GenerationResults GetHeightMapFromNormalMap( const FloatImage2D& normalMap, uint32_t iterations, float iterationMultiplier = 1.0f,
+    HeightMipMode mipMode = HeightMipMode::NONE, float* outputH = nullptr, const RelaxationControls& controls = {} );
\ No newline at end of file
@@ -0,0 +1,139 @@
+#include "normal_to_height_api.h"
+#include "normal_to_height_experimental.hpp"
+
+static size_t ComponentSize( N2H_ComponentType type )
+{
+    if ( type == N2H_COMPONENT_UNORM8 )
+        return 1;
+    else if ( type == N2H_COMPONENT_UNORM16 )
+        return 2;
+    else if ( type == N2H_COMPONENT_FLOAT32 )
+        return 4;
+
+    return 0;
+}
+
+static ImageFormat GetNormalBufferFormat( const N2H_NormalMapBuffer& buffer )
+{
+    if ( buffer.numChannels < 2 || buffer.numChannels > 4 )
+        return ImageFormat::INVALID;
+
+    ImageFormat base;
+    if ( buffer.componentType == N2H_COMPONENT_UNORM8 )
+        base = ImageFormat::R8_UNORM;
+    else if ( buffer.componentType == N2H_COMPONENT_UNORM16 )
+        base = ImageFormat::R16_UNORM;
+    else if ( buffer.componentType == N2H_COMPONENT_FLOAT32 )
+        base = ImageFormat::R32_FLOAT;
+    else
+        return ImageFormat::INVALID;
+
+    return static_cast<ImageFormat>( Underlying( base ) + buffer.numChannels - 1 );
+}
+
+void N2H_GetDefaultSettings( N2H_Settings* settings )
+{
+    settings->method               = N2H_METHOD_RELAXATION;
+    settings->iterations           = 1024;
+    settings->iterationMultiplier  = 0.25f;
+    settings->slopeScale           = 1.0f;
+    settings->flipX                = 0;
+    settings->flipY                = 0;
+    settings->linearSolveWithGuess = 1;
+    settings->packFloatsTo01       = 0;
+    settings->timeBudgetMs         = 0;
+    settings->progressCallback     = nullptr;
+    settings->progressUserData     = nullptr;
+    settings->progressInterval     = 0;
+}
+
+N2H_Status N2H_GenerateHeightMap( const N2H_NormalMapBuffer* normalMap, const N2H_Settings* settings, const N2H_HeightMapBuffer* heightMap,
+    N2H_Results* results )
+{
+    if ( !normalMap || !heightMap || !heightMap->data || ComponentSize( heightMap->componentType ) == 0 )
+        return N2H_INVALID_ARGUMENT;
+    // the normal map's strides are checked by DecodeNormalMap
+    if ( heightMap->rowStride != 0 && heightMap->rowStride < (size_t)Max( normalMap->width, 0 ) * ComponentSize( heightMap->componentType ) )
+        return N2H_INVALID_ARGUMENT;
+
+    N2H_Settings defaultSettings;
+    if ( !settings )
+    {
+        N2H_GetDefaultSettings( &defaultSettings );
+        settings = &defaultSettings;
+    }
+
+    FloatImage2D normals = DecodeNormalMap( normalMap->data, normalMap->width, normalMap->height, GetNormalBufferFormat( *normalMap ),
+        normalMap->pixelStride, normalMap->rowStride, settings->slopeScale, settings->flipY, settings->flipX );
+    if ( !normals )
+        return N2H_INVALID_ARGUMENT;
+
+    const int width         = normals.width;
+    const int height        = normals.height;
+    const size_t outputSize = ComponentSize( heightMap->componentType );
+    const size_t rowStride  = heightMap->rowStride ? heightMap->rowStride : width * outputSize;
+    const bool solveInPlace = heightMap->componentType == N2H_COMPONENT_FLOAT32 && rowStride == width * sizeof( float );
+    float* outputH          = solveInPlace ? static_cast<float*>( heightMap->data ) : nullptr;
+
+    RelaxationControls controls;
+    controls.timeBudgetMs = settings->timeBudgetMs;
+    std::atomic<bool> cancel = false;
+    if ( settings->progressCallback )
+    {
+        controls.progressInterval = settings->progressInterval;
+        controls.cancel           = &cancel;
+        controls.onProgress       = [&]( const SolverProgress& progress )
+        {
+            const ImageView<const float, 1>& h = progress.heights;
+            if ( settings->progressCallback( h.data, h.width, h.height, progress.mipLevel, progress.sweeps, progress.levelFinished,
+                     settings->progressUserData ) )
+                cancel = true;
+        };
+    }
+
+    GenerationResults result;
+    if ( settings->method == N2H_METHOD_RELAXATION_EDGE_AWARE )
+        result = GetHeightMapFromNormalMap_WithEdges(
+            normals, settings->iterations, settings->iterationMultiplier, HeightMipMode::NONE, outputH, controls );
+    else if ( settings->method == N2H_METHOD_LINEAR_SYSTEM )
+        result = GetHeightMapFromNormalMap_LinearSolve( normals, settings->iterations, settings->linearSolveWithGuess, HeightMipMode::NONE, outputH );
+    else
+        result = GetHeightMapFromNormalMap( normals, settings->iterations, settings->iterationMultiplier, HeightMipMode::NONE, outputH, controls );
+
+    if ( result.cancelled )
+        return N2H_CANCELLED;
+
+    GeneratedHeightMap& generated = result.heightMap;
+    generated.CalcMinMax();
+    if ( results )
+    {
+        results->minHeight        = generated.minH;
+        results->maxHeight        = generated.maxH;
+        results->iterations       = result.iterations;
+        results->timeToGenerate   = result.timeToGenerate;
+        results->achievedMipLevel = result.achievedMipLevel;
+    }
+
+    if ( heightMap->componentType != N2H_COMPONENT_FLOAT32 || settings->packFloatsTo01 )
+        generated.Pack0To1();
+    if ( solveInPlace )
+        return N2H_SUCCESS;
+
+    #pragma omp parallel for
+    for ( int row = 0; row < height; ++row )
+    {
+        const float* src = generated.map.data.get() + row * width;
+        uint8_t* dst     = static_cast<uint8_t*>( heightMap->data ) + row * rowStride;
+        for ( int col = 0; col < width; ++col )
+        {
+            if ( heightMap->componentType == N2H_COMPONENT_UNORM8 )
+                dst[col] = static_cast<uint8_t>( 255.0f * std::clamp( src[col], 0.0f, 1.0f ) + 0.5f );
+            else if ( heightMap->componentType == N2H_COMPONENT_UNORM16 )
+                reinterpret_cast<uint16_t*>( dst )[col] = static_cast<uint16_t>( 65535.0f * std::clamp( src[col], 0.0f, 1.0f ) + 0.5f );
+            else
+                reinterpret_cast<float*>( dst )[col] = src[col];
+        }
+    }
+
+    return N2H_SUCCESS;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+// C API for embedding the height map generation. Every buffer is owned by the caller: normals are read straight out of the
+// caller's (optionally strided) buffer, and the heights are written straight into the caller's height buffer, with no files involved
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum N2H_Status
+{
+    N2H_SUCCESS          = 0,
+    N2H_INVALID_ARGUMENT = 1,
+    N2H_CANCELLED        = 2, // the progress callback asked to stop. The height buffer is left in an undefined state
+} N2H_Status;
+
+typedef enum N2H_ComponentType
+{
+    N2H_COMPONENT_UNORM8  = 0,
+    N2H_COMPONENT_UNORM16 = 1,
+    N2H_COMPONENT_FLOAT32 = 2,
+} N2H_ComponentType;
+
+// Same values as HeightGenMethod
+typedef enum N2H_Method
+{
+    N2H_METHOD_RELAXATION            = 0,
+    N2H_METHOD_RELAXATION_EDGE_AWARE = 1,
+    N2H_METHOD_LINEAR_SYSTEM         = 2,
+} N2H_Method;
+
+typedef struct N2H_NormalMapBuffer
+{
+    const void* data;
+    int width;
+    int height;
+    int numChannels;                 // 2 (XY, Z is reconstructed), 3, or 4 (XYZ, the 4th channel is ignored)
+    N2H_ComponentType componentType; // all types are packed normals in [0, 1], like an image file would have
+    size_t pixelStride;              // bytes between pixels. 0 == numChannels * componentSize. Can't be smaller than a pixel
+    size_t rowStride;                // bytes between rows. 0 == width * pixelStride. Can't be smaller than a row
+} N2H_NormalMapBuffer;
+
+// Must be the same width and height as the normal map. Unorm heights are always packed to [0, 1] (see N2H_Results)
+typedef struct N2H_HeightMapBuffer
+{
+    void* data;
+    N2H_ComponentType componentType;
+    size_t rowStride; // bytes between rows. 0 == width * componentSize. Can't be smaller than a row
+} N2H_HeightMapBuffer;
+
+// Called with the current (unpacked, float) heights of the solver's mipLevel, which are only valid during the call. mipLevel 0 is
+// full resolution. levelFinished is 0 for the in between updates of N2H_Settings::progressInterval. Return non-zero to cancel
+typedef int ( *N2H_ProgressCallback )( const float* heights, int width, int height, uint32_t mipLevel, uint32_t sweeps, int levelFinished,
+    void* userData );
+
+typedef struct N2H_Settings
+{
+    N2H_Method method;
+    uint32_t iterations;
+    float iterationMultiplier; // only applicable to N2H_METHOD_RELAXATION*
+    float slopeScale;
+    int flipX;
+    int flipY;
+    int linearSolveWithGuess; // only applicable to N2H_METHOD_LINEAR_SYSTEM
+    int packFloatsTo01;       // if N2H_COMPONENT_FLOAT32 heights should be packed to [0, 1] like the unorm types are
+    float timeBudgetMs;       // only applicable to N2H_METHOD_RELAXATION*. If > 0, return the best solution so far after about this long
+
+    // Only applicable to N2H_METHOD_RELAXATION*. Optional, called after every mip level of the solver, and every progressInterval
+    // sweeps (0 == only after each level) during one. It runs on the calling thread, in between sweeps
+    N2H_ProgressCallback progressCallback;
+    void* progressUserData;
+    uint32_t progressInterval;
+} N2H_Settings;
+
+typedef struct N2H_Results
+{
+    // the unpacked height range. For packed heights: height = packed * ( maxHeight - minHeight ) + minHeight
+    float minHeight;
+    float maxHeight;
+    uint32_t iterations;
+    float timeToGenerate;      // seconds, solver only
+    uint32_t achievedMipLevel; // the finest mip level the relaxation got to before timeBudgetMs ran out. 0 == full resolution
+} N2H_Results;
+
+// Same defaults as the NormalToHeight command line
+void N2H_GetDefaultSettings( N2H_Settings* settings );
+
+// settings and results can be NULL. Float32 height buffers with no row padding are written to by the solver directly,
+// everything else is converted into the height buffer after the solve
+N2H_Status N2H_GenerateHeightMap( const N2H_NormalMapBuffer* normalMap, const N2H_Settings* settings, const N2H_HeightMapBuffer* heightMap,
+    N2H_Results* results );
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
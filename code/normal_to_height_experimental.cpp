@@ -2,95 +2,90 @@
 #include "Eigen/Dense"
 #include "Eigen/Sparse"
 
-void BuildDisplacement_WithEdges( const FloatImage2D& dxdyImg, const std::vector<FloatImage2D>& edgeImgs, float* scratchH,
-    float* outputH, uint32_t numIterations, float iterationMultiplier, uint32_t mipLevel = 0 )
+// Same as RelaxRow in normal_to_height.cpp, but with each neighbor weighted by how similar its normal is
+template <bool MeasureResidual>
+static float RelaxRow_WithEdges( ImageView<const float, 2> dxdy, ImageView<const float, 4> edges, uint32_t mipLevel, int row, const float* hUp,
+    const float* hMid, const float* hDown, float* next )
 {
+    int width  = dxdy.width;
+    int height = dxdy.height;
+    // wrap all edges
+    const float* dxdyMid  = dxdy.Row( row );
+    const float* dxdyUp   = dxdy.Row( Wrap( row - 1, height ) );
+    const float* dxdyDown = dxdy.Row( Wrap( row + 1, height ) );
+
+    float residual = 0;
+    for ( int col = 0; col < width; ++col )
+    {
+        uint32_t left = Wrap( col - 1, width );
+        uint32_t right = Wrap( col + 1, width );
+
+        vec4 w = edges.Get( row, col );
+        if ( mipLevel >= 0 )
+            w = vec4( 1.0f );
+
+        float h = 0;
+        h += w.x * (hMid[left]  + 0.5f * dxdyMid[2 * left]);
+        h += w.y * (hMid[right] - 0.5f * dxdyMid[2 * right]);
+        h += w.z * (hUp[col]    + 0.5f * dxdyUp[2 * col + 1]);
+        h += w.w * (hDown[col]  - 0.5f * dxdyDown[2 * col + 1]);
+
+        next[col] = h / Dot( w, vec4( 1.0f ) );
+        if constexpr ( MeasureResidual )
+            residual += ( next[col] - hMid[col] ) * ( next[col] - hMid[col] );
+    }
+
+    return residual;
+}
+
+void BuildDisplacement_WithEdges( const std::vector<FloatImage2D>& dxdyPyramid, const std::vector<FloatImage2D>& edgeImgs, float* scratchH,
+    float* outputH, SweepScheduler& scheduler, std::vector<FloatImage2D>* coarseMips, uint32_t mipLevel = 0 )
+{
+    const FloatImage2D& dxdyImg = dxdyPyramid[mipLevel];
     int width = dxdyImg.width;
     int height = dxdyImg.height;
     if ( width == 1 || height == 1 )
     {
         memset( outputH, 0, width * height * sizeof( float ) );
+        SaveCoarseHeightSolution( coarseMips, mipLevel, outputH, width, height );
         return;
     }
-    else
-    {
-        int halfW = Max( width / 2, 1 );
-        int halfH = Max( height / 2, 1 );
-        FloatImage2D halfDxDyImg = dxdyImg.Resize( halfW, halfH );
-        float scaleX = width / static_cast<float>( halfW );
-        float scaleY = height / static_cast<float>( halfH );
-        // update the 'invSize' from the original 'DxDyFromNormal( normal ) * invSize'
-        halfDxDyImg.ForEachPixel( [&]( float* p )
-            {
-                p[0] *= scaleX;
-                p[1] *= scaleY;
-            });
 
-        BuildDisplacement_WithEdges( halfDxDyImg, edgeImgs, scratchH, outputH, numIterations, 2 * iterationMultiplier, mipLevel + 1 );
+    if ( !scheduler.ResumesAt( mipLevel ) )
+        BuildDisplacement_WithEdges( dxdyPyramid, edgeImgs, scratchH, outputH, scheduler, coarseMips, mipLevel + 1 );
 
-        stbir_resize_float_generic( outputH, halfW, halfH, 0, scratchH, width, height, 0,
-            1, -1, 0, STBIR_EDGE_WRAP, STBIR_FILTER_BOX, STBIR_COLORSPACE_LINEAR, NULL );
-    }    
-    
-    float* cur = scratchH;
-    float* next = outputH;
-    numIterations = static_cast<uint32_t>( Min( 1.0f, iterationMultiplier ) * numIterations );
-    numIterations += numIterations % 2; // ensure odd number
-    const FloatImage2D& edgeImg = edgeImgs[mipLevel];
-    
-    for ( uint32_t iter = 0; iter < numIterations; ++iter )
-    {
-        #pragma omp parallel for
-        for ( int row = 0; row < height; ++row )
+    ImageView<const float, 4> edges = edgeImgs[mipLevel].View<4>();
+    ImageView<const float, 2> dxdy = dxdyImg.View<2>();
+    RelaxLevel( scheduler, mipLevel, width, height, scratchH, outputH,
+        [&]( auto measureResidual, int row, const float* hUp, const float* hMid, const float* hDown, float* nextRow )
         {
-            // wrap all edges
-            uint32_t up = Wrap( row - 1, height );
-            uint32_t down = Wrap( row + 1, height );
-            
-            for ( int col = 0; col < width; ++col )
-            {
-                uint32_t left = Wrap( col - 1, width );
-                uint32_t right = Wrap( col + 1, width );
-                
-                vec4 w = edgeImg.Get( row, col ); 
-                if ( mipLevel >= 0 )
-                    w = vec4( 1.0f );
-
-                float h = 0;
-                h += w.x * (cur[left  + row * width]   + 0.5f * (dxdyImg.Get( row, left ).x));
-                h += w.y * (cur[right + row * width]   - 0.5f * (dxdyImg.Get( row, right ).x));
-                h += w.z * (cur[col   + up * width]    + 0.5f * (dxdyImg.Get( up, col ).y));
-                h += w.w * (cur[col   + down * width]  - 0.5f * (dxdyImg.Get( down, col ).y));
-
-                next[col + row * width] = h / Dot( w, vec4( 1.0f ) );
-            }
-        }
-        std::swap( cur, next );
-    }
+            return RelaxRow_WithEdges<measureResidual>( dxdy, edges, mipLevel, row, hUp, hMid, hDown, nextRow );
+        } );
+
+    SaveCoarseHeightSolution( coarseMips, mipLevel, outputH, width, height );
 }
 
-GenerationResults GetHeightMapFromNormalMap_WithEdges( const FloatImage2D& normalMap, uint32_t iterations, float iterationMultiplier )
+GenerationResults GetHeightMapFromNormalMap_WithEdges( const FloatImage2D& normalMap, uint32_t iterations, float iterationMultiplier,
+    HeightMipMode mipMode, float* outputH, const RelaxationControls& controls )
 {
     GenerationResults returnData;
-    returnData.heightMap = GeneratedHeightMap( normalMap.width, normalMap.height );
+    returnData.heightMap = GeneratedHeightMap( normalMap.width, normalMap.height, outputH );
 
     auto startTime = PG::Time::GetTimePoint();
 
-    uint32_t numMips = (uint32_t)floor( log2( Max( normalMap.width, normalMap.height ) ) ) + 1;
-    std::vector<FloatImage2D> normalMips( numMips );
-    normalMips[0] = normalMap;
+    std::vector<FloatImage2D> normalMips = GenerateMipmaps( normalMap, MipmapGenerationSettings{} );
+    uint32_t numMips = (uint32_t)normalMips.size();
     for ( uint32_t mipLevel = 1; mipLevel < numMips; ++mipLevel )
     {
-        const FloatImage2D& src = normalMips[mipLevel - 1];
         FloatImage2D& dst = normalMips[mipLevel];
-        int halfW = Max( src.width / 2, 1 );
-        int halfH = Max( src.height / 2, 1 );
-        dst = src.Resize( halfW, halfH );
-        for ( int i = 0; i < halfW * halfH; ++i )
+        int halfW = dst.width;
+        int halfH = dst.height;
+        ImageView<float, 3> dstNormals = dst.View<3>();
+        #pragma omp parallel for if ( halfW * halfH >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
+        for ( int row = 0; row < halfH; ++row )
         {
-            vec3 normal = dst.Get( i );
-            normal = Normalize( normal );
-            dst.Set( i, normal );
+            for ( int col = 0; col < halfW; ++col )
+                dstNormals.Set( row, col, Normalize( dstNormals.Get( row, col ) ) );
         }
         //auto copy = dst.Clone();
         //PackNormalMap( copy, options.flipY, options.flipX );
@@ -100,11 +95,13 @@ GenerationResults GetHeightMapFromNormalMap_WithEdges( const FloatImage2D& norma
     std::vector<FloatImage2D> edgeImgs( numMips );
     for ( uint32_t mipLevel = 0; mipLevel < numMips; ++mipLevel )
     {
-        const FloatImage2D& normalMip = normalMips[mipLevel];
+        ImageView<const float, 3> normalMip = normalMips[mipLevel].View<3>();
         int width = normalMip.width;
         int height = normalMip.height;
-        edgeImgs[mipLevel] = FloatImage2D( normalMip.width, normalMip.height, 4 );
+        edgeImgs[mipLevel] = FloatImage2D( normalMip.width, normalMip.height, 4, ImageAllocFlags::UNINITIALIZED );
+        ImageView<float, 4> edges = edgeImgs[mipLevel].View<4>();
         //auto save = FloatImage2D( normalMip.width, normalMip.height, 4 );
+        #pragma omp parallel for if ( width * height >= MIN_PIXELS_FOR_PARALLEL_SWEEP )
         for ( int row = 0; row < height; ++row )
         {
             int up = Wrap( row - 1, height );
@@ -124,23 +121,24 @@ GenerationResults GetHeightMapFromNormalMap_WithEdges( const FloatImage2D& norma
                 float dRight = Dot( n, nRight );
                 float dUp = Dot( n, nUp );
                 float dDown = Dot( n, nDown );
-                edgeImgs[mipLevel].Set( row, col, vec4( dLeft, dRight, dUp, dDown ) );
+                edges.Set( row, col, vec4( dLeft, dRight, dUp, dDown ) );
                 //save.Set( row, col, vec4( 1.0f ) - vec4( dLeft, dRight, dUp, dDown ) );
             }
         }
         //save.Save( ROOT_DIR "extra_images/edges_" + std::to_string( mipLevel ) + ".png" );
     }
 
-    FloatImage2D dxdyImg = FloatImage2D( normalMap.width, normalMap.height, 2 );
-    vec2 invSize = { 1.0f / normalMap.width, 1.0f / normalMap.height };
-    for ( int i = 0; i < normalMap.width * normalMap.height; ++i )
-    {
-        vec3 normal = normalMap.Get( i );
-        dxdyImg.Set( i, DxDyFromNormal( normal ) * invSize );
-    }
+    std::vector<FloatImage2D> dxdyPyramid = BuildDxDyPyramid( DxDyImageFromNormalMap( normalMap ) );
 
-    FloatImage2D scratchH = FloatImage2D( normalMap.width, normalMap.height, 1 );
-    BuildDisplacement_WithEdges( dxdyImg, edgeImgs, scratchH.data.get(), returnData.heightMap.map.data.get(), iterations, iterationMultiplier );
+    FloatImage2D scratchH = FloatImage2D( normalMap.width, normalMap.height, 1, ImageAllocFlags::UNINITIALIZED );
+    std::vector<FloatImage2D>* coarseMips = mipMode == HeightMipMode::SOLVER ? &returnData.heightMap.mips : nullptr;
+    SweepScheduler scheduler( GetSolverLevelSizes( dxdyPyramid ), iterations, iterationMultiplier, controls, startTime );
+    scheduler.SetupCheckpoints( controls.checkpoints, dxdyPyramid, coarseMips );
+    scheduler.SetupWarmStart( controls, dxdyPyramid );
+    BuildDisplacement_WithEdges( dxdyPyramid, edgeImgs, scratchH.data.get(), returnData.heightMap.map.data.get(), scheduler, coarseMips );
+    scheduler.GetResults( returnData );
+    if ( !returnData.cancelled )
+        CompleteHeightMapMips( returnData.heightMap, mipMode );
 
     auto stopTime = PG::Time::GetTimePoint();
 
@@ -151,10 +149,11 @@ GenerationResults GetHeightMapFromNormalMap_WithEdges( const FloatImage2D& norma
     return returnData;
 }
 
-GenerationResults GetHeightMapFromNormalMap_LinearSolve( const FloatImage2D& normalMap, uint32_t iterations, bool linearSolveWithGuess )
+GenerationResults GetHeightMapFromNormalMap_LinearSolve( const FloatImage2D& normalMap, uint32_t iterations, bool linearSolveWithGuess,
+    HeightMipMode mipMode, float* outputH, const CheckpointControls& checkpoints )
 {
     GenerationResults returnData;
-    returnData.heightMap = GeneratedHeightMap( normalMap.width, normalMap.height );
+    returnData.heightMap = GeneratedHeightMap( normalMap.width, normalMap.height, outputH );
 
     using namespace Eigen;
 
@@ -204,15 +203,11 @@ GenerationResults GetHeightMapFromNormalMap_LinearSolve( const FloatImage2D& nor
     }
     A.setFromTriplets( triplets.begin(), triplets.end() );
     
+    // b is just the negated slopes, in the same interleaved layout as the dxdy image
     VectorXf b( 2 * width * height );
-    vec2 invSize = { 1.0f / width, 1.0f / height };
-    for ( int i = 0; i < width * height; ++i )
-    {
-        vec3 normal = normalMap.Get( i );
-        vec2 dxdy = -DxDyFromNormal( normal ) * invSize;
-        b( 2 * i + 0 ) = dxdy.x;
-        b( 2 * i + 1 ) = dxdy.y;
-    }
+    FloatImage2D dxdyImg = DxDyImageFromNormalMap( normalMap );
+    for ( int i = 0; i < 2 * width * height; ++i )
+        b( i ) = -dxdyImg.data[i];
 
     LeastSquaresConjugateGradient<SparseMatrix<float>> solver;
     solver.compute( A );
@@ -223,36 +218,88 @@ GenerationResults GetHeightMapFromNormalMap_LinearSolve( const FloatImage2D& nor
         return {};
     }
     VectorXf X;
-    solver.setMaxIterations( iterations );
-    if ( !linearSolveWithGuess )
+    const SolverCheckpoint* resume = checkpoints.resumeFrom;
+    if ( resume && ( resume->mipLevel != 0 || resume->heights.width != width || resume->heights.height != height ) )
+    {
+        LOG_WARN( "The checkpoint doesn't match this solve. Starting from scratch" );
+        resume = nullptr;
+    }
+
+    uint32_t iterationsDone = 0;
+    if ( !checkpoints.onCheckpoint && !resume )
     {
-        X = solver.solve( b );
+        solver.setMaxIterations( iterations );
+        if ( !linearSolveWithGuess )
+        {
+            X = solver.solve( b );
+        }
+        else
+        {
+            GenerationResults relaxtionResults = GetHeightMapFromNormalMap( normalMap, 512, 1.0f );
+            VectorXf guess( width * height );
+            for ( int i = 0; i < width * height; ++i )
+            {
+                guess(i) = relaxtionResults.heightMap.GetH( i );
+            }
+            X = solver.solveWithGuess( b, guess );
+        }
+        iterationsDone = (uint32_t)solver.iterations();
     }
     else
     {
-        GenerationResults relaxtionResults = GetHeightMapFromNormalMap( normalMap, 512, 1.0f );
-        VectorXf guess( width * height );
-        for ( int i = 0; i < width * height; ++i )
+        if ( resume )
         {
-            guess(i) = relaxtionResults.heightMap.GetH( i );
+            X = Map<const VectorXf>( resume->heights.data.get(), width * height );
+            iterationsDone = resume->sweeps;
+        }
+        else if ( linearSolveWithGuess )
+        {
+            GenerationResults relaxtionResults = GetHeightMapFromNormalMap( normalMap, 512, 1.0f );
+            X = Map<const VectorXf>( relaxtionResults.heightMap.map.data.get(), width * height );
+        }
+        else
+        {
+            X = VectorXf::Zero( width * height );
+        }
+
+        // Solve in chunks of about a checkpoint interval each, by restarting the solver from the current solution
+        uint32_t chunkIterations = 16;
+        auto lastCheckpointTime  = PG::Time::GetTimePoint();
+        while ( iterationsDone < iterations )
+        {
+            auto chunkStartTime = PG::Time::GetTimePoint();
+            solver.setMaxIterations( Min( chunkIterations, iterations - iterationsDone ) );
+            X = solver.solveWithGuess( b, X );
+            iterationsDone += (uint32_t)solver.iterations();
+            if ( solver.info() == Success )
+                break;
+
+            double msPerIteration = PG::Time::GetTimeSince( chunkStartTime ) / Max<Index>( solver.iterations(), 1 );
+            double msLeft         = checkpoints.interval * 1000.0 - PG::Time::GetTimeSince( lastCheckpointTime );
+            if ( checkpoints.onCheckpoint && msLeft <= msPerIteration )
+            {
+                SolverCheckpoint checkpoint;
+                checkpoint.sweeps  = iterationsDone;
+                checkpoint.heights = FloatImage2D( width, height, 1, X.data() );
+                checkpoints.onCheckpoint( checkpoint );
+                lastCheckpointTime = PG::Time::GetTimePoint();
+                msLeft             = checkpoints.interval * 1000.0;
+            }
+            chunkIterations = (uint32_t)Max( 16.0, msLeft / msPerIteration );
         }
-        X = solver.solveWithGuess( b, guess );
     }
     if ( solver.info() != Success )
     {
         LOG_WARN( "Solver didn't converge (yet)" );
     }
 
-    for ( int i = 0; i < width * height; ++i )
-    {
-        float h = X(i);
-        returnData.heightMap.map.Set( i, h );
-    }
+    memcpy( returnData.heightMap.map.data.get(), X.data(), width * height * sizeof( float ) );
+    CompleteHeightMapMips( returnData.heightMap, mipMode == HeightMipMode::NONE ? HeightMipMode::NONE : HeightMipMode::GENERATE );
 
     auto stopTime = PG::Time::GetTimePoint();
 
     returnData.heightMap.CalcMinMax();
-    returnData.iterations = (uint32_t)solver.iterations();
+    returnData.iterations = iterationsDone;
     returnData.solverError = solver.error();
     returnData.timeToGenerate = (float)PG::Time::GetElapsedTime( startTime, stopTime ) / 1000.0f;
 
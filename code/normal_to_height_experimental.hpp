@@ -2,6 +2,11 @@
 
 #include "normal_to_height.hpp"
 
-GenerationResults GetHeightMapFromNormalMap_WithEdges( const FloatImage2D& normalMap, uint32_t iterations, float iterationMultiplier = 1.0f );
+GenerationResults GetHeightMapFromNormalMap_WithEdges( const FloatImage2D& normalMap, uint32_t iterations, float iterationMultiplier = 1.0f,
+    HeightMipMode mipMode = HeightMipMode::NONE, float* outputH = nullptr, const RelaxationControls& controls = {} );
 
-GenerationResults GetHeightMapFromNormalMap_LinearSolve( const FloatImage2D& normalMap, uint32_t iterations, bool linearSolveWithGuess = true );
+// HeightMipMode::SOLVER isn't applicable here, and is treated as HeightMipMode::GENERATE.
+// With checkpointing (or resuming), the solver is restarted from its current solution after every checkpoint, which loses a little
+// bit of its convergence each time
+GenerationResults GetHeightMapFromNormalMap_LinearSolve( const FloatImage2D& normalMap, uint32_t iterations, bool linearSolveWithGuess = true,
+    HeightMipMode mipMode = HeightMipMode::NONE, float* outputH = nullptr, const CheckpointControls& checkpoints = {} );
@@ -0,0 +1,262 @@
+// Python module 'normal_to_height'. Arrays are passed in and out through the buffer protocol, so NumPy arrays are read and written
+// in place, with no copies. The GIL is released during each solve, so separate Python threads can process separate maps concurrently
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "height_to_normal.hpp"
+#include "normal_to_height_api.h"
+
+struct BufferView
+{
+    Py_buffer view = {};
+    bool valid     = false;
+
+    ~BufferView()
+    {
+        if ( valid )
+            PyBuffer_Release( &view );
+    }
+};
+
+static N2H_ComponentType GetComponentType( const Py_buffer& view, bool& valid )
+{
+    valid              = true;
+    const char* format = view.format ? view.format : "B";
+    if ( format[0] == '<' || format[0] == '=' || format[0] == '@' )
+        ++format;
+    if ( view.itemsize == 1 && ( format[0] == 'B' || format[0] == 'b' ) )
+        return N2H_COMPONENT_UNORM8;
+    if ( view.itemsize == 2 && format[0] == 'H' )
+        return N2H_COMPONENT_UNORM16;
+    if ( view.itemsize == 4 && format[0] == 'f' )
+        return N2H_COMPONENT_FLOAT32;
+
+    valid = false;
+    return N2H_COMPONENT_UNORM8;
+}
+
+// Returns a new float32 NumPy array with the given shape, or the 'out' array if it has the right shape and type
+static PyObject* GetOutputArray( PyObject* out, int numDims, const Py_ssize_t* shape )
+{
+    if ( out && out != Py_None )
+    {
+        Py_buffer view;
+        if ( PyObject_GetBuffer( out, &view, PyBUF_RECORDS ) < 0 )
+            return nullptr;
+
+        bool matches = view.ndim == numDims && view.itemsize == 4 && view.format && strchr( view.format, 'f' );
+        for ( int i = 0; i < numDims && matches; ++i )
+            matches = view.shape[i] == shape[i];
+        PyBuffer_Release( &view );
+        if ( !matches )
+        {
+            PyErr_SetString( PyExc_ValueError, "'out' must be a writable float32 array with the same width and height as the input" );
+            return nullptr;
+        }
+
+        Py_INCREF( out );
+        return out;
+    }
+
+    PyObject* numpy = PyImport_ImportModule( "numpy" );
+    if ( !numpy )
+        return nullptr;
+
+    PyObject* shapeTuple = PyTuple_New( numDims );
+    for ( int i = 0; i < numDims; ++i )
+        PyTuple_SET_ITEM( shapeTuple, i, PyLong_FromSsize_t( shape[i] ) );
+    PyObject* array = PyObject_CallMethod( numpy, "empty", "Os", shapeTuple, "float32" );
+    Py_DECREF( shapeTuple );
+    Py_DECREF( numpy );
+
+    return array;
+}
+
+static PyObject* GenerateHeightMap( PyObject* args, PyObject* kwargs, N2H_Method method )
+{
+    static const char* relaxationKeywords[] = { "normal_map", "iterations", "iteration_multiplier", "slope_scale", "flip_x", "flip_y", "out",
+        "time_budget_ms", nullptr };
+    static const char* linearKeywords[]     = { "normal_map", "iterations", "with_guess", "slope_scale", "flip_x", "flip_y", "out", nullptr };
+
+    N2H_Settings settings;
+    N2H_GetDefaultSettings( &settings );
+    settings.method = method;
+
+    PyObject* normalsObj = nullptr;
+    PyObject* out        = nullptr;
+    int flipX            = 0;
+    int flipY            = 0;
+    bool parsed;
+    if ( method == N2H_METHOD_LINEAR_SYSTEM )
+    {
+        int withGuess = settings.linearSolveWithGuess;
+        parsed = PyArg_ParseTupleAndKeywords( args, kwargs, "O|IpfppO", const_cast<char**>( linearKeywords ), &normalsObj, &settings.iterations,
+            &withGuess, &settings.slopeScale, &flipX, &flipY, &out );
+        settings.linearSolveWithGuess = withGuess;
+    }
+    else
+    {
+        parsed = PyArg_ParseTupleAndKeywords( args, kwargs, "O|IffppOf", const_cast<char**>( relaxationKeywords ), &normalsObj,
+            &settings.iterations, &settings.iterationMultiplier, &settings.slopeScale, &flipX, &flipY, &out, &settings.timeBudgetMs );
+    }
+    if ( !parsed )
+        return nullptr;
+    settings.flipX = flipX;
+    settings.flipY = flipY;
+
+    BufferView normals;
+    if ( PyObject_GetBuffer( normalsObj, &normals.view, PyBUF_RECORDS_RO ) < 0 )
+        return nullptr;
+    normals.valid = true;
+
+    bool validType;
+    const Py_buffer& nView            = normals.view;
+    N2H_ComponentType normalComponent = GetComponentType( nView, validType );
+    if ( !validType || nView.ndim != 3 || nView.shape[2] < 2 || nView.shape[2] > 4 || nView.strides[2] != nView.itemsize || nView.strides[0] < 0 ||
+         nView.strides[1] < 0 )
+    {
+        PyErr_SetString( PyExc_ValueError, "normal_map must be a (height, width, 2-4) uint8, uint16, or float32 array with contiguous channels" );
+        return nullptr;
+    }
+
+    Py_ssize_t shape[2] = { nView.shape[0], nView.shape[1] };
+    PyObject* heightsObj = GetOutputArray( out, 2, shape );
+    if ( !heightsObj )
+        return nullptr;
+
+    BufferView heights;
+    if ( PyObject_GetBuffer( heightsObj, &heights.view, PyBUF_RECORDS ) < 0 || heights.view.strides[1] != sizeof( float ) || heights.view.strides[0] < 0 )
+    {
+        if ( !PyErr_Occurred() )
+            PyErr_SetString( PyExc_ValueError, "'out' must have contiguous rows" );
+        Py_DECREF( heightsObj );
+        return nullptr;
+    }
+    heights.valid = true;
+
+    N2H_NormalMapBuffer normalBuffer = { nView.buf, (int)nView.shape[1], (int)nView.shape[0], (int)nView.shape[2], normalComponent,
+        (size_t)nView.strides[1], (size_t)nView.strides[0] };
+    N2H_HeightMapBuffer heightBuffer = { heights.view.buf, N2H_COMPONENT_FLOAT32, (size_t)heights.view.strides[0] };
+    N2H_Status status;
+    Py_BEGIN_ALLOW_THREADS
+    status = N2H_GenerateHeightMap( &normalBuffer, &settings, &heightBuffer, nullptr );
+    Py_END_ALLOW_THREADS
+
+    if ( status != N2H_SUCCESS )
+    {
+        PyErr_SetString( PyExc_ValueError, "Could not generate the height map" );
+        Py_DECREF( heightsObj );
+        return nullptr;
+    }
+
+    return heightsObj;
+}
+
+static PyObject* Py_GetHeightMapFromNormalMap( PyObject* self, PyObject* args, PyObject* kwargs )
+{
+    return GenerateHeightMap( args, kwargs, N2H_METHOD_RELAXATION );
+}
+
+static PyObject* Py_GetHeightMapFromNormalMap_WithEdges( PyObject* self, PyObject* args, PyObject* kwargs )
+{
+    return GenerateHeightMap( args, kwargs, N2H_METHOD_RELAXATION_EDGE_AWARE );
+}
+
+static PyObject* Py_GetHeightMapFromNormalMap_LinearSolve( PyObject* self, PyObject* args, PyObject* kwargs )
+{
+    return GenerateHeightMap( args, kwargs, N2H_METHOD_LINEAR_SYSTEM );
+}
+
+static PyObject* Py_GetNormalMapFromHeightMap( PyObject* self, PyObject* args, PyObject* kwargs )
+{
+    static const char* keywords[] = { "height_map", "method", "out", nullptr };
+
+    PyObject* heightsObj = nullptr;
+    PyObject* out        = nullptr;
+    unsigned int method  = Underlying( NormalCalcMethod::CROSS );
+    if ( !PyArg_ParseTupleAndKeywords( args, kwargs, "O|IO", const_cast<char**>( keywords ), &heightsObj, &method, &out ) )
+        return nullptr;
+    if ( method >= Underlying( NormalCalcMethod::COUNT ) )
+    {
+        PyErr_SetString( PyExc_ValueError, "Invalid normal calculation method" );
+        return nullptr;
+    }
+
+    // the solver only needs contiguous float heights, so only other layouts get copied
+    BufferView heights;
+    if ( PyObject_GetBuffer( heightsObj, &heights.view, PyBUF_RECORDS_RO ) < 0 )
+        return nullptr;
+    heights.valid = true;
+
+    const Py_buffer& hView = heights.view;
+    if ( hView.ndim != 2 || hView.itemsize != 4 || !hView.format || !strchr( hView.format, 'f' ) )
+    {
+        PyErr_SetString( PyExc_ValueError, "height_map must be a (height, width) float32 array" );
+        return nullptr;
+    }
+
+    int width  = (int)hView.shape[1];
+    int height = (int)hView.shape[0];
+    GeneratedHeightMap heightMap;
+    if ( PyBuffer_IsContiguous( &hView, 'C' ) )
+    {
+        heightMap.map = FloatImage2D( width, height, 1, static_cast<float*>( hView.buf ) );
+    }
+    else
+    {
+        heightMap.map = FloatImage2D( width, height, 1 );
+        for ( int row = 0; row < height; ++row )
+        {
+            for ( int col = 0; col < width; ++col )
+                heightMap.map.data[row * width + col] =
+                    *reinterpret_cast<const float*>( static_cast<const uint8_t*>( hView.buf ) + row * hView.strides[0] + col * hView.strides[1] );
+        }
+    }
+
+    Py_ssize_t shape[3] = { height, width, 3 };
+    PyObject* normalsObj = GetOutputArray( out, 3, shape );
+    if ( !normalsObj )
+        return nullptr;
+
+    BufferView normals;
+    if ( PyObject_GetBuffer( normalsObj, &normals.view, PyBUF_C_CONTIGUOUS | PyBUF_WRITABLE ) < 0 )
+    {
+        Py_DECREF( normalsObj );
+        return nullptr;
+    }
+    normals.valid = true;
+
+    Py_BEGIN_ALLOW_THREADS
+    GetNormalMapFromHeightMap( heightMap, (NormalCalcMethod)method, static_cast<float*>( normals.view.buf ) );
+    Py_END_ALLOW_THREADS
+
+    return normalsObj;
+}
+
+static PyMethodDef s_methods[] =
+{
+    { "get_height_map_from_normal_map", (PyCFunction)(void (*)( void ))Py_GetHeightMapFromNormalMap, METH_VARARGS | METH_KEYWORDS,
+        "get_height_map_from_normal_map(normal_map, iterations=1024, iteration_multiplier=0.25, slope_scale=1.0, flip_x=False, flip_y=False, out=None,\n"
+        "    time_budget_ms=0)\n"
+        "normal_map: (height, width, 2-4) uint8, uint16, or float32 array of packed normals. Returns the (height, width) float32 heights.\n"
+        "time_budget_ms: if > 0, return the best solution so far after about this long, upsampled to full resolution" },
+    { "get_height_map_from_normal_map_with_edges", (PyCFunction)(void (*)( void ))Py_GetHeightMapFromNormalMap_WithEdges, METH_VARARGS | METH_KEYWORDS,
+        "Same as get_height_map_from_normal_map, but with the edge-aware relaxation" },
+    { "get_height_map_from_normal_map_linear_solve", (PyCFunction)(void (*)( void ))Py_GetHeightMapFromNormalMap_LinearSolve, METH_VARARGS | METH_KEYWORDS,
+        "get_height_map_from_normal_map_linear_solve(normal_map, iterations=1024, with_guess=True, slope_scale=1.0, flip_x=False, flip_y=False, out=None)" },
+    { "get_normal_map_from_height_map", (PyCFunction)(void (*)( void ))Py_GetNormalMapFromHeightMap, METH_VARARGS | METH_KEYWORDS,
+        "get_normal_map_from_height_map(height_map, method=0, out=None)\n"
+        "height_map: (height, width) float32 array. Returns the (height, width, 3) float32 unit normals (not packed)" },
+    { nullptr, nullptr, 0, nullptr }
+};
+
+static PyModuleDef s_module =
+{
+    PyModuleDef_HEAD_INIT, "normal_to_height", "Height map generation from normal maps", -1, s_methods
+};
+
+PyMODINIT_FUNC PyInit_normal_to_height()
+{
+    return PyModule_Create( &s_module );
+}
@@ -0,0 +1,147 @@
+#include "server.hpp"
+#include "shared/logger.hpp"
+#include "shared/platform_defines.hpp"
+
+#if !USING( WINDOWS_PROGRAM )
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif // #if !USING( WINDOWS_PROGRAM )
+
+std::vector<std::string> SplitServerRequest( const std::string& request )
+{
+    std::vector<std::string> args;
+    std::string current;
+    bool inQuotes    = false;
+    bool hasArgument = false;
+    for ( char c : request )
+    {
+        if ( c == '"' )
+        {
+            inQuotes    = !inQuotes;
+            hasArgument = true;
+        }
+        else if ( !inQuotes && ( c == ' ' || c == '\t' || c == '\r' ) )
+        {
+            if ( hasArgument )
+                args.push_back( current );
+            current.clear();
+            hasArgument = false;
+        }
+        else
+        {
+            current += c;
+            hasArgument = true;
+        }
+    }
+    if ( hasArgument )
+        args.push_back( current );
+
+    return args;
+}
+
+#if USING( WINDOWS_PROGRAM )
+
+bool RunServer( const std::string& socketPath, const ServerRequestHandler& handleRequest )
+{
+    LOG_ERR( "Server mode is not currently supported on Windows" );
+    return false;
+}
+
+#else // #if USING( WINDOWS_PROGRAM )
+
+static bool ReadRequestLine( int connection, std::string& request )
+{
+    char buffer[1024];
+    while ( true )
+    {
+        ssize_t bytesRead = read( connection, buffer, sizeof( buffer ) );
+        if ( bytesRead <= 0 )
+            return !request.empty();
+
+        request.append( buffer, bytesRead );
+        size_t newline = request.find( '\n' );
+        if ( newline != std::string::npos )
+        {
+            request.resize( newline );
+            return true;
+        }
+    }
+}
+
+static void WriteAll( int connection, const std::string& reply )
+{
+    size_t written = 0;
+    while ( written < reply.size() )
+    {
+        ssize_t ret = write( connection, reply.data() + written, reply.size() - written );
+        if ( ret <= 0 )
+            return;
+        written += ret;
+    }
+}
+
+bool RunServer( const std::string& socketPath, const ServerRequestHandler& handleRequest )
+{
+    sockaddr_un address = {};
+    address.sun_family  = AF_UNIX;
+    if ( socketPath.size() >= sizeof( address.sun_path ) )
+    {
+        LOG_ERR( "Server socket path '%s' is too long", socketPath.c_str() );
+        return false;
+    }
+    memcpy( address.sun_path, socketPath.c_str(), socketPath.size() + 1 );
+
+    int listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+    if ( listener < 0 )
+    {
+        LOG_ERR( "Could not create the server socket" );
+        return false;
+    }
+    unlink( socketPath.c_str() );
+    if ( bind( listener, reinterpret_cast<sockaddr*>( &address ), sizeof( address ) ) < 0 || listen( listener, 64 ) < 0 )
+    {
+        LOG_ERR( "Could not bind the server socket to '%s'", socketPath.c_str() );
+        close( listener );
+        return false;
+    }
+
+    // clients that disconnect early shouldn't kill the server
+    signal( SIGPIPE, SIG_IGN );
+    LOG( "Server listening on '%s'", socketPath.c_str() );
+
+    bool shutdown = false;
+    while ( !shutdown )
+    {
+        int connection = accept( listener, nullptr, nullptr );
+        if ( connection < 0 )
+            continue;
+
+        std::string request;
+        if ( ReadRequestLine( connection, request ) )
+        {
+            std::string reply;
+            if ( request == "shutdown" )
+            {
+                shutdown = true;
+                reply    = "{\"success\":true}";
+            }
+            else
+            {
+                reply = handleRequest( request );
+            }
+            WriteAll( connection, reply + "\n" );
+        }
+        close( connection );
+    }
+
+    close( listener );
+    unlink( socketPath.c_str() );
+    LOG( "Server shut down" );
+
+    return true;
+}
+
+#endif // #else // #if USING( WINDOWS_PROGRAM )
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Gets the request line (without the newline), and returns the reply line (also without the newline)
+using ServerRequestHandler = std::function<std::string( const std::string& request )>;
+
+// Listens on a local Unix domain socket, and handles one request per connection: the client sends a single line, and gets a single
+// line back before the connection is closed. Requests are handled one at a time, in the order they are accepted, which lets each
+// job use the whole machine. Blocks until a client sends the request "shutdown". Returns false if the socket couldn't be set up
+bool RunServer( const std::string& socketPath, const ServerRequestHandler& handleRequest );
+
+// Splits a request line into arguments on whitespace. Double quotes group an argument that contains spaces
+std::vector<std::string> SplitServerRequest( const std::string& request );
@@ -31,7 +31,12 @@ std::string UnderscorePath( std::string str )
     return str;
 }
 
-void CreateDirectory( const std::string& dir ) { fs::create_directories( dir ); }
+bool CreateDirectory( const std::string& dir )
+{
+    std::error_code ec;
+    fs::create_directories( dir, ec );
+    return !ec;
+}
 
 bool CopyFile( const std::string& from, const std::string& to, bool overwriteExisting )
 {
@@ -10,7 +10,8 @@ std::string UnderscorePath( std::string str );
 
 // parent directory must exist.
 // i.e: for /dir1/dir2, dir1 must be created first, then another call to create dir2
-void CreateDirectory( const std::string& dir );
+// Returns false if the directory couldn't be created (doesn't throw)
+bool CreateDirectory( const std::string& dir );
 
 // returns false if there was an error. If overwriteExisting is false, and 'to' exists, returns true
 bool CopyFile( const std::string& from, const std::string& to, bool overwriteExisting );
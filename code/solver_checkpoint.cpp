@@ -0,0 +1,217 @@
+#include "solver_checkpoint.hpp"
+#include "shared/logger.hpp"
+#include "stb/stb_image.h"
+#include <filesystem>
+
+namespace fs = std::filesystem;
+
+static constexpr uint32_t CHECKPOINT_MAGIC      = 0x5043324E; // 'N2CP'
+static constexpr uint32_t CHECKPOINT_VERSION    = 1;
+static constexpr size_t CHECKPOINT_CHUNK_FLOATS = 1u << 20; // compressed independently, and in parallel
+static constexpr int CHECKPOINT_ZLIB_QUALITY    = 5;
+
+struct CheckpointHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint64_t pixelUpdates;
+    uint32_t mipLevel;
+    uint32_t sweeps;
+    uint32_t numLevelSweeps;
+    uint32_t numResiduals;
+    uint32_t numMaps; // heights + coarseMips
+    uint32_t compressed;
+};
+
+// Splits the bytes of each float into 4 planes, and stores each byte as the difference from the previous one. Smooth heights have
+// nearly constant exponent and high mantissa bytes, which then turn into long runs that deflate well
+static void ShuffleAndDelta( const float* src, size_t numFloats, uint8_t* dst )
+{
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>( src );
+    for ( size_t i = 0; i < numFloats; ++i )
+    {
+        for ( int b = 0; b < 4; ++b )
+            dst[b * numFloats + i] = bytes[4 * i + b];
+    }
+
+    uint8_t prev = 0;
+    for ( size_t i = 0; i < 4 * numFloats; ++i )
+    {
+        uint8_t cur = dst[i];
+        dst[i]      = cur - prev;
+        prev        = cur;
+    }
+}
+
+static void UndoShuffleAndDelta( uint8_t* src, size_t numFloats, float* dst )
+{
+    uint8_t prev = 0;
+    for ( size_t i = 0; i < 4 * numFloats; ++i )
+    {
+        prev  += src[i];
+        src[i] = prev;
+    }
+
+    uint8_t* bytes = reinterpret_cast<uint8_t*>( dst );
+    for ( size_t i = 0; i < numFloats; ++i )
+    {
+        for ( int b = 0; b < 4; ++b )
+            bytes[4 * i + b] = src[b * numFloats + i];
+    }
+}
+
+static bool WriteMap( FILE* file, const FloatImage2D& map, bool compress )
+{
+    int dims[2]      = { map.width, map.height };
+    size_t numFloats = (size_t)map.width * map.height;
+    if ( fwrite( dims, sizeof( dims ), 1, file ) != 1 )
+        return false;
+    if ( !compress )
+        return numFloats == 0 || fwrite( map.data.get(), numFloats * sizeof( float ), 1, file ) == 1;
+
+    int numChunks = (int)( ( numFloats + CHECKPOINT_CHUNK_FLOATS - 1 ) / CHECKPOINT_CHUNK_FLOATS );
+    std::vector<std::vector<uint8_t>> chunks( numChunks );
+    bool success = true;
+    #pragma omp parallel for schedule( dynamic ) reduction( && : success )
+    for ( int chunk = 0; chunk < numChunks; ++chunk )
+    {
+        size_t start = chunk * CHECKPOINT_CHUNK_FLOATS;
+        size_t count = std::min( CHECKPOINT_CHUNK_FLOATS, numFloats - start );
+        std::vector<uint8_t> shuffled( 4 * count );
+        ShuffleAndDelta( map.data.get() + start, count, shuffled.data() );
+        success = ZlibCompress( shuffled.data(), shuffled.size(), chunks[chunk], CHECKPOINT_ZLIB_QUALITY ) && success;
+    }
+
+    for ( int chunk = 0; chunk < numChunks && success; ++chunk )
+    {
+        uint32_t size = (uint32_t)chunks[chunk].size();
+        success = fwrite( &size, sizeof( size ), 1, file ) == 1 && fwrite( chunks[chunk].data(), size, 1, file ) == 1;
+    }
+
+    return success;
+}
+
+static bool ReadMap( FILE* file, FloatImage2D& map, bool compressed )
+{
+    int dims[2];
+    if ( fread( dims, sizeof( dims ), 1, file ) != 1 || dims[0] < 0 || dims[1] < 0 )
+        return false;
+
+    size_t numFloats = (size_t)dims[0] * dims[1];
+    map              = numFloats ? FloatImage2D( dims[0], dims[1], 1, ImageAllocFlags::UNINITIALIZED ) : FloatImage2D();
+    if ( !compressed )
+        return numFloats == 0 || fread( map.data.get(), numFloats * sizeof( float ), 1, file ) == 1;
+
+    // read all of the chunks first, so that they can be decompressed in parallel
+    size_t numChunks = ( numFloats + CHECKPOINT_CHUNK_FLOATS - 1 ) / CHECKPOINT_CHUNK_FLOATS;
+    std::vector<std::vector<uint8_t>> chunks( numChunks );
+    for ( std::vector<uint8_t>& chunk : chunks )
+    {
+        uint32_t size;
+        if ( fread( &size, sizeof( size ), 1, file ) != 1 )
+            return false;
+        chunk.resize( size );
+        if ( fread( chunk.data(), size, 1, file ) != 1 )
+            return false;
+    }
+
+    bool success = true;
+    #pragma omp parallel for schedule( dynamic ) reduction( && : success )
+    for ( int chunk = 0; chunk < (int)numChunks; ++chunk )
+    {
+        size_t start  = chunk * CHECKPOINT_CHUNK_FLOATS;
+        size_t count  = std::min( CHECKPOINT_CHUNK_FLOATS, numFloats - start );
+        int size      = 0;
+        char* decoded = stbi_zlib_decode_malloc_guesssize( reinterpret_cast<const char*>( chunks[chunk].data() ), (int)chunks[chunk].size(),
+            (int)( 4 * count ), &size );
+        if ( decoded && size == (int)( 4 * count ) )
+            UndoShuffleAndDelta( reinterpret_cast<uint8_t*>( decoded ), count, map.data.get() + start );
+        else
+            success = false;
+        free( decoded );
+    }
+
+    return success;
+}
+
+bool SaveSolverCheckpoint( const std::string& path, uint64_t key, const SolverCheckpoint& checkpoint, bool compress )
+{
+    CheckpointHeader header;
+    header.magic          = CHECKPOINT_MAGIC;
+    header.version        = CHECKPOINT_VERSION;
+    header.key            = key;
+    header.pixelUpdates   = checkpoint.pixelUpdates;
+    header.mipLevel       = checkpoint.mipLevel;
+    header.sweeps         = checkpoint.sweeps;
+    header.numLevelSweeps = (uint32_t)checkpoint.levelSweeps.size();
+    header.numResiduals   = (uint32_t)checkpoint.residuals.size();
+    header.numMaps        = 1 + (uint32_t)checkpoint.coarseMips.size();
+    header.compressed     = compress;
+
+    std::string tempPath = path + ".tmp";
+    FILE* file           = fopen( tempPath.c_str(), "wb" );
+    if ( !file )
+    {
+        LOG_WARN( "Could not write checkpoint '%s'", tempPath.c_str() );
+        return false;
+    }
+
+    bool success = fwrite( &header, sizeof( header ), 1, file ) == 1;
+    success = success && fwrite( checkpoint.levelSweeps.data(), sizeof( uint32_t ), header.numLevelSweeps, file ) == header.numLevelSweeps;
+    success = success && fwrite( checkpoint.residuals.data(), sizeof( double ), header.numResiduals, file ) == header.numResiduals;
+    for ( uint32_t i = 0; i < header.numMaps && success; ++i )
+        success = WriteMap( file, i == 0 ? checkpoint.heights : checkpoint.coarseMips[i - 1], compress );
+    success = fclose( file ) == 0 && success;
+
+    std::error_code ec;
+    if ( success )
+        fs::rename( tempPath, path, ec );
+    if ( !success || ec )
+    {
+        LOG_WARN( "Could not write checkpoint '%s'", path.c_str() );
+        fs::remove( tempPath, ec );
+        return false;
+    }
+
+    return true;
+}
+
+bool LoadSolverCheckpoint( const std::string& path, uint64_t key, SolverCheckpoint& checkpoint )
+{
+    FILE* file = fopen( path.c_str(), "rb" );
+    if ( !file )
+        return false;
+
+    CheckpointHeader header;
+    bool success = fread( &header, sizeof( header ), 1, file ) == 1 && header.magic == CHECKPOINT_MAGIC &&
+                   header.version == CHECKPOINT_VERSION && header.numMaps > 0;
+    if ( success && header.key != key )
+    {
+        fclose( file );
+        return false;
+    }
+
+    if ( success )
+    {
+        checkpoint.levelSweeps.resize( header.numLevelSweeps );
+        checkpoint.residuals.resize( header.numResiduals );
+        checkpoint.coarseMips.resize( header.numMaps - 1 );
+        success = fread( checkpoint.levelSweeps.data(), sizeof( uint32_t ), header.numLevelSweeps, file ) == header.numLevelSweeps &&
+                  fread( checkpoint.residuals.data(), sizeof( double ), header.numResiduals, file ) == header.numResiduals;
+    }
+    for ( uint32_t i = 0; i < header.numMaps && success; ++i )
+        success = ReadMap( file, i == 0 ? checkpoint.heights : checkpoint.coarseMips[i - 1], header.compressed );
+    fclose( file );
+    if ( !success || !checkpoint.heights )
+    {
+        LOG_WARN( "Ignoring corrupt checkpoint '%s'", path.c_str() );
+        return false;
+    }
+
+    checkpoint.mipLevel     = header.mipLevel;
+    checkpoint.sweeps       = header.sweeps;
+    checkpoint.pixelUpdates = header.pixelUpdates;
+
+    return true;
+}
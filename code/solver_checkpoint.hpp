@@ -0,0 +1,14 @@
+#pragma once
+
+#include "normal_to_height.hpp"
+#include <string>
+
+// key: identifies the normal map and every option that changes the result (like a HeightCacheKey), so that a checkpoint is only
+// ever resumed by the same job.
+// compress: shuffles the bytes of the floats into planes, delta encodes them, and deflates that. Slower to write, but usually
+// a fraction of the size. The floats are always stored losslessly, so resuming gives the exact same result as not stopping.
+// The checkpoint is written to a temporary file, and renamed into place, so being killed mid-write leaves the previous one intact
+bool SaveSolverCheckpoint( const std::string& path, uint64_t key, const SolverCheckpoint& checkpoint, bool compress );
+
+// Returns false if there is no checkpoint at path, or it's for a different key
+bool LoadSolverCheckpoint( const std::string& path, uint64_t key, SolverCheckpoint& checkpoint );
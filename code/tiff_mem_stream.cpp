@@ -0,0 +1,56 @@
+#include "tiff_mem_stream.hpp"
+#include "shared/math_base.hpp"
+#include <cstring>
+
+static const uint8_t* TiffMemData( const TiffMemStream* stream )
+{
+    return stream->readOnlyData ? stream->readOnlyData : stream->bytes.data();
+}
+
+static toff_t TiffMemSize( thandle_t handle )
+{
+    TiffMemStream* stream = static_cast<TiffMemStream*>( handle );
+    return stream->readOnlyData ? stream->readOnlySize : stream->bytes.size();
+}
+
+static tmsize_t TiffMemRead( thandle_t handle, void* buf, tmsize_t size )
+{
+    TiffMemStream* stream = static_cast<TiffMemStream*>( handle );
+    tmsize_t available    = static_cast<tmsize_t>( TiffMemSize( handle ) ) - static_cast<tmsize_t>( stream->pos );
+    size                  = Max<tmsize_t>( 0, Min( size, available ) );
+    memcpy( buf, TiffMemData( stream ) + stream->pos, size );
+    stream->pos += size;
+    return size;
+}
+
+static tmsize_t TiffMemWrite( thandle_t handle, void* buf, tmsize_t size )
+{
+    TiffMemStream* stream = static_cast<TiffMemStream*>( handle );
+    if ( stream->readOnlyData )
+        return 0;
+    if ( stream->pos + size > stream->bytes.size() )
+        stream->bytes.resize( stream->pos + size );
+    memcpy( stream->bytes.data() + stream->pos, buf, size );
+    stream->pos += size;
+    return size;
+}
+
+static toff_t TiffMemSeek( thandle_t handle, toff_t offset, int whence )
+{
+    TiffMemStream* stream = static_cast<TiffMemStream*>( handle );
+    if ( whence == SEEK_CUR )
+        offset += stream->pos;
+    else if ( whence == SEEK_END )
+        offset += TiffMemSize( handle );
+    stream->pos = offset;
+    return stream->pos;
+}
+
+static int TiffMemClose( thandle_t ) { return 0; }
+static int TiffMemMap( thandle_t, void**, toff_t* ) { return 0; }
+static void TiffMemUnmap( thandle_t, void*, toff_t ) {}
+
+TIFF* TiffMemOpen( TiffMemStream& stream, const char* name, const char* mode )
+{
+    return TIFFClientOpen( name, mode, &stream, TiffMemRead, TiffMemWrite, TiffMemSeek, TiffMemClose, TiffMemSize, TiffMemMap, TiffMemUnmap );
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "tiffio.h"
+#include <cstdint>
+#include <vector>
+
+// Minimal in-memory file for libtiff. Writes go into 'bytes'. Reads come from 'readOnlyData' if it's set (without copying it),
+// and from 'bytes' otherwise
+struct TiffMemStream
+{
+    std::vector<uint8_t> bytes;
+    const uint8_t* readOnlyData = nullptr;
+    size_t readOnlySize         = 0;
+    toff_t pos                  = 0;
+};
+
+// 'mode' is the same as TIFFOpen's. The stream has to outlive the returned TIFF
+TIFF* TiffMemOpen( TiffMemStream& stream, const char* name, const char* mode );